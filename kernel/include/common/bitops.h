@@ -0,0 +1,56 @@
+/**
+ * @file bitops.h
+ * @author Zack Bostock
+ * @brief Word-sized bit manipulation helpers
+ * @verbatim
+ * The kernel is built for baseline x86-64 without linking libgcc, so the
+ * population count is done by hand instead of through
+ * __builtin_popcountll (which would emit a call to __popcountdi2). The
+ * trailing zero count maps straight onto bsf/tzcnt.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/* ---------------------------- LITERAL CONSTANTS --------------------------- */
+#define BITS_PER_WORD       (64)
+
+/* -------------------------------- GLOBALS --------------------------------- */
+
+/* --------------------------------- MACROS --------------------------------- */
+
+/**
+ * @brief Mask of count set bits starting at bit first (count <= 64)
+ */
+#define BIT_RANGE_MASK(first, count)                                        \
+    ((count) >= BITS_PER_WORD ? ~((uint64_t) 0) :                           \
+     ((((uint64_t) 1 << (count)) - 1) << (first)))
+
+/* --------------------------- INTERNALLY DEFINED --------------------------- */
+
+/**
+ * @brief Counts the trailing zero bits of a word
+ *
+ * @param word Word to inspect, must not be 0
+ * @return uint64_t Index of the lowest set bit
+ */
+static inline uint64_t bit_ctz64(uint64_t word) {
+    return (uint64_t) __builtin_ctzll(word);
+}
+
+/**
+ * @brief Counts the number of set bits in a word (SWAR popcount)
+ *
+ * @param word Word to count
+ * @return uint64_t Number of set bits
+ */
+static inline uint64_t bit_popcount64(uint64_t word) {
+    word = word - ((word >> 1) & 0x5555555555555555);
+    word = (word & 0x3333333333333333) + ((word >> 2) & 0x3333333333333333);
+    word = (word + (word >> 4)) & 0x0F0F0F0F0F0F0F0F;
+    return (word * 0x0101010101010101) >> 56;
+}
@@ -15,10 +15,23 @@
 #include <structs/kmalloc_str.h>
 
 /* ---------------------------- LITERAL CONSTANTS --------------------------- */
-#define KMEM_MAGIC_NUMBER   (0xBEEFBEEF)
+/* Size of the callsite table, must be a power of two */
+#define KMEM_MAX_CALLSITES      (1024)
+#define KMEM_CALLSITE_UNKNOWN   (0)
+
+/* Small requests are served by the slab allocator (sys/mem/slab.c), build */
+/* with make CPPFLAGS=-DKMALLOC_SLAB=0 to use whole pages for everything   */
+#ifndef KMALLOC_SLAB
+#define KMALLOC_SLAB        (1)
+#endif
+
+#if KMALLOC_SLAB
+#define KMALLOC_NAME        "slab"
+#else
+#define KMALLOC_NAME        "pages"
+#endif
 
 /* -------------------------------- GLOBALS --------------------------------- */
-extern size_t kmalloc_checkno;
 
 /* --------------------------------- MACROS --------------------------------- */
 
@@ -27,6 +40,9 @@ void *kmalloc_impl(uint64_t size, const char *func, size_t line);
 void kfree_impl(void *address, const char *func, size_t line);
 void *krealloc_impl(void *address, size_t new_size, const char *func,
                     size_t line);
+uint64_t kmalloc_size(void *address);
+KMEM_CALLSITE *kmalloc_callsite(uint16_t id);
+void kmalloc_print_live();
 
 #define kmalloc(x)      kmalloc_impl(x, __func__, __LINE__)
 #define kfree(x)        kfree_impl(x, __func__, __LINE__)
@@ -9,6 +9,8 @@
 
 #pragma once
 
+#include <globals.h>
+
 #include <structs/lock_str.h>
 
 /* ---------------------------- LITERAL CONSTANTS --------------------------- */
@@ -18,8 +20,27 @@
 /* --------------------------- INTERNALLY DEFINED --------------------------- */
 void lock_lock_implementation(LOCK *s, const char *f, const int ln);
 void unlock_lock_implementation(LOCK *s, const char *f, const int ln);
+STATUS lock_try_implementation(LOCK *s, const char *f, const int ln);
+void qlock_lock_implementation(QLOCK *s, const char *f, const int ln);
+void qlock_unlock_implementation(QLOCK *s, const char *f, const int ln);
+STATUS qlock_try_implementation(QLOCK *s, const char *f, const int ln);
 
 /* --------------------------------- MACROS --------------------------------- */
-#define LOCK_NEW()      (LOCK) {0, 0}
-#define LOCK_LOCK(x)    lock_lock_implementation(x, __FILE__, __LINE__)
-#define UNLOCK_LOCK(x)  unlock_lock_implementation(x, __FILE__, __LINE__)
+#define LOCK_NEW()      (LOCK) {0, {0}}
+#define QLOCK_NEW()     (QLOCK) {0, NULL, NULL}
+
+/*
+  The same macros take either kind of lock. LOCK (ticket) suits short
+  critical sections, QLOCK (MCS) waiters each spin on their own cache line
+  so it holds up better under contention, but it can only be taken after
+  cpu_init has run on the calling CPU.
+*/
+#define LOCK_LOCK(x)                                                \
+  _Generic((x), QLOCK *: qlock_lock_implementation,                 \
+                default: lock_lock_implementation)(x, __FILE__, __LINE__)
+#define UNLOCK_LOCK(x)                                              \
+  _Generic((x), QLOCK *: qlock_unlock_implementation,               \
+                default: unlock_lock_implementation)(x, __FILE__, __LINE__)
+#define LOCK_TRY(x)                                                 \
+  _Generic((x), QLOCK *: qlock_try_implementation,                  \
+                default: lock_try_implementation)(x, __FILE__, __LINE__)
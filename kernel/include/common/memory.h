@@ -13,13 +13,71 @@
 #include <stddef.h>
 
 /* ---------------------------- LITERAL CONSTANTS --------------------------- */
+/* Shortest request which is worth the startup cost of rep movsb/stosb */
+#define MEM_REP_THRESHOLD   (256)
+
+/* Every byte of a word set to 0x01 and to 0x80 */
+#define MEM_ONES            (0x0101010101010101ULL)
+#define MEM_HIGHS           (0x8080808080808080ULL)
+
+/* Unaligned words which may alias anything */
+typedef uint64_t __attribute__((__may_alias__, __aligned__(1))) MEM_WORD;
+typedef uint32_t __attribute__((__may_alias__, __aligned__(1))) MEM_WORD32;
 
 /* -------------------------------- GLOBALS --------------------------------- */
 
 /* --------------------------------- MACROS --------------------------------- */
 
+/*
+  Sets the high bit of the first zero byte of a word (bytes above it may be
+  flagged too), zero if no byte is zero.
+*/
+#define MEM_HAS_ZERO(word)    (((word) - MEM_ONES) & ~(word) & MEM_HIGHS)
+
+/* Index of the first byte flagged by MEM_HAS_ZERO, which must be non-zero */
+#define MEM_ZERO_INDEX(mask)  ((size_t) __builtin_ctzll(mask) / 8)
+
+/*
+  Compares of a constant 4 or 8 bytes (ACPI signatures and the like) are a
+  single load and compare, comparing for equality needs no byte swap at all
+  once the compiler is done.
+*/
+#define memcmp(ptr1, ptr2, num)                                             \
+    (__builtin_constant_p(num) && (num) == 8 ? mem_cmp8((ptr1), (ptr2)) :  \
+     __builtin_constant_p(num) && (num) == 4 ? mem_cmp4((ptr1), (ptr2)) :  \
+     memcmp((ptr1), (ptr2), (num)))
+
+/**
+ * @brief Compares 8 bytes as memcmp would
+ *
+ * @param ptr1 First memory location
+ * @param ptr2 Second memory location
+ * @return int Less than, equal to or greater than 0 like memcmp
+ */
+static inline int mem_cmp8(const void *ptr1, const void *ptr2) {
+    /* Byte swapped, the first byte is the most significant */
+    uint64_t a = __builtin_bswap64(*(const MEM_WORD *) ptr1);
+    uint64_t b = __builtin_bswap64(*(const MEM_WORD *) ptr2);
+    return (a > b) - (a < b);
+}
+
+/**
+ * @brief Compares 4 bytes as memcmp would
+ *
+ * @param ptr1 First memory location
+ * @param ptr2 Second memory location
+ * @return int Less than, equal to or greater than 0 like memcmp
+ */
+static inline int mem_cmp4(const void *ptr1, const void *ptr2) {
+    uint32_t a = __builtin_bswap32(*(const MEM_WORD32 *) ptr1);
+    uint32_t b = __builtin_bswap32(*(const MEM_WORD32 *) ptr2);
+    return (a > b) - (a < b);
+}
+
 /* --------------------------- INTERNALLY DEFINED --------------------------- */
+void memory_init();
 void *memcpy(void *, const void *, size_t);
 void *memset(void *, int, size_t);
-int memcmp(const void *, const void *, size_t);
+int (memcmp)(const void *, const void *, size_t);
 void *memmove(void *, const void *, size_t);
+void *memchr(const void *, int, size_t);
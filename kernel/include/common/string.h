@@ -18,3 +18,5 @@
 /* --------------------------- INTERNALLY DEFINED --------------------------- */
 char *strncpy(char *destination, const char *source, size_t num);
 size_t strlen(const char *str);
+int strcmp(const char *str1, const char *str2);
+int strncmp(const char *str1, const char *str2, size_t num);
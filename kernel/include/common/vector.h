@@ -17,6 +17,7 @@
 
 #include <common/string.h>
 #include <common/kmalloc.h>
+#include <sys/mem/vmalloc.h>
 #include <common/memory.h>
 
 #define vector_struct(type)                                                 \
@@ -53,6 +54,9 @@
 
 /**
  * @brief Appends an element at the back of the DSA, resizes if needed
+ * @verbatim
+ * Large DSAs are moved to vmalloc (see kvrealloc), so growing them does not
+ * depend on finding a physically contiguous run of frames.
  *
  * @param vec Vector to operate on
  * @param elem Element to append on end of vector
@@ -61,7 +65,7 @@
     (vec)->length++;                                                        \
     if ((vec)->capacity < ((vec)->length * sizeof(elem))) {                 \
         (vec)->capacity = (vec)->length * sizeof(elem) * RESIZE;            \
-        (vec)->data = krealloc((vec)->data, (vec)->capacity);               \
+        (vec)->data = kvrealloc((vec)->data, (vec)->capacity);              \
     }                                                                       \
     (vec)->data[(vec)->length - 1] = elem;                                  \
 }
@@ -84,10 +88,10 @@
  * @param vec Vector to operate on
  */
 #define vector_free(vec) {                                                  \
-    (vec)->len = 0;                                                         \
+    (vec)->length = 0;                                                      \
     (vec)->capacity = 0;                                                    \
     if ((vec)->data != NULL) {                                              \
-        kfree((vec)->data);                                                 \
+        kvfree((vec)->data);                                                \
     }                                                                       \
     (vec)->data = NULL;                                                     \
 }
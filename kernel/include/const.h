@@ -56,6 +56,11 @@
 #define SYS_OK    (1)
 #define SYS_ERR (0)
 
+/* Boot-time benchmarks, enable with make CPPFLAGS=-DKERNEL_BENCHMARKS=1 */
+#ifndef KERNEL_BENCHMARKS
+#define KERNEL_BENCHMARKS (0)
+#endif
+
 /* Common */
 #define FALSE   (0)
 #define TRUE    (1)
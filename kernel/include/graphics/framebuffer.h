@@ -13,6 +13,7 @@
 
 #include <common/memory.h>
 #include <sys/asm.h>
+#include <sys/mmu.h>
 
 /* ---------------------------- LITERAL CONSTANTS --------------------------- */
 #define DEFAULT_BG (COLOR_BLACK)
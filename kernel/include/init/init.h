@@ -20,6 +20,7 @@
 #include <sys/pci.h>
 #include <sys/cmos.h>
 #include <sys/cpu.h>
+#include <sys/fpu.h>
 #include <sys/gdt/gdt.h>
 #include <sys/mmu.h>
 #include <sys/interrupts/isr.h>
@@ -29,9 +30,12 @@
 
 #include <init/psf.h>
 #include <init/boot_info.h>
+#include <init/reclaim.h>
 
 #include <graphics/framebuffer.h>
 
+#include <util/bench.h>
+
 /* ---------------------------- LITERAL CONSTANTS --------------------------- */
 
 /* -------------------------------- GLOBALS --------------------------------- */
@@ -0,0 +1,25 @@
+/**
+ * @file reclaim.h
+ * @author Zack Bostock
+ * @brief Information pertaining to reclaiming bootloader and ACPI memory
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <globals.h>
+
+#include <common/limine_typedefs.h>
+
+/* ---------------------------- LITERAL CONSTANTS --------------------------- */
+
+/* -------------------------------- GLOBALS --------------------------------- */
+
+/* --------------------------------- MACROS --------------------------------- */
+
+/* --------------------------- INTERNALLY DEFINED --------------------------- */
+void boot_reclaim(volatile LIMINE_MEM_REQ *mem_req,
+                  volatile LIMINE_MODULE_REQ *module_req,
+                  volatile LIMINE_RSDP_REQ *rsdp_req);
@@ -12,6 +12,7 @@
 #include <globals.h>
 
 /* ---------------------------- LITERAL CONSTANTS --------------------------- */
+#define KERNEL_STACK_SIZE   (64 * 1024)
 
 /* -------------------------------- GLOBALS --------------------------------- */
 
@@ -22,3 +23,4 @@
 /* --------------------------- EXTERNALLY DEFINED --------------------------- */
 void system_init();
 void terminal_puts(TERMINAL *t, const char *s);
+void zero_pool_idle();
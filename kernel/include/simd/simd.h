@@ -0,0 +1,25 @@
+/**
+ * @file simd.h
+ * @author Zack Bostock
+ * @brief Routines built with SIMD enabled
+ * @verbatim
+ * Every routine here uses vector registers, so it may only be called
+ * between kernel_fpu_begin and kernel_fpu_end, and only if the CPU has the
+ * extension in its name (see fpu_has_avx2).
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <globals.h>
+
+/* ---------------------------- LITERAL CONSTANTS --------------------------- */
+
+/* -------------------------------- GLOBALS --------------------------------- */
+
+/* --------------------------------- MACROS --------------------------------- */
+
+/* --------------------------- INTERNALLY DEFINED --------------------------- */
+void memcpy_avx2(void *dst, const void *src, size_t num);
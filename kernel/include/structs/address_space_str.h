@@ -10,10 +10,21 @@
 #pragma once
 
 #include <common/lock.h>
-#include <common/vector.h>
+#include <structs/page_info_str.h>
+#include <structs/vma_str.h>
 
-typedef struct {
+typedef struct ADDR_SPACE {
     uint64_t *pml4;
-    vector_struct(uint64_t) memory_list;
+    /* Paging structures owned by this address space, including the PML4 */
+    PAGE_LIST tables;
+    /* Areas mapped with vm_map_region, see vma.c */
+    VMA_TREE vmas;
     LOCK lock;
+
+    /* Tag of this address space's TLB entries, see tlb.c */
+    uint16_t pcid;
+    /* Set when entries tagged with pcid may be stale */
+    uint8_t pcid_stale;
+    /* pcid is only valid while this matches the current PCID generation */
+    uint64_t pcid_generation;
 } ADDR_SPACE;
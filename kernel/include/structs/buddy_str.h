@@ -0,0 +1,32 @@
+/**
+ * @file buddy_str.h
+ * @author Zack Bostock
+ * @brief Structs pertaining to the buddy physical memory allocator
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/* Largest block is 2^BUDDY_MAX_ORDER pages (4 MB) */
+#define BUDDY_MAX_ORDER     (10)
+
+/* Free list link, stored inside the free block itself */
+typedef struct BUDDY_BLOCK {
+    struct BUDDY_BLOCK *next;
+    struct BUDDY_BLOCK *prev;
+} BUDDY_BLOCK;
+
+typedef struct {
+    BUDDY_BLOCK *free_lists[BUDDY_MAX_ORDER + 1];
+    uint64_t free_blocks[BUDDY_MAX_ORDER + 1];
+
+    /* Per frame, order of the free block starting at the frame (if any) */
+    uint8_t *orders;
+    /* Physical frame number of frame 0, see buddy_init */
+    uint64_t first_page;
+    uint64_t num_pages;
+} BUDDY;
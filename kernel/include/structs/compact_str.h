@@ -0,0 +1,33 @@
+/**
+ * @file compact_str.h
+ * @author Zack Bostock
+ * @brief Structs pertaining to compaction of physical memory
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <structs/lock_str.h>
+
+/* Runs the fragmentation index is measured against (2 MB), and its scale */
+#define COMPACT_ORDER           (9)
+#define COMPACT_INDEX_SCALE     (1000)
+
+typedef struct {
+    /* Only one compaction runs at a time */
+    LOCK lock;
+
+    /* Statistics */
+    uint64_t runs;
+    uint64_t successes;
+    uint64_t failures;
+    /* Runs which found the kernel address space locked by their caller */
+    uint64_t busy;
+    /* Pages moved, and cached frames given back to coalesce */
+    uint64_t migrated;
+    uint64_t drained;
+} COMPACT_STATS;
@@ -0,0 +1,40 @@
+/**
+ * @file cpu_local_str.h
+ * @author Zack Bostock
+ * @brief Structs pertaining to per-CPU data
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <structs/pm_magazine_str.h>
+#include <structs/zero_pool_str.h>
+#include <structs/lock_str.h>
+
+/* Pointed to by the GS base of each CPU, self must stay the first member */
+typedef struct CPU_LOCAL {
+    struct CPU_LOCAL *self;
+    uint64_t cpu_number;
+    uint8_t online;
+    /* Last PCID generation whose stale entries this CPU has flushed */
+    uint64_t pcid_generation;
+    /* Address space loaded by tlb_switch, NULL until the first switch */
+    struct ADDR_SPACE *addr_space;
+    /* NUMA node of this CPU, set by numa_init */
+    uint32_t node;
+
+    /* Extended state saved by kernel_fpu_begin, see fpu.c */
+    uint8_t *fpu_state;
+    uint32_t fpu_depth;
+    uint64_t fpu_rflags;
+
+    PM_MAGAZINE pm_magazine;
+    ZERO_POOL zero_pool;
+
+    /* Nodes this CPU queues on QLOCKs with, see lock.c */
+    QLOCK_NODE qlock_nodes[QLOCK_MAX_NODES];
+} CPU_LOCAL;
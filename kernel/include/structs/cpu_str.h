@@ -18,6 +18,7 @@
 
 typedef struct {
   uint32_t feature;
+  /* Subleaf, passed to cpuid in ECX */
   uint32_t param;
   enum {
     CPUID_EAX   = 0x0,
@@ -32,3 +33,24 @@ typedef struct {
     uint32_t ebx;
     const char *vendor_name;
 } VENDOR;
+
+/* Most caches which are recorded, e.g. L1d, L1i, L2 and L3 */
+#define CPU_MAX_CACHES      (8)
+
+/* Cache types, as encoded by cpuid leaf 4 and 0x8000001D */
+#define CPU_CACHE_DATA          (1)
+#define CPU_CACHE_INSTRUCTION   (2)
+#define CPU_CACHE_UNIFIED       (3)
+
+typedef struct {
+    uint8_t level;
+    uint8_t type;
+    uint16_t line_size;
+    uint32_t ways;
+    uint32_t partitions;
+    uint32_t sets;
+    /* Logical processors sharing the cache, 0 if unknown */
+    uint32_t shared_threads;
+    /* Bytes, ways * partitions * line_size * sets */
+    uint64_t size;
+} CPU_CACHE;
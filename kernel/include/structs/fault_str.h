@@ -0,0 +1,28 @@
+/**
+ * @file fault_str.h
+ * @author Zack Bostock
+ * @brief Structs pertaining to page fault handling
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/* Bucket i of the latency histogram counts faults which took */
+/* [2^(i + FAULT_HIST_SHIFT), 2^(i + FAULT_HIST_SHIFT + 1)) TSC cycles */
+#define FAULT_HIST_BUCKETS  (16)
+#define FAULT_HIST_SHIFT    (8)
+
+typedef struct {
+    uint64_t faults;
+    /* Faults which were resolved by backing a reserved page */
+    uint64_t resolved;
+
+    /* TSC cycles spent resolving faults */
+    uint64_t total_cycles;
+    uint64_t max_cycles;
+    uint64_t histogram[FAULT_HIST_BUCKETS];
+} FAULT_STATS;
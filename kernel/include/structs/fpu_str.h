@@ -0,0 +1,25 @@
+/**
+ * @file fpu_str.h
+ * @author Zack Bostock
+ * @brief Structs pertaining to the FPU and SIMD state used by the kernel
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/* Features found on the boot CPU, which every CPU is assumed to share */
+typedef struct {
+    uint8_t xsave;
+    uint8_t xsaveopt;
+    uint8_t avx;
+    uint8_t avx2;
+    uint8_t avx512;
+    /* State components enabled in XCR0 */
+    uint64_t xcr0;
+    /* Bytes of a save area for the components in xcr0 */
+    uint32_t state_size;
+} FPU_INFO;
@@ -0,0 +1,26 @@
+/**
+ * @file frame_bitmap_str.h
+ * @author Zack Bostock
+ * @brief Structs pertaining to the physical frame bitmap
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+typedef struct {
+    /* One bit per 4 KB frame, a set bit means the frame is free */
+    uint64_t *words;
+    uint64_t num_words;
+    uint64_t num_pages;
+
+    /* Free frame count for each region, full regions are skipped in scans */
+    uint32_t *region_free;
+    uint64_t num_regions;
+
+    /* Next-fit hint, frame index where the next search starts */
+    uint64_t cursor;
+} FRAME_BITMAP;
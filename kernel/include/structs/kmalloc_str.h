@@ -7,13 +7,14 @@
  *
  */
 
+#pragma once
+
 #include <stddef.h>
 
+/**
+ * @brief Interned kmalloc callsite, allocations refer to it by ID
+ */
 typedef struct {
-    size_t magic;
-    size_t checkno;
-    size_t num_pages;
-    size_t size;
-    char file_name[512];
-    size_t lineno;
-} KMEM_METADATA;
+    const char *func;
+    size_t line;
+} KMEM_CALLSITE;
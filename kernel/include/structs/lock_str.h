@@ -11,7 +11,35 @@
 
 #include <stdint.h>
 
+/* Queue lock nodes per CPU, i.e. how many QLOCKs a CPU may hold at once */
+#define QLOCK_MAX_NODES     (4)
+
+/*
+  Ticket lock, each locker takes the next ticket and waits until owner
+  reaches it, so the lock is handed out in the order it was asked for.
+*/
 typedef struct {
   uint64_t rflags;
-  int lock;
+  union {
+    uint32_t lock;
+    struct {
+      uint16_t owner;
+      uint16_t next;
+    };
+  };
 } LOCK;
+
+/* Per-CPU node a QLOCK waiter spins on, on its own cache line */
+typedef struct QLOCK_NODE {
+  struct QLOCK_NODE *next;
+  uint32_t locked;
+  uint8_t in_use;
+} __attribute__((aligned(64))) QLOCK_NODE;
+
+/* MCS queue lock, tail is the last node in the queue, NULL when free */
+typedef struct {
+  uint64_t rflags;
+  QLOCK_NODE *tail;
+  /* Node of the CPU holding the lock */
+  QLOCK_NODE *holder;
+} QLOCK;
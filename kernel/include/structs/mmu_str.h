@@ -11,10 +11,40 @@
 
 #include <stdint.h>
 
+#include <structs/pm_pool_str.h>
+#include <structs/numa_str.h>
+#include <structs/page_info_str.h>
+
+typedef struct {
+  /* Frames covered by the zone's pools, including holes */
+  uint64_t num_pages;
+  /* Free pages (summed over the zone's pools) which allocations falling */
+  /* back from a higher zone leave alone */
+  uint64_t watermark_min;
+  /* Below this many free pages the zone is under pressure */
+  uint64_t watermark_low;
+
+  /* Allocations served by this zone which wanted a higher zone */
+  uint64_t fallbacks;
+} PM_ZONE;
+
 typedef struct {
   uint64_t physical_limit;
   uint64_t total_size;
   uint64_t free_size;
 
   uint8_t *bitmap;
+  uint64_t bitmap_size;
+
+  /* Sorted by address, together they cover every frame below the limit */
+  PM_POOL pools[PM_MAX_POOLS];
+  uint64_t num_pools;
+  PM_ZONE zones[PM_NUM_ZONES];
+
+  /* Per requesting node, allocations served by that node and by others */
+  uint64_t local_allocs[NUMA_MAX_NODES];
+  uint64_t remote_allocs[NUMA_MAX_NODES];
+
+  /* One entry per frame, stored right after the pools' backends */
+  PAGE_INFO *page_info;
 } KERNEL_MEM_INFO;
@@ -0,0 +1,116 @@
+/**
+ * @file numa_str.h
+ * @author Zack Bostock
+ * @brief Structs pertaining to the ACPI SRAT and SLIT, which describe the
+ *        NUMA topology of the machine
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <structs/acpi_str.h>
+
+/* Most nodes and memory ranges which are tracked, the rest count as node 0 */
+#define NUMA_MAX_NODES      (8)
+#define NUMA_MAX_RANGES     (32)
+
+/**
+ * @brief Static Resource Affinity Table (SRAT)
+ */
+typedef struct {
+    ACPI_SDT_HEADER header;
+
+    uint32_t reserved1;
+    uint64_t reserved2;
+
+    uint8_t records[];
+} __attribute__((packed)) SRAT;
+
+/**
+ * @brief SRAT record header, same layout as the MADT's
+ */
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed)) SRAT_RECORD_HEADER;
+
+/**
+ * @brief Proximity domain of a local APIC
+ * Entry Type: 0
+ */
+typedef struct {
+    SRAT_RECORD_HEADER header;
+
+    uint8_t domain_low;
+    uint8_t apic_id;
+    uint32_t flags;
+    uint8_t sapic_eid;
+    uint8_t domain_high[3];
+    uint32_t clock_domain;
+} __attribute__((packed)) SRAT_RECORD_LAPIC;
+
+/**
+ * @brief Proximity domain of a range of physical memory
+ * Entry Type: 1
+ */
+typedef struct {
+    SRAT_RECORD_HEADER header;
+
+    uint32_t domain;
+    uint16_t reserved1;
+    uint64_t base;
+    uint64_t length;
+    uint32_t reserved2;
+    uint32_t flags;
+    uint64_t reserved3;
+} __attribute__((packed)) SRAT_RECORD_MEMORY;
+
+/**
+ * @brief Proximity domain of a local x2APIC
+ * Entry Type: 2
+ */
+typedef struct {
+    SRAT_RECORD_HEADER header;
+
+    uint16_t reserved1;
+    uint32_t domain;
+    uint32_t x2apic_id;
+    uint32_t flags;
+    uint32_t clock_domain;
+    uint32_t reserved2;
+} __attribute__((packed)) SRAT_RECORD_X2APIC;
+
+/**
+ * @brief System Locality Information Table (SLIT)
+ * @verbatim
+ * Matrix of num_localities^2 relative distances, entry i * n + j being the
+ * distance from proximity domain i to j. Local accesses are always 10.
+ */
+typedef struct {
+    ACPI_SDT_HEADER header;
+
+    uint64_t num_localities;
+
+    uint8_t entries[];
+} __attribute__((packed)) SLIT;
+
+/**
+ * @brief Physical memory range of a node, base and length in bytes
+ */
+typedef struct {
+    uint64_t base;
+    uint64_t length;
+    uint32_t node;
+} NUMA_RANGE;
+
+/**
+ * @brief Local APIC ID of a processor and the node it belongs to
+ */
+typedef struct {
+    uint32_t apic_id;
+    uint32_t node;
+} NUMA_CPU;
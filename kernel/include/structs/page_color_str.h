@@ -0,0 +1,39 @@
+/**
+ * @file page_color_str.h
+ * @author Zack Bostock
+ * @brief Structs pertaining to page coloring of physical frames
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <structs/lock_str.h>
+
+/* Most colors used (one refill is this many frames), and frames per color */
+#define PAGE_COLOR_MAX      (512)
+#define PAGE_COLOR_DEPTH    (2)
+
+typedef struct {
+    /* Physical addresses of free frames of one color */
+    uint64_t frames[PAGE_COLOR_DEPTH];
+    uint64_t count;
+} PAGE_COLOR_BIN;
+
+typedef struct {
+    PAGE_COLOR_BIN bins[PAGE_COLOR_MAX];
+    /* Power of two, 1 if the cache geometry is unknown */
+    uint64_t num_colors;
+    uint64_t cached;
+    LOCK lock;
+
+    /* Statistics */
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t refills;
+    /* Frames of a refill given back because their bin was full */
+    uint64_t returned;
+} PAGE_COLORS;
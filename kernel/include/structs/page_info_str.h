@@ -0,0 +1,46 @@
+/**
+ * @file page_info_str.h
+ * @author Zack Bostock
+ * @brief Structs pertaining to per-frame physical memory metadata
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * @brief Metadata kept for every physical 4 KB frame, indexed by frame number
+ */
+typedef struct {
+    /* PAGE_TYPE_*, who owns the frame */
+    uint8_t type;
+    /* Size class shift of slab pages */
+    uint8_t order;
+    union {
+        /* Interned kmalloc callsite of the first frame of an allocation */
+        uint16_t callsite;
+        /* Number of present entries in a paging structure */
+        uint16_t live_entries;
+    };
+    union {
+        /* Bytes requested by kmalloc, stored in the first frame */
+        uint32_t size;
+        /* Page of the vmalloc window a movable frame is mapped at */
+        uint32_t vmalloc_page;
+    };
+
+    /* Frame numbers of the neighbours while on a PAGE_LIST */
+    uint32_t next;
+    uint32_t prev;
+} PAGE_INFO;
+
+/**
+ * @brief Intrusive doubly linked list of frames, linked through PAGE_INFO
+ */
+typedef struct {
+    uint32_t head;
+    uint64_t count;
+} PAGE_LIST;
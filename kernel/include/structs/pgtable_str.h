@@ -0,0 +1,38 @@
+/**
+ * @file pgtable_str.h
+ * @author Zack Bostock
+ * @brief Structs pertaining to the page table page allocator
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <structs/lock_str.h>
+
+/* Zeroed frames kept ready, and how many are zeroed per refill */
+#define PGTABLE_POOL_SIZE   (64)
+#define PGTABLE_POOL_BATCH  (16)
+
+typedef struct {
+    /* Physical addresses of zeroed 4 KB frames */
+    uint64_t frames[PGTABLE_POOL_SIZE];
+    uint64_t count;
+    LOCK lock;
+
+    /* Statistics */
+    uint64_t in_use;
+    uint64_t hits;
+    uint64_t misses;
+} PGTABLE_POOL;
+
+/**
+ * @brief Page table memory used by one address space
+ */
+typedef struct {
+    uint64_t table_pages;
+    uint64_t table_bytes;
+} VM_STATS;
@@ -0,0 +1,28 @@
+/**
+ * @file pm_magazine_str.h
+ * @author Zack Bostock
+ * @brief Structs pertaining to the per-CPU physical frame caches
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/* Frames held by one CPU, and how many move to/from the global allocator */
+#define PM_MAGAZINE_SIZE    (64)
+#define PM_MAGAZINE_BATCH   (32)
+
+typedef struct {
+    /* Physical addresses of cached free 4 KB frames */
+    uint64_t frames[PM_MAGAZINE_SIZE];
+    uint64_t count;
+
+    /* Statistics */
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t refills;
+    uint64_t drains;
+} PM_MAGAZINE;
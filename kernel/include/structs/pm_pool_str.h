@@ -0,0 +1,40 @@
+/**
+ * @file pm_pool_str.h
+ * @author Zack Bostock
+ * @brief Structs pertaining to the free pools of the physical allocator
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <structs/frame_bitmap_str.h>
+#include <structs/buddy_str.h>
+
+/* Most pools the physical memory can be split into */
+#define PM_MAX_POOLS        (16)
+
+/* Zones, frames below 4 GB are kept for devices which can only DMA there */
+#define ZONE_DMA32          (0)
+#define ZONE_NORMAL         (1)
+#define PM_NUM_ZONES        (2)
+
+typedef struct {
+    /* Physical frames [first_page, first_page + num_pages) */
+    uint64_t first_page;
+    uint64_t num_pages;
+    uint64_t free_pages;
+    uint32_t node;
+    /* ZONE_DMA32 or ZONE_NORMAL, pools never straddle the 4 GB boundary */
+    uint8_t zone;
+
+    /* Only the backend selected by PM_BACKEND is used */
+    FRAME_BITMAP frames;
+    BUDDY buddy;
+
+    /* Statistics */
+    uint64_t allocs;
+} PM_POOL;
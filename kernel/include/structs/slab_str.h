@@ -0,0 +1,58 @@
+/**
+ * @file slab_str.h
+ * @author Zack Bostock
+ * @brief Structs pertaining to the slab allocator
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <structs/lock_str.h>
+
+/**
+ * @brief Free object, the link is stored inside the object itself
+ */
+typedef struct SLAB_OBJECT {
+    struct SLAB_OBJECT *next;
+    /* SLAB_FREE_POISON while the object is on a free list */
+    uint64_t poison;
+} SLAB_OBJECT;
+
+struct SLAB_CACHE;
+
+/**
+ * @brief Header at the start of every slab page
+ */
+typedef struct SLAB {
+    uint32_t magic;
+    uint16_t in_use;
+    uint16_t capacity;
+    SLAB_OBJECT *free_list;
+    struct SLAB *next;
+    struct SLAB *prev;
+    struct SLAB_CACHE *cache;
+} SLAB;
+
+/**
+ * @brief One size class
+ */
+typedef struct SLAB_CACHE {
+    uint64_t obj_size;
+    uint64_t capacity;
+    /* Slabs with at least one free object, full slabs are not tracked */
+    SLAB *partial;
+    LOCK lock;
+    /* Color of the next slab page, so a cache's slabs spread over the LLC */
+    uint64_t next_color;
+
+    /* Statistics */
+    uint64_t num_slabs;
+    uint64_t empty_slabs;
+    uint64_t in_use;
+    uint64_t allocs;
+    uint64_t frees;
+} SLAB_CACHE;
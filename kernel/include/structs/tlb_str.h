@@ -0,0 +1,70 @@
+/**
+ * @file tlb_str.h
+ * @author Zack Bostock
+ * @brief Structs pertaining to batched TLB invalidation and PCIDs
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <structs/address_space_str.h>
+
+/* Past this many pages a full flush is cheaper than invlpg'ing each one */
+#define TLB_FLUSH_THRESHOLD     (33)
+/* Freed page tables held back until the TLB no longer references them */
+#define TLB_GATHER_MAX_TABLES   (32)
+
+/* PCID 0 always belongs to the kernel address space */
+#define PCID_KERNEL             (0)
+#define PCID_FIRST              (1)
+#define PCID_COUNT              (4096)
+
+/* Invalidation types of the invpcid instruction */
+#define INVPCID_ADDRESS         (0)
+#define INVPCID_CONTEXT         (1)
+#define INVPCID_ALL_GLOBAL      (2)
+#define INVPCID_ALL             (3)
+
+/**
+ * @brief Invalidations collected over one vm_map or vm_unmap call
+ */
+typedef struct {
+    /* Address space being changed */
+    ADDR_SPACE *as;
+    /* Lower half of the address space is loaded on this CPU */
+    uint8_t live;
+    /* Not loaded, but entries tagged with its PCID may still be cached */
+    uint8_t tagged;
+    /* Kernel half (global) pages were changed */
+    uint8_t global;
+    /* Too many pages for invlpg, flush everything when finished */
+    uint8_t flush_all;
+
+    uint64_t num_pages;
+    uint64_t pages[TLB_FLUSH_THRESHOLD];
+
+    uint64_t num_tables;
+    uint64_t tables[TLB_GATHER_MAX_TABLES];
+} TLB_GATHER;
+
+typedef struct {
+    uint64_t pcid;
+    uint64_t address;
+} __attribute__((packed)) INVPCID_DESC;
+
+typedef struct {
+    uint64_t gathers;
+    uint64_t invlpgs;
+    uint64_t invpcids;
+    uint64_t full_flushes;
+    uint64_t global_flushes;
+    uint64_t deferred_tables;
+
+    uint64_t switches;
+    uint64_t switch_flushes;
+    uint64_t pcid_rollovers;
+} TLB_STATS;
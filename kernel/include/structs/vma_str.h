@@ -0,0 +1,48 @@
+/**
+ * @file vma_str.h
+ * @author Zack Bostock
+ * @brief Structs pertaining to virtual memory areas
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * @brief A mapped range of virtual memory, kept in a VMA_TREE
+ */
+typedef struct VMA {
+    /* First byte and one past the last byte of the area */
+    uint64_t start;
+    uint64_t end;
+    /* Physical address mapped at start, 0 if not physically contiguous */
+    uint64_t phys_addr;
+    uint64_t flags;
+    const char *name;
+    /* VMA_TYPE_FIXED, or VMA_TYPE_DEMAND / VMA_TYPE_VMALLOC if the area */
+    /* owns the frames it is backed with */
+    uint8_t type;
+
+    /* Red-black tree links */
+    struct VMA *parent;
+    struct VMA *left;
+    struct VMA *right;
+    uint8_t color;
+
+    /* Lowest start, highest end and largest hole between two areas in the */
+    /* subtree rooted at this node, kept up to date on every change */
+    uint64_t min_start;
+    uint64_t max_end;
+    uint64_t max_gap;
+} VMA;
+
+/**
+ * @brief Red-black interval tree of non-overlapping VMAs, ordered by start
+ */
+typedef struct {
+    VMA *root;
+    uint64_t count;
+} VMA_TREE;
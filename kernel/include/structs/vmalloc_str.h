@@ -0,0 +1,21 @@
+/**
+ * @file vmalloc_str.h
+ * @author Zack Bostock
+ * @brief Structs pertaining to virtually contiguous allocations
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+typedef struct {
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t failures;
+    /* How the allocations were backed */
+    uint64_t large_pages;
+    uint64_t small_pages;
+} VMALLOC_STATS;
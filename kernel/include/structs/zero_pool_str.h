@@ -0,0 +1,29 @@
+/**
+ * @file zero_pool_str.h
+ * @author Zack Bostock
+ * @brief Structs pertaining to the pool of pre-zeroed frames
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/* Zeroed frames kept ready per CPU, and how many are zeroed per idle pass */
+#define ZERO_POOL_SIZE      (64)
+#define ZERO_POOL_BATCH     (8)
+
+typedef struct {
+    /* Physical addresses of zeroed 4 KB frames */
+    uint64_t frames[ZERO_POOL_SIZE];
+    uint64_t count;
+
+    /* Statistics */
+    uint64_t hits;
+    uint64_t misses;
+    /* Bytes cleared while idle, and on the allocation path after a miss */
+    uint64_t background_bytes;
+    uint64_t sync_bytes;
+} ZERO_POOL;
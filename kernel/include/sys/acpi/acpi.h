@@ -34,6 +34,7 @@
 
 #include <sys/mmu.h>
 #include <sys/acpi/madt.h>
+#include <sys/acpi/numa.h>
 #include <sys/acpi/rsdp.h>
 #include <sys/asm.h>
 
@@ -46,4 +47,5 @@
 /* --------------------------- INTERNALLY DEFINED --------------------------- */
 ACPI_SDT *acpi_get_sdt(const char *signature);
 void acpi_init(LIMINE_RSDP_REQ req);
+void acpi_relocate(volatile LIMINE_RSDP_REQ *req);
 uint8_t calculate_checksum(const uint8_t *addr, size_t length);
@@ -59,6 +59,9 @@
 #define TMR_INT_ENB_CNF     (2)
 #define TMR_INT_TYPE_CNF    (1)
 
+/* Femtoseconds in a nanosecond, the main counter period is in femtoseconds */
+#define HPET_FS_PER_NS      (1000000)
+
 /* -------------------------------- GLOBALS --------------------------------- */
 extern HPET *hpet;
 
@@ -99,3 +102,4 @@ extern HPET *hpet;
 
 /* --------------------------- INTERNALLY DEFINED --------------------------- */
 STATUS hpet_init();
+uint64_t hpet_get_nanoseconds();
@@ -0,0 +1,39 @@
+/**
+ * @file numa.h
+ * @author Zack Bostock
+ * @brief Information pertaining to the NUMA topology found in the ACPI tables
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <globals.h>
+
+#include <structs/numa_str.h>
+
+#include <sys/acpi/acpi.h>
+
+/* ---------------------------- LITERAL CONSTANTS --------------------------- */
+#define SRAT_RECORD_TYPE_LAPIC      (0)
+#define SRAT_RECORD_TYPE_MEMORY     (1)
+#define SRAT_RECORD_TYPE_X2APIC     (2)
+
+/* Distances of the SLIT, used when the table is missing */
+#define NUMA_LOCAL_DISTANCE         (10)
+#define NUMA_REMOTE_DISTANCE        (20)
+
+/* -------------------------------- GLOBALS --------------------------------- */
+
+/* --------------------------------- MACROS --------------------------------- */
+#define SRAT_FLAG_ENABLED           (1 << 0)
+
+/* --------------------------- INTERNALLY DEFINED --------------------------- */
+void numa_init();
+uint32_t numa_num_nodes();
+uint32_t numa_num_ranges();
+NUMA_RANGE *numa_get_ranges();
+uint32_t numa_apic_node(uint32_t apic_id);
+uint8_t numa_distance(uint32_t from, uint32_t to);
+uint32_t numa_fallback(uint32_t node, uint32_t index);
@@ -99,6 +99,37 @@ static inline void enable_interrupts() {
     __asm__ volatile("sti");
 }
 
+/**
+ * @brief Saves RFLAGS and disables external interrupts.
+ *
+ * @return uint64_t RFLAGS before interrupts were disabled
+ */
+static inline uint64_t interrupts_save() {
+    uint64_t flags;
+    __asm__ volatile("pushfq; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+/**
+ * @brief Restores RFLAGS saved by interrupts_save.
+ *
+ * @param flags RFLAGS to restore
+ */
+static inline void interrupts_restore(uint64_t flags) {
+    __asm__ volatile("push %0; popfq" : : "r"(flags) : "memory", "cc");
+}
+
+/**
+ * @brief Reads the time stamp counter.
+ *
+ * @return uint64_t Number of reference cycles since reset
+ */
+static inline uint64_t read_tsc() {
+    uint32_t low, high;
+    __asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t) high << 32) | low;
+}
+
 /**
  * @brief Halts the processor and disables interrupts.
  */
@@ -12,6 +12,7 @@
 #include <globals.h>
 #include <structs/control_registers_str.h>
 #include <structs/cpu_str.h>
+#include <structs/cpu_local_str.h>
 
 /* GCC built-in cpuid headers */
 #include <cpuid.h>
@@ -39,8 +40,28 @@
 /* Holds the base address of the local Advanced Programmable Interrupt */
 /* Controller.                                                         */
 #define MSR_APIC_BASE           (0x0000001B)
+/* Architectural performance monitoring, see CPUID leaf 0xA */
+#define MSR_PERFEVTSEL0         (0x00000186)
+#define MSR_PMC0                (0x000000C1)
+/* Only present from architectural performance monitoring version 2 */
+#define MSR_PERF_GLOBAL_CTRL    (0x0000038F)
+
+/* Event select fields, count in ring 3 and ring 0 */
+#define PERFEVTSEL_USR          (1 << 16)
+#define PERFEVTSEL_OS           (1 << 17)
+#define PERFEVTSEL_ENABLE       (1 << 22)
+/* Architectural LLC miss event (event 0x2E, umask 0x41) */
+#define PERF_EVENT_LLC_MISSES   (0x412E)
+/* Its bit in CPUID.0xA EBX, set when the event is not available */
+#define PERF_EVENT_LLC_MISSES_BIT (4)
+
+/* With CR4.PCIDE set, the low 12 bits of CR3 hold the current PCID */
+#define CR3_PCID_MASK           (0xFFF)
+/* Set in a value written to CR3 to keep the TLB entries of the new PCID */
+#define CR3_NOFLUSH             (1ULL << 63)
 
 /* -------------------------------- GLOBALS --------------------------------- */
+extern CPU_LOCAL cpu_locals[MAX_CPUS];
 
 /* --------------------------------- MACROS --------------------------------- */
 
@@ -82,6 +103,9 @@
 /* --------------------------- INTERNALLY DEFINED --------------------------- */
 void cpu_init(size_t cpu_number);
 STATUS check_cpu_support(CPUID_FEATURE feature);
+uint8_t cpu_num_caches();
+CPU_CACHE *cpu_get_cache(uint8_t index);
+CPU_CACHE *cpu_llc();
 
 /**
  * @brief Uses the the cpuid function from gcc to determine the availability
@@ -106,6 +130,25 @@ static inline STATUS cpuid(uint32_t feature, uint32_t *eax, uint32_t *ebx,
     return SYS_OK;
 }
 
+/**
+ * @brief Same as cpuid, for leaves which take a subleaf in ECX
+ *
+ * @param feature Leaf to pass into cpuid
+ * @param subleaf Subleaf to pass into cpuid
+ * @param eax EAX register to pass into cpuid
+ * @param ebx EBX register to pass into cpuid
+ * @param ecx ECX register to pass into cpuid
+ * @param edx EDX register to pass into cpuid
+ */
+static inline STATUS cpuid_count(uint32_t feature, uint32_t subleaf,
+                                 uint32_t *eax, uint32_t *ebx, uint32_t *ecx,
+                                 uint32_t *edx) {
+    if (__get_cpuid_count(feature, subleaf, eax, ebx, ecx, edx) != 1) {
+        return SYS_ERR;
+    }
+    return SYS_OK;
+}
+
 /**
  * @brief Reads the model specific register specified.
  *
@@ -143,4 +186,16 @@ static inline void write_msr(uint32_t msr, uint64_t val) {
                      :
                      : [msr] "g"(msr), [low] "g"(low), [high] "g"(high)
                      : "eax", "ecx", "edx");
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Gets the per-CPU data of the calling CPU through the GS base.
+ * @note Only valid after cpu_init has run on the calling CPU
+ *
+ * @return CPU_LOCAL * Per-CPU data of the calling CPU
+ */
+static inline CPU_LOCAL *this_cpu() {
+    CPU_LOCAL *local;
+    __asm__ volatile("mov %%gs:0, %0" : "=r"(local));
+    return local;
+}
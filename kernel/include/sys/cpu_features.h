@@ -84,6 +84,31 @@ enum {
     CPUID_FEAT_EDX_PBE          = 1 << 31
 };
 
+/* Extended features, cpuid with 0x80000001 in eax */
+enum {
+    CPUID_FEAT_EXT_ECX_TOPOEXT  = 1 << 22,
+
+    CPUID_FEAT_EXT_EDX_NX       = 1 << 20,
+    CPUID_FEAT_EXT_EDX_PDPE1GB  = 1 << 26,
+    CPUID_FEAT_EXT_EDX_RDTSCP   = 1 << 27,
+    CPUID_FEAT_EXT_EDX_LM       = 1 << 29
+};
+
+/* Structured extended features, cpuid with 0x7 in eax and 0x0 in ecx */
+enum {
+    CPUID_FEAT_EXT7_EBX_AVX2    = 1 << 5,
+    CPUID_FEAT_EXT7_EBX_ERMS    = 1 << 9,
+    CPUID_FEAT_EXT7_EBX_INVPCID = 1 << 10,
+    CPUID_FEAT_EXT7_EBX_AVX512F = 1 << 16,
+
+    CPUID_FEAT_EXT7_EDX_FSRM    = 1 << 4,
+};
+
+/* Extended state features, cpuid with 0xD in eax and 0x1 in ecx */
+enum {
+    CPUID_FEAT_XSAVE_EAX_XSAVEOPT = 1 << 0,
+};
+
 /*
   Here are CPU vendor defines for determining the CPU vendor using the cpuid
   command with 0x0 inputted in the "feature" parameter (which goes into eax).
@@ -143,8 +168,88 @@ static const CPUID_FEATURE cpuid_feature_pat = {
     .mask = CPUID_FEAT_EDX_PAT
 };
 
+static const CPUID_FEATURE cpuid_feature_pge = {
+    .feature = 0x00000001,
+    .registers = CPUID_EDX,
+    .mask = CPUID_FEAT_EDX_PGE,
+};
+
+static const CPUID_FEATURE cpuid_feature_pcid = {
+    .feature = 0x00000001,
+    .registers = CPUID_ECX,
+    .mask = CPUID_FEAT_ECX_PCID,
+};
+
+static const CPUID_FEATURE cpuid_feature_invpcid = {
+    .feature = 0x00000007,
+    .param = 0x0,
+    .registers = CPUID_EBX,
+    .mask = CPUID_FEAT_EXT7_EBX_INVPCID,
+};
+
+/* Enhanced rep movsb/stosb, fast for any length past the startup cost */
+static const CPUID_FEATURE cpuid_feature_erms = {
+    .feature = 0x00000007,
+    .param = 0x0,
+    .registers = CPUID_EBX,
+    .mask = CPUID_FEAT_EXT7_EBX_ERMS,
+};
+
+/* Fast short rep movsb, no startup cost for copies of up to 128 bytes */
+static const CPUID_FEATURE cpuid_feature_fsrm = {
+    .feature = 0x00000007,
+    .param = 0x0,
+    .registers = CPUID_EDX,
+    .mask = CPUID_FEAT_EXT7_EDX_FSRM,
+};
+
+static const CPUID_FEATURE cpuid_feature_xsave = {
+    .feature = 0x00000001,
+    .registers = CPUID_ECX,
+    .mask = CPUID_FEAT_ECX_XSAVE,
+};
+
+static const CPUID_FEATURE cpuid_feature_xsaveopt = {
+    .feature = 0x0000000D,
+    .param = 0x1,
+    .registers = CPUID_EAX,
+    .mask = CPUID_FEAT_XSAVE_EAX_XSAVEOPT,
+};
+
+static const CPUID_FEATURE cpuid_feature_avx = {
+    .feature = 0x00000001,
+    .registers = CPUID_ECX,
+    .mask = CPUID_FEAT_ECX_AVX,
+};
+
+static const CPUID_FEATURE cpuid_feature_avx2 = {
+    .feature = 0x00000007,
+    .param = 0x0,
+    .registers = CPUID_EBX,
+    .mask = CPUID_FEAT_EXT7_EBX_AVX2,
+};
+
+static const CPUID_FEATURE cpuid_feature_avx512f = {
+    .feature = 0x00000007,
+    .param = 0x0,
+    .registers = CPUID_EBX,
+    .mask = CPUID_FEAT_EXT7_EBX_AVX512F,
+};
+
 static const CPUID_FEATURE cpuid_feature_mtrr = {
     .feature = 0x00000001,
     .registers = CPUID_EDX,
     .mask = CPUID_FEAT_EDX_MTRR,
 };
+
+static const CPUID_FEATURE cpuid_feature_topoext = {
+    .feature = 0x80000001,
+    .registers = CPUID_ECX,
+    .mask = CPUID_FEAT_EXT_ECX_TOPOEXT,
+};
+
+static const CPUID_FEATURE cpuid_feature_pdpe1gb = {
+    .feature = 0x80000001,
+    .registers = CPUID_EDX,
+    .mask = CPUID_FEAT_EXT_EDX_PDPE1GB,
+};
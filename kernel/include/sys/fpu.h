@@ -0,0 +1,47 @@
+/**
+ * @file fpu.h
+ * @author Zack Bostock
+ * @brief Information pertaining to kernel use of the FPU and SIMD registers
+ * @verbatim
+ * The kernel is built without SSE, so only translation units under
+ * src/simd (built with SIMD enabled, see the Makefile) may touch vector
+ * registers, and only between kernel_fpu_begin and kernel_fpu_end.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <globals.h>
+
+#include <structs/fpu_str.h>
+
+/* ---------------------------- LITERAL CONSTANTS --------------------------- */
+/* State components of XCR0 */
+#define XCR0_X87            (1 << 0)
+#define XCR0_SSE            (1 << 1)
+#define XCR0_AVX            (1 << 2)
+#define XCR0_OPMASK         (1 << 5)
+#define XCR0_ZMM_HI256      (1 << 6)
+#define XCR0_HI16_ZMM       (1 << 7)
+#define XCR0_AVX512         (XCR0_OPMASK | XCR0_ZMM_HI256 | XCR0_HI16_ZMM)
+
+/* Size of the legacy area saved by fxsave */
+#define FPU_FXSAVE_SIZE     (512)
+
+/* Shortest copy which is worth saving the extended state for */
+#define FPU_COPY_THRESHOLD  (4096)
+
+/* -------------------------------- GLOBALS --------------------------------- */
+
+/* --------------------------------- MACROS --------------------------------- */
+
+/* --------------------------- INTERNALLY DEFINED --------------------------- */
+void fpu_init(size_t cpu_number);
+void fpu_alloc_state();
+void kernel_fpu_begin();
+void kernel_fpu_end();
+uint8_t fpu_has_avx2();
+uint8_t fpu_has_avx512();
+void *fpu_memcpy(void *dst, const void *src, size_t num);
@@ -29,5 +29,6 @@
 
 /* --------------------------- INTERNALLY DEFINED --------------------------- */
 void isr_handler(REGISTERS *regs);
+void isr_fatal(REGISTERS *regs) __attribute__((noreturn));
 void isr_init();
 void isr_register_handler(int interrupt, ISR_HANDLER handler);
@@ -0,0 +1,36 @@
+/**
+ * @file buddy.h
+ * @author Zack Bostock
+ * @brief Information pertaining to the buddy physical memory allocator
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <globals.h>
+
+#include <structs/buddy_str.h>
+
+/* ---------------------------- LITERAL CONSTANTS --------------------------- */
+/* Marks a frame which is not the head of a free block */
+#define BUDDY_NOT_FREE      (0xFF)
+
+/* Returned when no block could be found */
+#define BUDDY_NONE          (~((uint64_t) 0))
+
+/* -------------------------------- GLOBALS --------------------------------- */
+
+/* --------------------------------- MACROS --------------------------------- */
+#define BUDDY_ORDER_PAGES(order)    (((uint64_t) 1) << (order))
+
+/* --------------------------- INTERNALLY DEFINED --------------------------- */
+uint64_t buddy_storage_size(uint64_t num_pages);
+void buddy_init(BUDDY *b, void *storage, uint64_t first_page,
+                uint64_t num_pages);
+uint64_t buddy_free(BUDDY *b, uint64_t page, uint64_t count);
+uint64_t buddy_alloc(BUDDY *b, uint64_t count, uint64_t min_page);
+uint8_t buddy_test_free(BUDDY *b, uint64_t page, uint64_t count);
+STATUS buddy_reserve(BUDDY *b, uint64_t page, uint64_t count);
+void buddy_print_stats(BUDDY *b);
@@ -0,0 +1,28 @@
+/**
+ * @file compact.h
+ * @author Zack Bostock
+ * @brief Information pertaining to compaction of physical memory
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <globals.h>
+
+#include <structs/compact_str.h>
+
+/* ---------------------------- LITERAL CONSTANTS --------------------------- */
+
+/* -------------------------------- GLOBALS --------------------------------- */
+
+/* --------------------------------- MACROS --------------------------------- */
+
+/* --------------------------- INTERNALLY DEFINED --------------------------- */
+void compact_set_movable(uint64_t phys, uint64_t virt_addr);
+void compact_clear_movable(uint64_t phys);
+uint64_t compact_drain();
+uint64_t compact_alloc(uint64_t num_pages, uint64_t min_page, uint64_t flags);
+uint64_t compact_fragmentation_index(uint8_t order);
+void compact_print_stats();
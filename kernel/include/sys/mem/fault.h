@@ -0,0 +1,33 @@
+/**
+ * @file fault.h
+ * @author Zack Bostock
+ * @brief Information pertaining to the page fault handler
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <globals.h>
+
+#include <structs/fault_str.h>
+
+/* ---------------------------- LITERAL CONSTANTS --------------------------- */
+#define ISR_PAGE_FAULT  (14)
+
+/* Bits of the error code pushed by a page fault */
+#define PF_PRESENT      (1 << 0)
+#define PF_WRITE        (1 << 1)
+#define PF_USER         (1 << 2)
+#define PF_RESERVED     (1 << 3)
+#define PF_FETCH        (1 << 4)
+
+/* -------------------------------- GLOBALS --------------------------------- */
+
+/* --------------------------------- MACROS --------------------------------- */
+
+/* --------------------------- INTERNALLY DEFINED --------------------------- */
+void fault_init();
+void fault_get_stats(FAULT_STATS *stats);
+void fault_print_stats();
@@ -0,0 +1,44 @@
+/**
+ * @file frame_bitmap.h
+ * @author Zack Bostock
+ * @brief Information pertaining to the physical frame bitmap search engine
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <globals.h>
+
+#include <structs/frame_bitmap_str.h>
+
+#include <common/bitops.h>
+
+/* ---------------------------- LITERAL CONSTANTS --------------------------- */
+/* 64 words per region, so one region covers 16 MB of physical memory */
+#define FRAME_BITMAP_REGION_WORDS   (64)
+#define FRAME_BITMAP_REGION_PAGES   (FRAME_BITMAP_REGION_WORDS * BITS_PER_WORD)
+
+/* Returned by the search when no run of free frames could be found */
+#define FRAME_BITMAP_NONE           (~((uint64_t) 0))
+
+/* -------------------------------- GLOBALS --------------------------------- */
+
+/* --------------------------------- MACROS --------------------------------- */
+#define FRAME_BITMAP_WORDS(pages)   (((pages) + BITS_PER_WORD - 1) /          \
+                                     BITS_PER_WORD)
+#define FRAME_BITMAP_REGIONS(pages) (((pages) + FRAME_BITMAP_REGION_PAGES - 1) \
+                                     / FRAME_BITMAP_REGION_PAGES)
+
+/* --------------------------- INTERNALLY DEFINED --------------------------- */
+uint64_t frame_bitmap_storage_size(uint64_t num_pages);
+void frame_bitmap_init(FRAME_BITMAP *fb, void *storage, uint64_t num_pages);
+uint64_t frame_bitmap_set_free(FRAME_BITMAP *fb, uint64_t page,
+                               uint64_t count);
+uint64_t frame_bitmap_set_used(FRAME_BITMAP *fb, uint64_t page,
+                               uint64_t count);
+uint8_t frame_bitmap_test_free(FRAME_BITMAP *fb, uint64_t page,
+                               uint64_t count);
+uint64_t frame_bitmap_find(FRAME_BITMAP *fb, uint64_t count,
+                           uint64_t min_page);
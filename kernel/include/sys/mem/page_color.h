@@ -0,0 +1,29 @@
+/**
+ * @file page_color.h
+ * @author Zack Bostock
+ * @brief Information pertaining to page coloring of physical frames
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <globals.h>
+
+#include <structs/page_color_str.h>
+
+/* ---------------------------- LITERAL CONSTANTS --------------------------- */
+
+/* -------------------------------- GLOBALS --------------------------------- */
+
+/* --------------------------------- MACROS --------------------------------- */
+
+/* --------------------------- INTERNALLY DEFINED --------------------------- */
+void page_color_init();
+uint64_t page_color_count();
+uint64_t page_color_of(uint64_t phys);
+uint64_t page_color_get(uint64_t color, uint64_t flags);
+uint64_t page_color_drain();
+uint64_t page_color_cached();
+void page_color_print_stats();
@@ -0,0 +1,27 @@
+/**
+ * @file page_nt.h
+ * @author Zack Bostock
+ * @brief Information pertaining to clearing and copying pages with
+ *        non-temporal stores
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <globals.h>
+
+/* ---------------------------- LITERAL CONSTANTS --------------------------- */
+/* How far ahead of the copy the source is prefetched, in bytes */
+#define PAGE_NT_PREFETCH    (512)
+
+/* -------------------------------- GLOBALS --------------------------------- */
+
+/* --------------------------------- MACROS --------------------------------- */
+
+/* --------------------------- INTERNALLY DEFINED --------------------------- */
+void page_clear_nt(void *page);
+void page_copy_nt(void *dst, const void *src);
+void page_clear_nt_run(void *start, uint64_t num_pages);
+void page_copy_nt_run(void *dst, const void *src, uint64_t num_pages);
@@ -0,0 +1,26 @@
+/**
+ * @file pgtable.h
+ * @author Zack Bostock
+ * @brief Information pertaining to the page table page allocator
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <globals.h>
+
+#include <structs/pgtable_str.h>
+
+/* ---------------------------- LITERAL CONSTANTS --------------------------- */
+
+/* -------------------------------- GLOBALS --------------------------------- */
+
+/* --------------------------------- MACROS --------------------------------- */
+
+/* --------------------------- INTERNALLY DEFINED --------------------------- */
+void pgtable_init();
+uint64_t pgtable_alloc();
+void pgtable_free(uint64_t phys);
+void pgtable_print_stats();
@@ -0,0 +1,27 @@
+/**
+ * @file pm_magazine.h
+ * @author Zack Bostock
+ * @brief Information pertaining to the per-CPU physical frame caches
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <globals.h>
+
+#include <structs/pm_magazine_str.h>
+
+/* ---------------------------- LITERAL CONSTANTS --------------------------- */
+
+/* -------------------------------- GLOBALS --------------------------------- */
+
+/* --------------------------------- MACROS --------------------------------- */
+
+/* --------------------------- INTERNALLY DEFINED --------------------------- */
+uint64_t pm_magazine_get();
+STATUS pm_magazine_put(uint64_t address);
+uint64_t pm_magazine_drain();
+uint64_t pm_magazine_cached();
+void pm_magazine_print_stats();
@@ -0,0 +1,36 @@
+/**
+ * @file pm_pool.h
+ * @author Zack Bostock
+ * @brief Information pertaining to the free pools of the physical allocator
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <globals.h>
+
+#include <structs/pm_pool_str.h>
+
+#include <sys/mem/buddy.h>
+#include <sys/mem/frame_bitmap.h>
+
+/* ---------------------------- LITERAL CONSTANTS --------------------------- */
+/* Pool boundaries are aligned to the largest buddy block (4 MB) */
+#define PM_POOL_ALIGN_PAGES     (BUDDY_ORDER_PAGES(BUDDY_MAX_ORDER))
+
+/* -------------------------------- GLOBALS --------------------------------- */
+
+/* --------------------------------- MACROS --------------------------------- */
+#define PM_POOL_END(pool)       ((pool)->first_page + (pool)->num_pages)
+
+/* --------------------------- INTERNALLY DEFINED --------------------------- */
+uint64_t pm_pool_storage_size(uint64_t num_pages);
+void pm_pool_init(PM_POOL *pool, void *storage, uint64_t first_page,
+                  uint64_t num_pages, uint32_t node, uint8_t zone);
+uint64_t pm_pool_alloc(PM_POOL *pool, uint64_t count, uint64_t min_page);
+uint64_t pm_pool_free(PM_POOL *pool, uint64_t page, uint64_t count);
+uint8_t pm_pool_test_free(PM_POOL *pool, uint64_t page, uint64_t count);
+STATUS pm_pool_reserve(PM_POOL *pool, uint64_t page, uint64_t count);
+void pm_pool_print_stats(PM_POOL *pool, uint64_t index);
@@ -0,0 +1,47 @@
+/**
+ * @file slab.h
+ * @author Zack Bostock
+ * @brief Information pertaining to the slab allocator for small objects
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <globals.h>
+
+#include <structs/slab_str.h>
+
+/* ---------------------------- LITERAL CONSTANTS --------------------------- */
+#define SLAB_MAGIC          (0x51AB51AB)
+/* Second word of every free object, see slab_free */
+#define SLAB_FREE_POISON    (0xF4EE51ABF4EE51AB)
+
+/*
+  Power of two size classes from 16 B to 1 KB. With the header in the page
+  a 2 KB class would fit a single object per page, which is no better than
+  giving the request a page of its own.
+*/
+#define SLAB_MIN_SHIFT      (4)
+#define SLAB_MAX_SHIFT      (10)
+#define SLAB_NUM_CLASSES    (SLAB_MAX_SHIFT - SLAB_MIN_SHIFT + 1)
+#define SLAB_MIN_SIZE       (1 << SLAB_MIN_SHIFT)
+#define SLAB_MAX_SIZE       (1 << SLAB_MAX_SHIFT)
+
+/* Objects start one cache line into the page, after the SLAB header */
+#define SLAB_HEADER_SIZE    (64)
+
+/* Empty slabs kept per class before pages are given back */
+#define SLAB_MAX_EMPTY      (1)
+
+/* -------------------------------- GLOBALS --------------------------------- */
+
+/* --------------------------------- MACROS --------------------------------- */
+#define SLAB_CAPACITY(size) ((PAGE_SIZE - SLAB_HEADER_SIZE) / (size))
+
+/* --------------------------- INTERNALLY DEFINED --------------------------- */
+void *slab_alloc(uint64_t size);
+STATUS slab_free(void *address);
+uint64_t slab_size(void *address);
+void slab_print_stats();
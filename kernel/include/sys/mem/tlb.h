@@ -0,0 +1,33 @@
+/**
+ * @file tlb.h
+ * @author Zack Bostock
+ * @brief Information pertaining to batched TLB invalidation and PCIDs
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <globals.h>
+
+#include <structs/tlb_str.h>
+#include <structs/address_space_str.h>
+
+/* ---------------------------- LITERAL CONSTANTS --------------------------- */
+
+/* -------------------------------- GLOBALS --------------------------------- */
+
+/* --------------------------------- MACROS --------------------------------- */
+
+/* --------------------------- INTERNALLY DEFINED --------------------------- */
+void tlb_init();
+void tlb_gather_init(TLB_GATHER *tlb, ADDR_SPACE *as);
+void tlb_gather_page(TLB_GATHER *tlb, uint64_t virt_addr);
+void tlb_gather_range(TLB_GATHER *tlb, uint64_t virt_addr, uint64_t size);
+void tlb_gather_table(TLB_GATHER *tlb, uint64_t phys);
+void tlb_gather_finish(TLB_GATHER *tlb);
+void tlb_flush_all(uint8_t global);
+void tlb_switch(ADDR_SPACE *addr_space);
+uint8_t tlb_pcid_enabled();
+void tlb_print_stats();
@@ -0,0 +1,39 @@
+/**
+ * @file vma.h
+ * @author Zack Bostock
+ * @brief Information pertaining to virtual memory area trees
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <globals.h>
+
+#include <structs/vma_str.h>
+
+/* ---------------------------- LITERAL CONSTANTS --------------------------- */
+#define VMA_RED         (0)
+#define VMA_BLACK       (1)
+
+#define VMA_TYPE_FIXED      (0)
+#define VMA_TYPE_DEMAND     (1)
+#define VMA_TYPE_VMALLOC    (2)
+
+/* Returned by vma_find_gap when no hole is large enough */
+#define VMA_NO_GAP      (~((uint64_t) 0))
+
+/* -------------------------------- GLOBALS --------------------------------- */
+
+/* --------------------------------- MACROS --------------------------------- */
+
+/* --------------------------- INTERNALLY DEFINED --------------------------- */
+STATUS vma_insert(VMA_TREE *tree, VMA *vma);
+void vma_remove(VMA_TREE *tree, VMA *vma);
+VMA *vma_find(VMA_TREE *tree, uint64_t address);
+VMA *vma_find_overlap(VMA_TREE *tree, uint64_t start, uint64_t end);
+uint64_t vma_find_gap(VMA_TREE *tree, uint64_t low, uint64_t high,
+                      uint64_t size, uint64_t align);
+VMA *vma_first(VMA_TREE *tree);
+VMA *vma_next(VMA *vma);
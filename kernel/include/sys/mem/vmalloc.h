@@ -0,0 +1,34 @@
+/**
+ * @file vmalloc.h
+ * @author Zack Bostock
+ * @brief Information pertaining to virtually contiguous allocations
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <globals.h>
+
+#include <structs/vmalloc_str.h>
+
+/* ---------------------------- LITERAL CONSTANTS --------------------------- */
+/* Frames taken from the physical allocator at a time */
+#define VMALLOC_BATCH       (64)
+
+/* kvmalloc and kvrealloc use vmalloc from this many bytes up */
+#define KVMALLOC_THRESHOLD  (64 * 1024)
+
+/* -------------------------------- GLOBALS --------------------------------- */
+
+/* --------------------------------- MACROS --------------------------------- */
+
+/* --------------------------- INTERNALLY DEFINED --------------------------- */
+void *vmalloc(uint64_t size);
+void vfree(void *address);
+uint64_t vmalloc_size(void *address);
+void *kvmalloc(uint64_t size);
+void *kvrealloc(void *address, uint64_t new_size);
+void kvfree(void *address);
+void vmalloc_print_stats();
@@ -0,0 +1,28 @@
+/**
+ * @file zero_pool.h
+ * @author Zack Bostock
+ * @brief Information pertaining to the pool of pre-zeroed frames
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <globals.h>
+
+#include <structs/zero_pool_str.h>
+
+/* ---------------------------- LITERAL CONSTANTS --------------------------- */
+
+/* -------------------------------- GLOBALS --------------------------------- */
+
+/* --------------------------------- MACROS --------------------------------- */
+
+/* --------------------------- INTERNALLY DEFINED --------------------------- */
+uint64_t zero_pool_get();
+void zero_pool_clear(uint64_t phys, uint64_t num_pages);
+void zero_pool_idle();
+uint64_t zero_pool_drain();
+uint64_t zero_pool_cached();
+void zero_pool_print_stats();
@@ -13,7 +13,6 @@
 
 #include <structs/mmu_str.h>
 #include <structs/address_space_str.h>
-#include <structs/memory_map_str.h>
 
 #include <common/vector.h>
 #include <common/memory.h>
@@ -22,17 +21,67 @@
 
 #include <sys/asm.h>
 #include <sys/cpu.h>
+#include <sys/acpi/numa.h>
+#include <sys/mem/frame_bitmap.h>
+#include <sys/mem/buddy.h>
+#include <sys/mem/pm_pool.h>
+#include <sys/mem/pm_magazine.h>
+#include <sys/mem/zero_pool.h>
+#include <sys/mem/page_nt.h>
+#include <sys/mem/page_color.h>
+#include <sys/mem/compact.h>
+#include <sys/mem/pgtable.h>
+#include <sys/mem/tlb.h>
+#include <sys/mem/vma.h>
+#include <sys/mem/fault.h>
 
 /* ---------------------------- LITERAL CONSTANTS --------------------------- */
-#define PAGES_PER_BYTE      (8)
 #define PAGE_SIZE           (4096)
 
+/* Physical memory backends, select with make CPPFLAGS=-DPM_BACKEND=<n> */
+#define PM_BACKEND_BITMAP   (0)
+#define PM_BACKEND_BUDDY    (1)
+
+#ifndef PM_BACKEND
+#define PM_BACKEND          PM_BACKEND_BITMAP
+#endif
+
+#if PM_BACKEND == PM_BACKEND_BUDDY
+#define PM_BACKEND_NAME     "buddy"
+#else
+#define PM_BACKEND_NAME     "bitmap"
+#endif
+
+/* Flags of pm_get */
+#define PM_ZERO             (1 << 0)
+/* Only frames below PM_DMA32_LIMIT, for 32-bit DMA engines */
+#define PM_DMA32            (1 << 1)
+
+/* End of ZONE_DMA32 */
+#define PM_DMA32_LIMIT      (0x100000000)
+
+/* Zone watermarks, relative to the free pages of the zone after pm_init */
+#define PM_WATERMARK_DIV    (64)
+#define PM_WATERMARK_MAX    (4096)
+
+/* Returned by the physical backends when no pages could be found */
+#define PM_NO_PAGE          (~((uint64_t) 0))
+
+/* Owners of a frame, see PAGE_INFO */
+#define PAGE_TYPE_NONE      (0)
+#define PAGE_TYPE_SLAB      (0x5A)
+#define PAGE_TYPE_KMALLOC   (0xB3)
+#define PAGE_TYPE_PGTABLE   (0x7E)
+/* Backs one page of the vmalloc window, which compaction may move */
+#define PAGE_TYPE_MOVABLE   (0x3C)
+/* Free, but held by a per-CPU magazine (see pm_magazine.c) */
+#define PAGE_TYPE_CACHED    (0xCA)
+
+/* End of a PAGE_LIST, frame 0 is never put on one */
+#define PAGE_LIST_END       (0)
+
 /* Determed from the HHDM offset input from bootloader */
 #define MEM_VIRT_OFFSET     (0xFFFF800000000000)
-#define FREE                (1)
-#define ALLOCATED           (0)
-
-typedef uint8_t BITMAP_STATUS;
 
 /* Virtual Memory Page Flags */
 #define VM_PRESENT          (1 << 0)
@@ -41,14 +90,48 @@ typedef uint8_t BITMAP_STATUS;
 #define VM_WRITE_THROUGH    (1 << 3)
 #define VM_CACHE_DISABLE    (1 << 4)
 #define VM_PAT              (1 << 7)
+/* Leaf survives CR3 reloads, used for the kernel half when PGE is enabled */
+#define VM_GLOBAL           (1 << 8)
 
 /* Virtual Memory Modes */
 #define VM_DEFAULT          (VM_PRESENT | VM_READ_WRITE)
 #define VM_MMIO             (VM_DEFAULT | VM_CACHE_DISABLE | VM_WRITE_THROUGH)
 #define VM_USERMODE         (VM_DEFAULT | VM_USER)
 
+/* Large page flags, only valid in PDPT and PD entries */
+#define VM_LARGE            (1 << 7)
+#define VM_LARGE_PAT        (1 << 12)
+
+/* Flags which are compared when checking if a mapping already exists */
+#define VM_FLAGS_MASK       (VM_PRESENT | VM_READ_WRITE | VM_USER |         \
+                             VM_WRITE_THROUGH | VM_CACHE_DISABLE | VM_PAT)
+
+#define PAGE_ADDR_MASK      (0x000FFFFFFFFFF000)
+#define PAGE_SIZE_2M        (0x200000)
+#define PAGE_SIZE_1G        (0x40000000)
+/* The direct map only uses 4 KB pages below this, see vm_map_direct */
+#define VM_DIRECT_SMALL_END (PAGE_SIZE_2M)
+/* Frame runs vm_unmap_region collects before each unmap and flush */
+#define VM_UNMAP_RUNS       (32)
+
+/* Paging structure levels, a leaf at level 2 or 3 is a large page */
+#define VM_LEVEL_PT         (1)
+#define VM_LEVEL_PD         (2)
+#define VM_LEVEL_PDPT       (3)
+#define VM_LEVEL_PML4       (4)
+
 #define PAGE_TABLE_ENTRIES  (512)
-#define DEFAULT_PAGES       (8)
+
+/* PML4 entries 256 - 511 map the kernel half, shared by every address space */
+#define VM_KERNEL_PML4_FIRST    (256)
+#define VM_KERNEL_HALF_START    (0xFFFF800000000000)
+
+/* Kernel mappings outside of the direct map (e.g. device memory) */
+#define VM_KERNEL_AREA_START    (0xFFFFC90000000000)
+#define VM_KERNEL_AREA_END      (0xFFFFE90000000000)
+/* Upper part of the kernel area, for vmalloc and vm_reserve */
+#define VM_VMALLOC_START        (0xFFFFD90000000000)
+#define VM_VMALLOC_END          (VM_KERNEL_AREA_END)
 
 /* -------------------------------- GLOBALS --------------------------------- */
 extern ADDR_SPACE kernel_addr_space;
@@ -115,6 +198,20 @@ extern ADDR_SPACE kernel_addr_space;
 #define PAGE_ALIGN(addr)              (NUM_PAGES(addr) * PAGE_SIZE)
 #define MAKE_TABLE_ENTRY(addr, flags) ((addr & ~(0xFFF)) | flags)
 
+/* Bytes mapped by one entry at a level, and the index of virt at a level */
+#define VM_LEVEL_SIZE(level)                                      \
+      ((uint64_t) PAGE_SIZE << (9 * ((level) - 1)))
+#define VM_LEVEL_INDEX(virt, level)                               \
+      (((virt) >> (12 + 9 * ((level) - 1))) & 0x1FF)
+/* Physical address bits of a leaf, large leaves keep their PAT in bit 12 */
+#define VM_LEVEL_ADDR(entry, level)                               \
+      ((entry) & PAGE_ADDR_MASK & ~(VM_LEVEL_SIZE(level) - 1))
+
+#define VM_IS_KERNEL_HALF(virt)       ((virt) >= VM_KERNEL_HALF_START)
+#define VM_IS_VMALLOC(virt)                                       \
+      ((uint64_t) (virt) >= VM_VMALLOC_START &&                   \
+       (uint64_t) (virt) < VM_VMALLOC_END)
+
 #define CHECK_NOT_PRESENT(entry)      (!((entry) & VM_PRESENT))
 #define CHECK_PRESENT(entry)          (((entry) & VM_PRESENT))
 
@@ -122,14 +219,46 @@ extern ADDR_SPACE kernel_addr_space;
 
 /* --------------------------- INTERNALLY DEFINED --------------------------- */
 void pm_init(LIMINE_MEM_REQ req);
+uint64_t pm_reclaim(LIMINE_MEM_REQ req, uint64_t type);
 STATUS pm_free(uint64_t address, uint64_t num_pages);
 STATUS pm_allocate(uint64_t address, uint64_t num_pages);
-uint64_t pm_get(uint64_t num_pages, uint64_t address, const char *func,
-                size_t line_number);
+uint64_t pm_get(uint64_t num_pages, uint64_t address, uint64_t flags,
+                const char *func, size_t line_number);
+uint64_t pm_get_node(uint64_t num_pages, uint32_t node, uint64_t flags,
+                     const char *func, size_t line_number);
+uint32_t pm_page_node(uint64_t address);
 void pm_used();
+void pm_numa_print_stats();
+uint8_t pm_under_pressure();
+uint64_t pm_free_size();
+uint64_t pm_num_pools();
+PM_POOL *pm_get_pool(uint64_t index);
+uint8_t pm_test_free(uint64_t address, uint64_t num_pages);
+PAGE_INFO *pm_page_info(uint64_t address);
+void page_list_push(PAGE_LIST *list, uint64_t address);
+void page_list_remove(PAGE_LIST *list, uint64_t address);
+uint64_t page_list_pop(PAGE_LIST *list);
+uint64_t pm_try_get(uint64_t num_pages);
+uint64_t pm_get_frames(uint64_t *frames, uint64_t count);
+void pm_put_frames(uint64_t *frames, uint64_t count);
 uint64_t vm_get_phys_addr(ADDR_SPACE *addr_space, uint64_t virt_addr);
 void vm_unmap(ADDR_SPACE *addr_space, uint64_t virt_addr, uint64_t num_pages);
+STATUS vm_migrate_page(uint64_t virt_addr, uint64_t old_phys,
+                       uint64_t new_phys);
 void vm_map(ADDR_SPACE *addr_space, uint64_t virt_addr, uint64_t phys_addr,
             uint64_t num_pages, uint64_t flags);
+VMA *vm_map_region(ADDR_SPACE *addr_space, const char *name,
+                   uint64_t virt_addr, uint64_t phys_addr, uint64_t num_pages,
+                   uint64_t flags);
+uint64_t vm_map_mmio(const char *name, uint64_t phys_addr, uint64_t size);
+VMA *vm_alloc_area(const char *name, uint64_t size, uint64_t align,
+                   uint8_t type, uint64_t flags);
+void *vm_reserve(const char *name, uint64_t size, uint64_t flags);
+STATUS vm_handle_fault(uint64_t virt_addr, uint64_t error_code);
+VMA *vm_find_region(ADDR_SPACE *addr_space, uint64_t virt_addr);
+STATUS vm_unmap_region(ADDR_SPACE *addr_space, uint64_t virt_addr);
+void vm_print_regions(ADDR_SPACE *addr_space);
 void vm_init(LIMINE_MEM_REQ req, LIMINE_K_ADDR_REQ k_req);
 ADDR_SPACE *create_address_space();
+void destroy_address_space(ADDR_SPACE *addr_space);
+void vm_get_stats(ADDR_SPACE *addr_space, VM_STATS *stats);
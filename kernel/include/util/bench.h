@@ -0,0 +1,89 @@
+/**
+ * @file bench.h
+ * @author Zack Bostock
+ * @brief Information pertaining to the boot-time benchmarks
+ * @verbatim
+ * Benchmarks are only compiled in when the kernel is built with
+ * KERNEL_BENCHMARKS set (e.g. make CPPFLAGS=-DKERNEL_BENCHMARKS=1).
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <globals.h>
+
+/* ---------------------------- LITERAL CONSTANTS --------------------------- */
+#define NS_PER_SEC          (1000000000)
+
+/* Physical memory benchmark */
+#define BENCH_PM_BATCH      (256)
+#define BENCH_PM_ROUNDS     (16)
+
+/* kmalloc benchmark */
+#define BENCH_KMALLOC_LIVE  (256)
+#define BENCH_KMALLOC_OPS   (4096)
+#define BENCH_KMALLOC_VEC   (1024)
+
+/* Address space switch benchmark, pages touched per address space */
+#define BENCH_PCID_PAGES    (64)
+#define BENCH_PCID_ROUNDS   (4096)
+#define BENCH_PCID_BASE     (0x40000000)
+
+/* Demand paging benchmark, only half of the reserved pages are touched */
+#define BENCH_FAULT_PAGES   (512)
+
+/* vmalloc benchmark, about the size of a 1920x1080 32 bpp back buffer */
+#define BENCH_VMALLOC_SIZE  (8 * 1024 * 1024)
+#define BENCH_VMALLOC_ROUNDS (16)
+
+/* NUMA benchmark, runs of more than one page bypass the magazines */
+#define BENCH_NUMA_RUNS     (256)
+#define BENCH_NUMA_RUN_PAGES (2)
+
+/* Zone benchmark, runs allocated with PM_DMA32 */
+#define BENCH_ZONE_RUNS     (256)
+
+/* Page coloring benchmark, buffers are the size of the LLC up to the max */
+#define BENCH_COLOR_MAX_SIZE (8 * 1024 * 1024)
+#define BENCH_COLOR_PASSES  (16)
+
+/* mem* bandwidth benchmark, sizes go up by 4x, bytes moved per size */
+#define BENCH_MEM_MIN_SIZE  (16)
+#define BENCH_MEM_MAX_SIZE  (16 * 1024 * 1024)
+#define BENCH_MEM_BYTES     (64 * 1024 * 1024)
+/* Distance memmove shifts a buffer by, so source and destination overlap */
+#define BENCH_MEM_SHIFT     (64)
+
+/* Non-temporal page benchmark, pages cleared or copied per round, and the */
+/* largest working set walked in between                                  */
+#define BENCH_NT_PAGES      (256)
+#define BENCH_NT_ROUNDS     (32)
+#define BENCH_NT_HOT_MAX    (4 * 1024 * 1024)
+
+/* Lock contention benchmark, time per lock and acquisitions between two */
+/* reads of the clock                                                     */
+#define BENCH_LOCK_NS       (20 * 1000 * 1000)
+#define BENCH_LOCK_BATCH    (256)
+
+/* -------------------------------- GLOBALS --------------------------------- */
+
+/* --------------------------------- MACROS --------------------------------- */
+
+/* --------------------------- INTERNALLY DEFINED --------------------------- */
+uint64_t bench_now_ns();
+void bench_report(const char *name, uint64_t ops, uint64_t ns);
+void bench_pm();
+void bench_kmalloc();
+void bench_pcid();
+void bench_fault();
+void bench_vmalloc();
+void bench_numa();
+void bench_zones();
+void bench_color();
+void bench_mem();
+void bench_nt();
+void bench_lock_worker(void *lock, uint8_t queued, uint64_t end_ns);
+void bench_lock();
+void bench_run();
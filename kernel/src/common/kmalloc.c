@@ -2,6 +2,14 @@
  * @file kmalloc.c
  * @author Zack Bostock
  * @brief Internal kernel memory allocator
+ * @verbatim
+ * Requests of at most SLAB_MAX_SIZE bytes come from the slab allocator.
+ * Larger requests get whole pages, and their size and callsite are kept out
+ * of line in the PAGE_INFO of the first frame (see mmu.c) rather than in a
+ * header page in front of the data.
+ *
+ * Callsites are interned once into kmem_callsites, so an allocation only
+ * records a 16-bit ID instead of a copy of the function name.
  *
  * @copyright Copyright (c) 2024
  *
@@ -12,10 +20,73 @@
 #include <common/kmalloc.h>
 #include <common/kprint.h>
 #include <common/string.h>
+#include <common/lock.h>
 #include <sys/asm.h>
 #include <sys/mmu.h>
+#include <sys/mem/slab.h>
+
+static KMEM_CALLSITE kmem_callsites[KMEM_MAX_CALLSITES] = {0};
+static LOCK kmem_callsite_lock = {0};
+
+/**
+ * @brief Interns a callsite into the global callsite table
+ * @verbatim
+ * func is always __func__ of the caller, which is a string with static
+ * storage, so only the pointer is kept and compared.
+ *
+ * @param func Function name of the callsite
+ * @param line Line number of the callsite
+ * @return uint16_t Callsite ID, KMEM_CALLSITE_UNKNOWN if the table is full
+ */
+static uint16_t kmalloc_intern_callsite(const char *func, size_t line) {
+    uint64_t hash = ((uint64_t) func ^ (line * 0x9E3779B97F4A7C15)) >> 4;
+    uint16_t id = KMEM_CALLSITE_UNKNOWN;
+
+    LOCK_LOCK(&kmem_callsite_lock);
+    for (uint64_t i = 0; i < KMEM_MAX_CALLSITES; i++) {
+        uint64_t slot = (hash + i) & (KMEM_MAX_CALLSITES - 1);
+        KMEM_CALLSITE *site = &kmem_callsites[slot];
+
+        if (!site->func) {
+            site->func = func;
+            site->line = line;
+        }
+        if (site->func == func && site->line == line) {
+            /* ID 0 is reserved for unknown callsites */
+            id = slot + 1;
+            break;
+        }
+    }
+    UNLOCK_LOCK(&kmem_callsite_lock);
+    return id;
+}
+
+/**
+ * @brief Gets the callsite an ID was interned from
+ *
+ * @param id Callsite ID
+ * @return KMEM_CALLSITE * Callsite, NULL if unknown
+ */
+KMEM_CALLSITE *kmalloc_callsite(uint16_t id) {
+    if (id == KMEM_CALLSITE_UNKNOWN || id > KMEM_MAX_CALLSITES) {
+        return NULL;
+    }
+    return &kmem_callsites[id - 1];
+}
 
-size_t kmalloc_checkno = 0;
+/**
+ * @brief Gets the PAGE_INFO of a page allocation made by kmalloc
+ *
+ * @param address Address returned by kmalloc
+ * @return PAGE_INFO * Metadata of the first frame, NULL if not kmalloc'd
+ */
+static inline PAGE_INFO *kmalloc_page_info(void *address) {
+    PAGE_INFO *info = pm_page_info(VIRT_TO_PHYS(address));
+    if (!info || info->type != PAGE_TYPE_KMALLOC) {
+        return NULL;
+    }
+    return info;
+}
 
 /**
  * @brief Internal kernel implementation of malloc
@@ -26,25 +97,37 @@ size_t kmalloc_checkno = 0;
  * @return void * Pointer to the data which was allocated
  */
 void *kmalloc_impl(uint64_t size, const char *func, size_t line) {
-    KMEM_METADATA *mem = (KMEM_METADATA *)
-        PHYS_TO_VIRT(pm_get(NUM_PAGES(size) + 1, 0x0, func, line));
+#if KMALLOC_SLAB
+    if (size <= SLAB_MAX_SIZE) {
+        void *obj = slab_alloc(size);
+        memset(obj, 0, size);
+        return obj;
+    }
+#endif
+
+    if (size > UINT32_MAX) {
+        kloge("kmalloc: %d bytes from %s:%d is too large\n", size, func, line);
+        return NULL;
+    }
 
-    if (!mem) {
+    uint64_t num_pages = size ? NUM_PAGES(size) : 1;
+    /* Single pages usually come out of the pool zeroed while idle */
+    uint64_t phys = pm_get(num_pages, 0x0, PM_ZERO, func, line);
+    void *mem = (void *) PHYS_TO_VIRT(phys);
+
+    if (!phys) {
         kloge("Out of memory when allocating %d bytes from %s:%d\n", size,
                 func, line);
+        return NULL;
     }
 
-    /* zero out the memory - unneeded, but nice to have for now */
-    memset(mem, 0, size + PAGE_SIZE);
-
-    mem->magic = KMEM_MAGIC_NUMBER;
-    mem->checkno = kmalloc_checkno;
-    mem->num_pages = NUM_PAGES(size);
-    mem->size = size;
-    mem->lineno = line;
-    strncpy(mem->file_name, func, sizeof(mem->file_name) - 1);
+    PAGE_INFO *info = pm_page_info(phys);
+    info->type = PAGE_TYPE_KMALLOC;
+    info->order = 0;
+    info->size = size;
+    info->callsite = kmalloc_intern_callsite(func, line);
 
-    return ((uint8_t *) mem) + PAGE_SIZE;
+    return mem;
 }
 
 /**
@@ -55,17 +138,24 @@ void *kmalloc_impl(uint64_t size, const char *func, size_t line) {
  * @param line Line number in the function which is freeing the memory
  */
 void kfree_impl(void *address, const char *func, size_t line) {
-    (void) func;
-    (void) line;
+    PAGE_INFO *info = pm_page_info(VIRT_TO_PHYS(address));
 
-    KMEM_METADATA *mem = (KMEM_METADATA *) ((uint8_t *) address - PAGE_SIZE);
+    if (info && info->type == PAGE_TYPE_SLAB &&
+        slab_free(address) == SYS_OK) {
+        return;
+    }
 
-    if (mem->magic == KMEM_MAGIC_NUMBER) {
-        pm_free(VIRT_TO_PHYS(mem), mem->num_pages + 1);
-        mem->magic = 0;
-    } else {
-        kloge("free: memory corruption detected\n");
+    /* Page allocations always start at the first byte of a frame */
+    if (info && info->type == PAGE_TYPE_KMALLOC &&
+        !((uint64_t) address & (PAGE_SIZE - 1))) {
+        /* Before the free, a single frame may be tagged by the magazine */
+        info->type = PAGE_TYPE_NONE;
+        pm_free(VIRT_TO_PHYS(address),
+                info->size ? NUM_PAGES(info->size) : 1);
+        return;
     }
+
+    kloge("free: memory corruption detected (%s:%d)\n", func, line);
 }
 
 /**
@@ -83,30 +173,61 @@ void *krealloc_impl(void *address, size_t new_size, const char *func,
         return kmalloc_impl(new_size, func, line);
     }
 
-    KMEM_METADATA *mem = (KMEM_METADATA *) ((uint8_t *) address - PAGE_SIZE);
-
-    if (NUM_PAGES(mem->size) == NUM_PAGES(new_size)) {
-        /* Number of pages is the same, don't change number of pages alloc'd */
-        mem->size = new_size;
-        mem->num_pages = NUM_PAGES(new_size);
-        mem->magic = KMEM_MAGIC_NUMBER;
-        mem->lineno = line;
-        strncpy(mem->file_name, func, sizeof(mem->file_name) - 1);
-        return address;
+    uint64_t old_size;
+    PAGE_INFO *info = kmalloc_page_info(address);
+
+    if (info) {
+        old_size = info->size;
+        if (new_size && new_size <= UINT32_MAX &&
+            NUM_PAGES(old_size) == NUM_PAGES(new_size)) {
+            /* Same number of pages, the allocation stays where it is */
+            info->size = new_size;
+            info->callsite = kmalloc_intern_callsite(func, line);
+            return address;
+        }
+    } else {
+        old_size = slab_size(address);
+        if (new_size <= old_size &&
+            (old_size == SLAB_MIN_SIZE || new_size > old_size / 2)) {
+            /* Still the same size class */
+            return address;
+        }
     }
 
-    /* Number of pages is different, allocate more pages */
+    /* Size class or number of pages is different, move the data */
     void *new_base = kmalloc_impl(new_size, func, line);
+    memcpy(new_base, address, old_size < new_size ? old_size : new_size);
+    kfree_impl(address, func, line);
+    return new_base;
+}
 
-    /* nice to have, but unneeded */
-    memset(new_base, 0, new_size);
-
-    if (mem->size > new_size) {
-        memcpy(new_base, address, new_size);
-    } else {
-        memcpy(new_base, address, mem->size);
+/**
+ * @brief Gets the usable size of memory allocated with kmalloc
+ *
+ * @param address Address returned by kmalloc
+ * @return uint64_t Number of bytes, 0 if not kmalloc'd
+ */
+uint64_t kmalloc_size(void *address) {
+    PAGE_INFO *info = kmalloc_page_info(address);
+    if (info) {
+        return info->size;
     }
+    return slab_size(address);
+}
 
-    kfree_impl(address, func, line);
-    return new_base;
+/**
+ * @brief Prints every live page allocation along with its callsite, useful
+ *        for finding leaks
+ */
+void kmalloc_print_live() {
+    PAGE_INFO *info;
+    for (uint64_t phys = 0; (info = pm_page_info(phys)); phys += PAGE_SIZE) {
+        if (info->type != PAGE_TYPE_KMALLOC) {
+            continue;
+        }
+        KMEM_CALLSITE *site = kmalloc_callsite(info->callsite);
+        klogi("kmalloc: %x %d bytes from %s:%d\n", PHYS_TO_VIRT(phys),
+              info->size, site ? site->func : "unknown",
+              site ? site->line : 0);
+    }
 }
@@ -3,12 +3,39 @@
  * @author Zack Bostock
  * @brief Hardware locking functionality
  * @verbatim
+ * Two spinlocks, both of which hand the lock out in the order it was asked
+ * for, so no CPU can be starved by the others:
+ *
+ * LOCK is a ticket lock. A locker takes a ticket with one lock xadd and
+ * then only reads until the owner count reaches it, which is cheap for
+ * short critical sections, but every waiter reads the same cache line and
+ * each release invalidates it on all of them.
+ *
+ * QLOCK is an MCS queue lock. A locker appends a node of its own CPU to
+ * the queue and spins on that node, which only its predecessor writes to
+ * when it hands the lock over, so a release touches one other CPU.
+ *
+ * Both save RFLAGS and disable interrupts before waiting (an interrupt
+ * handler taking a lock its CPU already holds would never get it) and
+ * restore them on unlock.
  *
  * @copyright Copyright (c) 2024
  *
  */
 
 #include <common/lock.h>
+#include <sys/asm.h>
+#include <sys/cpu.h>
+
+/* Added to the lock word to take the next ticket */
+#define LOCK_TICKET     (1 << 16)
+
+/**
+ * @brief Waits a little inside a spin loop
+ */
+static inline void lock_relax() {
+  asm __volatile__ ("pause" : : : "memory");
+}
 
 /**
  * @brief Locks a hardware lock
@@ -24,22 +51,19 @@ void lock_lock_implementation(LOCK *s, const char *f, const int ln) {
   (void) f;
   (void) ln;
 
+  uint64_t rflags = interrupts_save();
+  uint32_t ticket = LOCK_TICKET;
   asm __volatile__ (
-      "pushfq;"
-      "cli;"
-      "lock btsl $0, %[lock];"
-      "jnc 2f;"
-      "1:"
-      "pause;"
-      "btl $0, %[lock];"
-      "jc 1b;"
-      "lock btsl $0, %[lock];"
-      "jc 1b;"
-      "2:"
-      "pop %[flags]"
-      : [lock] "=m"((s)->lock), [flags] "=m"((s)->rflags)
+      "lock xaddl %[ticket], %[lock]"
+      : [ticket] "+r"(ticket), [lock] "+m"((s)->lock)
       :
       : "memory", "cc");
+
+  /* The previous value of next is this locker's ticket */
+  while (*(volatile uint16_t *) &s->owner != (uint16_t) (ticket >> 16)) {
+    lock_relax();
+  }
+  s->rflags = rflags;
 }
 
 /**
@@ -49,15 +73,199 @@ void lock_lock_implementation(LOCK *s, const char *f, const int ln) {
  * @param f File name
  * @param ln Line number
  */
-void unlock_lock_implmentation(LOCK *s, const char *f, const int ln) {
+void unlock_lock_implementation(LOCK *s, const char *f, const int ln) {
+  (void) f;
+  (void) ln;
+
+  /* The next holder overwrites rflags as soon as owner moves on */
+  uint64_t rflags = s->rflags;
+  asm __volatile__ (
+      "lock incw %[owner]"
+      : [owner] "+m"((s)->owner)
+      :
+      : "memory", "cc");
+  interrupts_restore(rflags);
+}
+
+/**
+ * @brief Takes a hardware lock only if it is free
+ * @verbatim
+ * For paths which may run while the caller already holds the lock, e.g.
+ * compaction under an allocation made with the address space lock held.
+ * Interrupts are left as they were when the lock is not taken.
+ *
+ * @param s LOCK structure
+ * @param f File name
+ * @param ln Line number
+ * @return STATUS SYS_OK if the lock was taken, SYS_ERR if it is held
+ */
+STATUS lock_try_implementation(LOCK *s, const char *f, const int ln) {
   (void) f;
   (void) ln;
 
+  uint64_t rflags = interrupts_save();
+  uint32_t old = *(volatile uint32_t *) &s->lock;
+  uint8_t taken = FALSE;
+
+  /* Free when nobody holds or waits for a ticket */
+  if ((uint16_t) old == (uint16_t) (old >> 16)) {
+    asm __volatile__ (
+        "lock cmpxchgl %[new], %[lock];"
+        "sete %[taken]"
+        : [lock] "+m"((s)->lock), "+a"(old), [taken] "=q"(taken)
+        : [new] "r"(old + LOCK_TICKET)
+        : "memory", "cc");
+  }
+
+  if (!taken) {
+    interrupts_restore(rflags);
+    return SYS_ERR;
+  }
+  s->rflags = rflags;
+  return SYS_OK;
+}
+
+/**
+ * @brief Picks a free queue node of the calling CPU, interrupts must be
+ *        disabled
+ *
+ * @return QLOCK_NODE * Node, marked in use and unlinked
+ */
+static QLOCK_NODE *qlock_get_node() {
+  CPU_LOCAL *local = this_cpu();
+
+  for (uint32_t i = 0; i < QLOCK_MAX_NODES; i++) {
+    QLOCK_NODE *node = &local->qlock_nodes[i];
+    if (!node->in_use) {
+      node->in_use = TRUE;
+      node->next = NULL;
+      node->locked = FALSE;
+      return node;
+    }
+  }
+
+  kloge("LOCK: CPU %d holds more than %d queue locks\n", local->cpu_number,
+        QLOCK_MAX_NODES);
+  halt();
+}
+
+/**
+ * @brief Swaps the tail of a queue lock
+ *
+ * @param s QLOCK structure
+ * @param node New tail
+ * @return QLOCK_NODE * Previous tail, NULL if the lock was free
+ */
+static inline QLOCK_NODE *qlock_swap_tail(QLOCK *s, QLOCK_NODE *node) {
+  asm __volatile__ (
+      "xchgq %[node], %[tail]"
+      : [node] "+r"(node), [tail] "+m"((s)->tail)
+      :
+      : "memory");
+  return node;
+}
+
+/**
+ * @brief Replaces the tail of a queue lock if it is still the given node
+ *
+ * @param s QLOCK structure
+ * @param old Expected tail
+ * @param node New tail
+ * @return uint8_t TRUE if the tail was replaced
+ */
+static inline uint8_t qlock_cmpxchg_tail(QLOCK *s, QLOCK_NODE *old,
+                                         QLOCK_NODE *node) {
+  uint8_t swapped;
   asm __volatile__ (
-                "push %[flags];"
-                "lock btrl $0, %[lock];"
-                "popfq;"
-                : [lock] "=m"((s)->lock)
-                : [flags] "m"((s)->rflags)
-                : "memory", "cc");
+      "lock cmpxchgq %[node], %[tail];"
+      "sete %[swapped]"
+      : [tail] "+m"((s)->tail), "+a"(old), [swapped] "=q"(swapped)
+      : [node] "r"(node)
+      : "memory", "cc");
+  return swapped;
+}
+
+/**
+ * @brief Locks a queue lock
+ *
+ * @param s QLOCK structure
+ * @param f File name
+ * @param ln Line number
+ */
+void qlock_lock_implementation(QLOCK *s, const char *f, const int ln) {
+  (void) f;
+  (void) ln;
+
+  uint64_t rflags = interrupts_save();
+  QLOCK_NODE *node = qlock_get_node();
+  QLOCK_NODE *prev = qlock_swap_tail(s, node);
+
+  if (prev) {
+    *(QLOCK_NODE *volatile *) &prev->next = node;
+    while (!*(volatile uint32_t *) &node->locked) {
+      lock_relax();
+    }
+  }
+  s->holder = node;
+  s->rflags = rflags;
+}
+
+/**
+ * @brief Unlocks a queue lock, handing it to the next waiter if any
+ *
+ * @param s QLOCK structure
+ * @param f File name
+ * @param ln Line number
+ */
+void qlock_unlock_implementation(QLOCK *s, const char *f, const int ln) {
+  (void) f;
+  (void) ln;
+
+  uint64_t rflags = s->rflags;
+  QLOCK_NODE *node = s->holder;
+  QLOCK_NODE *next = *(QLOCK_NODE *volatile *) &node->next;
+
+  if (!next) {
+    if (qlock_cmpxchg_tail(s, node, NULL)) {
+      goto done;
+    }
+    /* A waiter swapped the tail but has not linked itself in yet */
+    while (!(next = *(QLOCK_NODE *volatile *) &node->next)) {
+      lock_relax();
+    }
+  }
+  *(volatile uint32_t *) &next->locked = TRUE;
+
+done:
+  node->in_use = FALSE;
+  interrupts_restore(rflags);
+}
+
+/**
+ * @brief Takes a queue lock only if nobody holds or waits for it
+ *
+ * @param s QLOCK structure
+ * @param f File name
+ * @param ln Line number
+ * @return STATUS SYS_OK if the lock was taken, SYS_ERR otherwise
+ */
+STATUS qlock_try_implementation(QLOCK *s, const char *f, const int ln) {
+  (void) f;
+  (void) ln;
+
+  uint64_t rflags = interrupts_save();
+  if (*(QLOCK_NODE *volatile *) &s->tail) {
+    interrupts_restore(rflags);
+    return SYS_ERR;
+  }
+
+  QLOCK_NODE *node = qlock_get_node();
+  if (!qlock_cmpxchg_tail(s, NULL, node)) {
+    node->in_use = FALSE;
+    interrupts_restore(rflags);
+    return SYS_ERR;
+  }
+  s->holder = node;
+  s->rflags = rflags;
+  return SYS_OK;
 }
@@ -3,12 +3,131 @@
  * @author Zack Bostock
  * @brief Memory helpers, needed for compiler
  * @verbatim
+ * Copies and fills are done with rep movsb/stosb on CPUs with enhanced rep
+ * strings (ERMS), where microcode moves whole cache lines at a time. Those
+ * instructions take a while to get going, so requests below
+ * MEM_REP_THRESHOLD bytes use unrolled 8-byte loops instead, unless the CPU
+ * also has fast short rep movsb (FSRM). CPUs without ERMS always use the
+ * loops. memory_init picks between them once the boot CPU's features are
+ * known, until then the loops are used.
+ *
+ * The loops must never be turned back into calls to these functions, so
+ * they are built without loop pattern distribution.
+ *
+ * memcmp and memchr go a word at a time too. memchr looks for the byte
+ * with MEM_HAS_ZERO on the word XORed with the byte repeated, memcmp
+ * byte swaps the first words which differ so they order like the bytes.
  *
  * @copyright Copyright (c) 2024
  *
  */
 
 #include <common/memory.h>
+#include <sys/cpu.h>
+#include <sys/cpu_features.h>
+
+#define MEM_NO_BUILTIN                                          \
+      __attribute__((optimize("no-tree-loop-distribute-patterns")))
+
+/* Set by memory_init */
+static uint8_t mem_erms = FALSE;
+static uint8_t mem_fsrm = FALSE;
+
+/**
+ * @brief Picks the copy and fill routines for the boot CPU's features
+ */
+void memory_init() {
+  mem_erms = check_cpu_support(cpuid_feature_erms) == SYS_OK;
+  mem_fsrm = mem_erms && check_cpu_support(cpuid_feature_fsrm) == SYS_OK;
+  klogi("Memory routines: %s, fast short copies: %s\n",
+        mem_erms ? "rep movsb/stosb" : "8-byte loops",
+        mem_fsrm ? "yes" : "no");
+}
+
+/**
+ * @brief Copies from the first byte to the last, 32 bytes per iteration
+ * @note Also safe for overlapping buffers as long as dst is below src,
+ *       since every word is loaded before anything is stored over it
+ *
+ * @param dst Destination
+ * @param src Source
+ * @param num Number of bytes
+ */
+static MEM_NO_BUILTIN void mem_copy_forward(uint8_t *dst, const uint8_t *src,
+                                            size_t num) {
+  for (; num >= 4 * sizeof(uint64_t); num -= 4 * sizeof(uint64_t)) {
+    uint64_t a = ((const MEM_WORD *) src)[0];
+    uint64_t b = ((const MEM_WORD *) src)[1];
+    uint64_t c = ((const MEM_WORD *) src)[2];
+    uint64_t d = ((const MEM_WORD *) src)[3];
+    ((MEM_WORD *) dst)[0] = a;
+    ((MEM_WORD *) dst)[1] = b;
+    ((MEM_WORD *) dst)[2] = c;
+    ((MEM_WORD *) dst)[3] = d;
+    dst += 4 * sizeof(uint64_t);
+    src += 4 * sizeof(uint64_t);
+  }
+  for (; num >= sizeof(uint64_t); num -= sizeof(uint64_t)) {
+    *(MEM_WORD *) dst = *(const MEM_WORD *) src;
+    dst += sizeof(uint64_t);
+    src += sizeof(uint64_t);
+  }
+  while (num--) {
+    *dst++ = *src++;
+  }
+}
+
+/**
+ * @brief Copies from the last byte to the first, for overlapping buffers
+ *        where dst is above src
+ *
+ * @param dst Destination
+ * @param src Source
+ * @param num Number of bytes
+ */
+static MEM_NO_BUILTIN void mem_copy_backward(uint8_t *dst, const uint8_t *src,
+                                             size_t num) {
+  dst += num;
+  src += num;
+  for (; num >= 4 * sizeof(uint64_t); num -= 4 * sizeof(uint64_t)) {
+    dst -= 4 * sizeof(uint64_t);
+    src -= 4 * sizeof(uint64_t);
+    uint64_t a = ((const MEM_WORD *) src)[3];
+    uint64_t b = ((const MEM_WORD *) src)[2];
+    uint64_t c = ((const MEM_WORD *) src)[1];
+    uint64_t d = ((const MEM_WORD *) src)[0];
+    ((MEM_WORD *) dst)[3] = a;
+    ((MEM_WORD *) dst)[2] = b;
+    ((MEM_WORD *) dst)[1] = c;
+    ((MEM_WORD *) dst)[0] = d;
+  }
+  for (; num >= sizeof(uint64_t); num -= sizeof(uint64_t)) {
+    dst -= sizeof(uint64_t);
+    src -= sizeof(uint64_t);
+    *(MEM_WORD *) dst = *(const MEM_WORD *) src;
+  }
+  while (num--) {
+    *--dst = *--src;
+  }
+}
+
+/**
+ * @brief Copies memory with whichever routine suits the size
+ * @note rep movsb copies as if one byte at a time from the first, so it is
+ *       also safe for overlapping buffers where dst is below src
+ *
+ * @param dst Destination
+ * @param src Source
+ * @param num Number of bytes
+ */
+static inline void mem_copy(void *dst, const void *src, size_t num) {
+  if (mem_erms && (mem_fsrm || num >= MEM_REP_THRESHOLD)) {
+    __asm__ volatile("rep movsb"
+                     : "+D"(dst), "+S"(src), "+c"(num) : : "memory");
+    return;
+  }
+  mem_copy_forward((uint8_t *) dst, (const uint8_t *) src, num);
+}
 
 /**
  * @brief Copies memory from one location to another.
@@ -19,26 +138,41 @@
  * @return void* Destination where memory was copied to
  */
 void *memcpy(void *dst, const void *src, size_t num) {
-  uint8_t *u8Dst = (uint8_t *)dst;
-  const uint8_t *u8Src = (const uint8_t *)src;
-  for (size_t i = 0; i < num; i++) {
-    u8Dst[i] = u8Src[i];
-  }
+  mem_copy(dst, src, num);
   return dst;
 }
 
 /**
- * @brief
+ * @brief Fills memory with a byte value
  *
  * @param ptr Memory location to start from
  * @param value Value to set it to
  * @param num Number of bytes to set
  * @return void* Pointer to the memory which was set
  */
-void *memset(void *ptr, int value, size_t num) {
+MEM_NO_BUILTIN void *memset(void *ptr, int value, size_t num) {
+  if (mem_erms && num >= MEM_REP_THRESHOLD) {
+    void *dst = ptr;
+    __asm__ volatile("rep stosb"
+                     : "+D"(dst), "+c"(num) : "a"(value) : "memory");
+    return ptr;
+  }
+
   uint8_t *u8Ptr = (uint8_t *)ptr;
-  for (size_t i = 0; i < num; i++) {
-    u8Ptr[i] = (uint8_t)value;
+  uint64_t pattern = (uint8_t) value * MEM_ONES;
+  for (; num >= 4 * sizeof(uint64_t); num -= 4 * sizeof(uint64_t)) {
+    ((MEM_WORD *) u8Ptr)[0] = pattern;
+    ((MEM_WORD *) u8Ptr)[1] = pattern;
+    ((MEM_WORD *) u8Ptr)[2] = pattern;
+    ((MEM_WORD *) u8Ptr)[3] = pattern;
+    u8Ptr += 4 * sizeof(uint64_t);
+  }
+  for (; num >= sizeof(uint64_t); num -= sizeof(uint64_t)) {
+    *(MEM_WORD *) u8Ptr = pattern;
+    u8Ptr += sizeof(uint64_t);
+  }
+  while (num--) {
+    *u8Ptr++ = (uint8_t)value;
   }
   return ptr;
 }
@@ -49,22 +183,66 @@ void *memset(void *ptr, int value, size_t num) {
  * @param ptr1 First memory location to compare to
  * @param ptr2 Second memory location
  * @param num Number of bytes to compare
- * @return int 1 if different, 0 if not
+ * @return int Less than, equal to or greater than 0 as the first differing
+ *         byte of ptr1 is below, the same as or above the one of ptr2
  */
-int memcmp(const void *ptr1, const void *ptr2, size_t num) {
+int (memcmp)(const void *ptr1, const void *ptr2, size_t num) {
   const uint8_t *u8Ptr1 = (const uint8_t *)ptr1;
   const uint8_t *u8Ptr2 = (const uint8_t *)ptr2;
 
+  for (; num >= sizeof(uint64_t); num -= sizeof(uint64_t)) {
+    uint64_t a = *(const MEM_WORD *) u8Ptr1;
+    uint64_t b = *(const MEM_WORD *) u8Ptr2;
+    if (a != b) {
+      a = __builtin_bswap64(a);
+      b = __builtin_bswap64(b);
+      return a < b ? -1 : 1;
+    }
+    u8Ptr1 += sizeof(uint64_t);
+    u8Ptr2 += sizeof(uint64_t);
+  }
   for (size_t i = 0; i < num; i++) {
     if (u8Ptr1[i] != u8Ptr2[i]) {
-      return 1;
+      return u8Ptr1[i] - u8Ptr2[i];
     }
   }
   return 0;
 }
 
+/**
+ * @brief Finds the first occurrence of a byte
+ *
+ * @param ptr Memory location to search from
+ * @param value Byte to look for
+ * @param num Number of bytes to search
+ * @return void* Pointer to the byte, NULL if it is not found
+ */
+void *memchr(const void *ptr, int value, size_t num) {
+  const uint8_t *u8Ptr = (const uint8_t *)ptr;
+  uint8_t byte = (uint8_t)value;
+  uint64_t pattern = byte * MEM_ONES;
+
+  for (; num >= sizeof(uint64_t); num -= sizeof(uint64_t)) {
+    uint64_t mask = MEM_HAS_ZERO(*(const MEM_WORD *) u8Ptr ^ pattern);
+    if (mask) {
+      return (void *) (u8Ptr + MEM_ZERO_INDEX(mask));
+    }
+    u8Ptr += sizeof(uint64_t);
+  }
+  for (; num; num--, u8Ptr++) {
+    if (*u8Ptr == byte) {
+      return (void *) u8Ptr;
+    }
+  }
+  return NULL;
+}
+
 /**
  * @brief Moves memory from one place to another.
+ * @verbatim
+ * Unless the destination starts inside the source, copying from the first
+ * byte never overwrites source bytes before they are read, so it takes the
+ * same path as memcpy. Only that case is copied backwards.
  *
  * @param dest Destination of where to move to
  * @param src Source of where the data is
@@ -74,14 +252,13 @@ int memcmp(const void *ptr1, const void *ptr2, size_t num) {
 void *memmove(void *dest, const void *src, size_t n) {
   uint8_t *pdest = (uint8_t *)dest;
   const uint8_t *psrc = (const uint8_t *)src;
-  if (src > dest) {
-    for (size_t i = 0; i < n; i++) {
-      pdest[i] = psrc[i];
-    }
-  } else if (src < dest) {
-    for (size_t i = n; i > 0; i--) {
-      pdest[i - 1] = psrc[i - 1];
-    }
+  if (pdest == psrc || !n) {
+    return dest;
+  }
+  if (pdest < psrc || pdest >= psrc + n) {
+    mem_copy(pdest, psrc, n);
+  } else {
+    mem_copy_backward(pdest, psrc, n);
   }
   return dest;
 }
@@ -2,12 +2,24 @@
  * @file string.c
  * @author Zack Bostock
  * @brief Functionality pertaining to string manipulation
+ * @verbatim
+ * Strings are read 8 bytes at a time, MEM_HAS_ZERO (see memory.h) tells if
+ * a word holds the terminator. Words are only read from 8-byte aligned
+ * addresses, so a read never crosses into the next page (which may not be
+ * mapped) even when it goes past the end of the string. The bytes up to
+ * the first aligned address are handled one at a time. strcmp and strncmp
+ * can only align both strings when they are equally misaligned, otherwise
+ * they compare byte by byte.
  *
  * @copyright Copyright (c) 2024
  *
  */
 
 #include <common/string.h>
+#include <common/memory.h>
+
+/* Bytes to go until a pointer is 8-byte aligned */
+#define STR_TO_ALIGN(ptr)   (-(uintptr_t) (ptr) & (sizeof(uint64_t) - 1))
 
 /**
  * @brief string copying function for a specific number of bytes
@@ -22,14 +34,24 @@ char *strncpy(char *dest, const char *src, size_t num) {
         return NULL;
     }
 
-    size_t i;
-
-    for (i = 0; i < num && src[i] != '\0'; i++) {
+    size_t i = 0;
+    size_t head = STR_TO_ALIGN(src);
+    for (; i < num && i < head && src[i] != '\0'; i++) {
         dest[i] = src[i];
     }
-    for (; i < num; i++) {
-        dest[i] = '\0';
+    if (i == head) {
+        for (; num - i >= sizeof(uint64_t); i += sizeof(uint64_t)) {
+            uint64_t word = *(const MEM_WORD *) (src + i);
+            if (MEM_HAS_ZERO(word)) {
+                break;
+            }
+            *(MEM_WORD *) (dest + i) = word;
+        }
     }
+    for (; i < num && src[i] != '\0'; i++) {
+        dest[i] = src[i];
+    }
+    memset(dest + i, 0, num - i);
     return dest;
 }
 
@@ -41,8 +63,67 @@ char *strncpy(char *dest, const char *src, size_t num) {
  */
 size_t strlen(const char *str) {
     const char *s = str;
-    while (*s) {
-        ++s;
+    for (size_t head = STR_TO_ALIGN(s); head; head--, s++) {
+        if (!*s) {
+            return s - str;
+        }
+    }
+
+    uint64_t mask;
+    while (!(mask = MEM_HAS_ZERO(*(const MEM_WORD *) s))) {
+        s += sizeof(uint64_t);
+    }
+    return s + MEM_ZERO_INDEX(mask) - str;
+}
+
+/**
+ * @brief Compares two strings, at most a number of characters
+ *
+ * @param str1 First string
+ * @param str2 Second string
+ * @param num Most characters to compare
+ * @return int Less than, equal to or greater than 0 as the first differing
+ *         character of str1 is below, the same as or above the one of str2
+ */
+int strncmp(const char *str1, const char *str2, size_t num) {
+    const uint8_t *s1 = (const uint8_t *) str1;
+    const uint8_t *s2 = (const uint8_t *) str2;
+
+    /* Skip whole words while they match and hold no terminator */
+    if (STR_TO_ALIGN(s1) == STR_TO_ALIGN(s2)) {
+        for (size_t head = STR_TO_ALIGN(s1); head && num; head--, num--) {
+            if (*s1 != *s2 || !*s1) {
+                return *s1 - *s2;
+            }
+            s1++;
+            s2++;
+        }
+        for (; num >= sizeof(uint64_t); num -= sizeof(uint64_t)) {
+            uint64_t word = *(const MEM_WORD *) s1;
+            if (word != *(const MEM_WORD *) s2 || MEM_HAS_ZERO(word)) {
+                break;
+            }
+            s1 += sizeof(uint64_t);
+            s2 += sizeof(uint64_t);
+        }
+    }
+
+    for (; num; num--, s1++, s2++) {
+        if (*s1 != *s2 || !*s1) {
+            return *s1 - *s2;
+        }
     }
-    return s - str;
+    return 0;
+}
+
+/**
+ * @brief Compares two strings
+ *
+ * @param str1 First string
+ * @param str2 Second string
+ * @return int Less than, equal to or greater than 0 as the first differing
+ *         character of str1 is below, the same as or above the one of str2
+ */
+int strcmp(const char *str1, const char *str2) {
+    return strncmp(str1, str2, SIZE_MAX);
 }
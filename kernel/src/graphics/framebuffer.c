@@ -9,6 +9,7 @@
  */
 
 #include <graphics/framebuffer.h>
+#include <sys/fpu.h>
 
 /**
  * @brief Initialization of a framebuffer
@@ -33,7 +34,9 @@ void fb_init(struct limine_framebuffer_request req) {
     initial_fb.pitch = fb->pitch;
     klogi("Framebuffer: %d x %d pixels\n", fb->width, fb->height);
     initial_fb.bpp = fb->bpp;
-    // initial_fb.swapbuffer = malloc(fb->width * fb->height * 4);
+    /* Only backed once double-buffering starts writing to it */
+    initial_fb.swapbuffer = vm_reserve("framebuffer swapbuffer",
+                                       fb->pitch * fb->height, VM_DEFAULT);
   }
 
   klogi("INIT FRAMEBUFFER: finished...\n");
@@ -132,7 +135,7 @@ void fb_refresh(FRAMEBUFFER *fb) {
         dst[i] = src[i];
       }
     }
-    memcpy(fb->base, fb->swapbuffer, len);
+    fpu_memcpy(fb->base, fb->swapbuffer, len);
   }
 }
 
@@ -49,20 +49,30 @@ void system_init() {
     /* Initialize CPU specific features */
     cpu_init(0);
 
+    /* Pick the copy and fill routines for the CPU's features */
+    memory_init();
+
     /* Initialize interrupt service routines */
     isr_init();
 
+    /* ACPI (MADT, SRAT and SLIT) initialization, before memory so that */
+    /* the physical allocator can split its pools by NUMA node */
+    acpi_init(rsdp_request);
+
     /* Memory initialization */
     pm_init(mem_req);
     vm_init(mem_req, kernel_addr_request);
 
+    /* Page faults on reserved areas can be resolved from here on */
+    fault_init();
+
+    /* Save area for kernel_fpu_begin on the boot CPU */
+    fpu_alloc_state();
+
     /* Indicate the memory usage after virtual memory has been initialized */
     klogi("SYSTEM INIT: Memory used after initial mapping\n");
     pm_used();
 
-    /* ACPI (and MADT) initialization */
-    acpi_init(rsdp_request);
-
     /* High Precision Event Timer (HPET) initialization */
     hpet_init();
 
@@ -90,5 +100,19 @@ void system_init() {
     /* Initialize Advanced Programmable Interrupt Controller */
     apic_init();
 
+    /* Nothing else reads these responses, and they are about to be freed */
+    hhdm_request.response = NULL;
+    bl_info_req.response = NULL;
+    kernel_addr_request.response = NULL;
+    framebuffer_req.response = NULL;
+
+    /* Give bootloader and ACPI reclaimable memory to the allocator */
+    boot_reclaim(&mem_req, &psf_file_request, &rsdp_request);
+
     klogi("SYSTEM INIT: System initialized successfully...\n");
+
+#if KERNEL_BENCHMARKS
+    /* Run boot-time benchmarks now that the timers are available */
+    bench_run();
+#endif
 }
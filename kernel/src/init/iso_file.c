@@ -9,6 +9,8 @@
  */
 
 #include <init/iso_file.h>
+#include <common/memory.h>
+#include <common/string.h>
 
 /**
  * @brief Helper to see if the string ends which a specific string sequence.
@@ -18,37 +20,11 @@
  * @return int 1 if the specified ending, 0 otherwise
  */
 int check_string_ending(const char *str, const char *end) {
-    const char *_str = str;
-    const char *_end = end;
+    size_t str_length = strlen(str);
+    size_t end_length = strlen(end);
 
-    while (*str != 0) {
-        str++;
-    }
-    str--;
-
-    while (*end != 0) {
-        end++;
-    }
-    end--;
-
-    while (1) {
-        if (*str != *end) {
-            return 0;
-        }
-
-        str--;
-        end--;
-
-        if (end == _end || (str == _str && end == _end)) {
-            return 1;
-        }
-
-        if (str == _str) {
-            return 0;
-        }
-    }
-
-    return 0;
+    return end_length <= str_length &&
+           !memcmp(str + str_length - end_length, end, end_length);
 }
 
 /*
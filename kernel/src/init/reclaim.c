@@ -0,0 +1,133 @@
+/**
+ * @file reclaim.c
+ * @author Zack Bostock
+ * @brief Reclaims the memory used by the bootloader and the ACPI tables
+ * @verbatim
+ * pm_init leaves LIMINE_MEMMAP_BOOTLOADER_RECLAIMABLE and
+ * LIMINE_MEMMAP_ACPI_RECLAIMABLE entries marked as used, since the Limine
+ * responses (and the boot stack) live in the former and the ACPI tables
+ * in the latter. Once the kernel is done initializing, the responses it
+ * still refers to and the ACPI tables are copied into kernel memory, and
+ * both kinds of entries are given to the physical allocator.
+ *
+ * Module contents (e.g. the PSF font) are in LIMINE_MEMMAP_KERNEL_AND_MODULES
+ * memory, which is kept, so only the module list is copied.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <init/reclaim.h>
+#include <common/kmalloc.h>
+#include <common/string.h>
+#include <sys/mmu.h>
+#include <sys/acpi/acpi.h>
+
+/**
+ * @brief Copies a string into kernel memory
+ *
+ * @param str String to copy, may be NULL
+ * @return char * Copy, NULL if str is NULL
+ */
+static char *boot_copy_string(const char *str) {
+    if (!str) {
+        return NULL;
+    }
+    size_t length = strlen(str) + 1;
+    char *copy = kmalloc(length);
+    memcpy(copy, str, length);
+    return copy;
+}
+
+/**
+ * @brief Copies the memory map response into kernel memory
+ *
+ * @param req Memory map request, repointed at the copy
+ */
+static void boot_copy_memmap(volatile LIMINE_MEM_REQ *req) {
+    LIMINE_MEM_RES *res = req->response;
+    if (!res) {
+        return;
+    }
+
+    /* Response, entry pointers and entries in one allocation */
+    uint64_t count = res->entry_count;
+    LIMINE_MEM_RES *copy = kmalloc(sizeof(LIMINE_MEM_RES) +
+                                   count * sizeof(void *) +
+                                   count * sizeof(struct limine_memmap_entry));
+    struct limine_memmap_entry **pointers =
+        (struct limine_memmap_entry **) (copy + 1);
+    struct limine_memmap_entry *entries =
+        (struct limine_memmap_entry *) (pointers + count);
+
+    *copy = *res;
+    copy->entries = pointers;
+    for (uint64_t i = 0; i < count; i++) {
+        entries[i] = *res->entries[i];
+        pointers[i] = &entries[i];
+    }
+    req->response = copy;
+}
+
+/**
+ * @brief Copies the module list into kernel memory, the modules themselves
+ *        are left where they are
+ *
+ * @param req Module request, repointed at the copy
+ */
+static void boot_copy_modules(volatile LIMINE_MODULE_REQ *req) {
+    LIMINE_MODULE_RESP *res = req->response;
+    if (!res) {
+        return;
+    }
+
+    uint64_t count = res->module_count;
+    LIMINE_MODULE_RESP *copy = kmalloc(sizeof(LIMINE_MODULE_RESP) +
+                                       count * sizeof(void *) +
+                                       count * sizeof(LIMINE_FILE));
+    LIMINE_FILE **pointers = (LIMINE_FILE **) (copy + 1);
+    LIMINE_FILE *files = (LIMINE_FILE *) (pointers + count);
+
+    *copy = *res;
+    copy->modules = pointers;
+    for (uint64_t i = 0; i < count; i++) {
+        files[i] = *res->modules[i];
+        files[i].path = boot_copy_string(res->modules[i]->path);
+        files[i].cmdline = boot_copy_string(res->modules[i]->cmdline);
+        pointers[i] = &files[i];
+    }
+    req->response = copy;
+}
+
+/**
+ * @brief Copies out everything which is still needed from reclaimable
+ *        memory, then frees it
+ * @verbatim
+ * Must be called once the kernel no longer runs on the stack it was
+ * entered with (see _start), and no other Limine response is used after
+ * this.
+ *
+ * @param mem_req Memory map request
+ * @param module_req Module request
+ * @param rsdp_req RSDP request
+ */
+void boot_reclaim(volatile LIMINE_MEM_REQ *mem_req,
+                  volatile LIMINE_MODULE_REQ *module_req,
+                  volatile LIMINE_RSDP_REQ *rsdp_req) {
+    klogi("RECLAIM: starting...\n");
+    uint64_t before = pm_free_size();
+
+    boot_copy_memmap(mem_req);
+    boot_copy_modules(module_req);
+    acpi_relocate(rsdp_req);
+
+    uint64_t bootloader = pm_reclaim(*mem_req,
+                                     LIMINE_MEMMAP_BOOTLOADER_RECLAIMABLE);
+    uint64_t acpi = pm_reclaim(*mem_req, LIMINE_MEMMAP_ACPI_RECLAIMABLE);
+
+    klogi("RECLAIM: %d KB from the bootloader, %d KB from ACPI\n",
+          bootloader / 1024, acpi / 1024);
+    klogi("RECLAIM: free memory %d KB before, %d KB after\n",
+          before / 1024, pm_free_size() / 1024);
+    klogi("RECLAIM: finished...\n");
+}
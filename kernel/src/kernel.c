@@ -10,10 +10,13 @@
 
 #include <kernel.h>
 
+/* The stack Limine enters with is in bootloader reclaimable memory */
+static uint8_t kernel_stack[KERNEL_STACK_SIZE] __attribute__((aligned(16)));
+
 /**
- * @brief Main entry point from bootloader to kernel.
+ * @brief Runs the kernel once it is on its own stack.
  */
-void _start() {
+static void __attribute__((noreturn)) kernel_main() {
 
   /* Sets vital system settings */
   system_init();
@@ -25,5 +28,22 @@ void _start() {
   "/ __  /| (_) || |   | | / /| (_) || | | || (_) ||__   _|\n"
   "\\/ /_/  \\___/ |_|   |_|/___|\\___/ |_| |_| \\___/    |_|  \n"
   "                                                        \n");
-  while (1) {}
+  /* Idle loop, clear frames ahead of time for PM_ZERO requests */
+  while (1) {
+    zero_pool_idle();
+  }
+}
+
+/**
+ * @brief Main entry point from bootloader to kernel.
+ * @verbatim
+ * Moves off the bootloader's stack first, so that the memory it lives in
+ * can be reclaimed at the end of system_init.
+ */
+void _start() {
+  __asm__ volatile("mov %0, %%rsp\n\t"
+                   "call %P1"
+                   : : "r"(kernel_stack + KERNEL_STACK_SIZE), "i"(kernel_main)
+                   : "memory");
+  __builtin_unreachable();
 }
@@ -0,0 +1,54 @@
+/**
+ * @file memcpy_avx2.c
+ * @author Zack Bostock
+ * @brief Copies with 256-bit AVX2 loads and stores
+ * @verbatim
+ * Built with AVX2 enabled, so the 32-byte vectors below turn into vmovdqu.
+ * Four registers are moved per iteration to keep enough loads in flight,
+ * and the compiler clears the upper halves (vzeroupper) before returning
+ * so that legacy SSE code does not pay a transition penalty.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <simd/simd.h>
+#include <common/memory.h>
+
+/* Unaligned 256-bit vector which may alias anything */
+typedef long long SIMD_YMM
+    __attribute__((__vector_size__(32), __aligned__(1), __may_alias__));
+
+/**
+ * @brief Copies memory with AVX2, must be called between kernel_fpu_begin
+ *        and kernel_fpu_end
+ *
+ * @param dst Destination, must not overlap src
+ * @param src Source
+ * @param num Number of bytes
+ */
+void memcpy_avx2(void *dst, const void *src, size_t num) {
+    uint8_t *d = (uint8_t *) dst;
+    const uint8_t *s = (const uint8_t *) src;
+
+    for (; num >= 4 * sizeof(SIMD_YMM); num -= 4 * sizeof(SIMD_YMM)) {
+        SIMD_YMM a = ((const SIMD_YMM *) s)[0];
+        SIMD_YMM b = ((const SIMD_YMM *) s)[1];
+        SIMD_YMM c = ((const SIMD_YMM *) s)[2];
+        SIMD_YMM e = ((const SIMD_YMM *) s)[3];
+        ((SIMD_YMM *) d)[0] = a;
+        ((SIMD_YMM *) d)[1] = b;
+        ((SIMD_YMM *) d)[2] = c;
+        ((SIMD_YMM *) d)[3] = e;
+        d += 4 * sizeof(SIMD_YMM);
+        s += 4 * sizeof(SIMD_YMM);
+    }
+    for (; num >= sizeof(SIMD_YMM); num -= sizeof(SIMD_YMM)) {
+        *(SIMD_YMM *) d = *(const SIMD_YMM *) s;
+        d += sizeof(SIMD_YMM);
+        s += sizeof(SIMD_YMM);
+    }
+    if (num) {
+        memcpy(d, s, num);
+    }
+}
@@ -14,6 +14,9 @@
 /* NOTE: SDT => System Descriptor Table */
 static ACPI_SDT *sdt = NULL;
 static uint8_t use_xsdt = FALSE;
+/* Copies of the RSDP and its response which outlive the bootloader's */
+static XSDP rsdp_copy;
+static LIMINE_RSDP_RES rsdp_res_copy;
 
 /**
  * @brief Helper for adding together bytes in the ACPI structure.
@@ -47,6 +50,12 @@ ACPI_SDT *acpi_get_sdt(const char *signature) {
         return NULL;
     }
 
+    if (strlen(signature) != sizeof(sdt->header.signature)) {
+        kloge("INIT ACPI: \"%s\" is not a 4 character signature!\n",
+              signature);
+        return NULL;
+    }
+
     /* Turnary operator here is for compatibility with ver 2.0 or greater */
     size_t length = (sdt->header.length - sizeof(ACPI_SDT_HEADER)) /
                       (use_xsdt ? 8 : 4);
@@ -55,7 +64,9 @@ ACPI_SDT *acpi_get_sdt(const char *signature) {
         ACPI_SDT *table = (ACPI_SDT *) PHYS_TO_VIRT((use_xsdt ?
                           ((uint64_t *) sdt->data)[i] :
                           ((uint32_t *) sdt->data)[i]));
-        if (!memcmp(table->header.signature, signature, strlen(signature))) {
+        /* Constant size, so a single 4-byte compare */
+        if (!memcmp(table->header.signature, signature,
+                    sizeof(table->header.signature))) {
             klogi("INIT ACPI: found SDT \"%s\" %x\n", signature, table);
             return table;
         }
@@ -124,5 +135,67 @@ void acpi_init(LIMINE_RSDP_REQ req) {
 
     /* Initialize Multiple APIC Description Table (MADT) */
     madt_init();
+    /* NUMA topology, needed by pm_init to split memory by node */
+    numa_init();
     klogi("INIT ACPI: finished...\n");
 }
+
+/**
+ * @brief Copies the ACPI tables into kernel memory, so that the ranges the
+ *        firmware keeps them in can be reclaimed
+ * @verbatim
+ * Every table listed by the RSDT/XSDT is copied, and the root table is
+ * rebuilt with 64-bit entries (i.e. as an XSDT) pointing at the copies,
+ * since the copies may live above 4 GB. The MADT is parsed again, as the
+ * records it handed out pointed into the old copy.
+ *
+ * Tables which are only reached through other tables (e.g. the DSDT) are
+ * left where they are, the kernel does not use them yet.
+ *
+ * @param req RSDP request from the bootloader, repointed at a copy
+ */
+void acpi_relocate(volatile LIMINE_RSDP_REQ *req) {
+    if (!sdt) {
+        return;
+    }
+
+    if (req->response) {
+        XSDP *rsdp = (XSDP *) req->response->address;
+        memcpy(&rsdp_copy, rsdp,
+               rsdp->revision == 2 ? sizeof(XSDP) : sizeof(RSDP));
+        rsdp_res_copy = *req->response;
+        rsdp_res_copy.address = &rsdp_copy;
+        req->response = &rsdp_res_copy;
+    }
+
+    size_t count = (sdt->header.length - sizeof(ACPI_SDT_HEADER)) /
+                   (use_xsdt ? 8 : 4);
+    ACPI_SDT *root = kmalloc(sizeof(ACPI_SDT_HEADER) + count * 8);
+    if (!root) {
+        kloge("ACPI: Out of memory when relocating the tables\n");
+        return;
+    }
+    root->header = sdt->header;
+    root->header.length = sizeof(ACPI_SDT_HEADER) + count * 8;
+
+    uint64_t bytes = root->header.length;
+    for (size_t i = 0; i < count; i++) {
+        ACPI_SDT *table = (ACPI_SDT *) PHYS_TO_VIRT((use_xsdt ?
+                          ((uint64_t *) sdt->data)[i] :
+                          ((uint32_t *) sdt->data)[i]));
+        ACPI_SDT *copy = kmalloc(table->header.length);
+        if (!copy) {
+            kloge("ACPI: Out of memory when relocating the tables\n");
+            kfree(root);
+            return;
+        }
+        memcpy(copy, table, table->header.length);
+        ((uint64_t *) root->data)[i] = VIRT_TO_PHYS(copy);
+        bytes += table->header.length;
+    }
+
+    sdt = root;
+    use_xsdt = TRUE;
+    madt_init();
+    klogi("ACPI: relocated %d tables (%d KB)\n", count, bytes / 1024);
+}
@@ -276,15 +276,18 @@ void apic_init() {
         halt();
     }
 
-    local_apic_base = (void *) PHYS_TO_VIRT(madt_get_local_apic_base());
+    /* The APIC must be visible to all tasks */
+    local_apic_base = (void *) vm_map_mmio("local APIC",
+                                           madt_get_local_apic_base(),
+                                           PAGE_SIZE);
+    if (!local_apic_base) {
+        kloge("INIT APIC: Could not map the local APIC registers!\n");
+        halt();
+    }
 
     /* Reset the error register */
     apic_reset_error_reg();
 
-    /* The APIC must be visible to all tasks */
-    vm_map(NULL, (uint64_t) local_apic_base, VIRT_TO_PHYS(local_apic_base),
-           1, VM_MMIO);
-    
     klogi("INIT APIC: APIC base memory %x mapped\n", local_apic_base);
 
     klogi("INIT APIC: Enabling APIC...\n");
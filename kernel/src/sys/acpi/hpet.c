@@ -22,6 +22,8 @@ static HPET_SDT *hpet_sdt = NULL;
 /*       the number which is stored here */
 static uint16_t num_hpet_comparators = HPET_MAX_COMPARATOR;
 static uint64_t hpet_period = 0;
+/* Length of one main counter tick in femtoseconds */
+static uint64_t hpet_period_fs = 0;
 
 /**
  * @brief Helper function which unsets the ENABLE_CNF value in the
@@ -67,6 +69,22 @@ static inline uint64_t hpet_read_main_counter_value() {
     return hpet->main_counter_value;
 }
 
+/**
+ * @brief Converts the main counter value of the HPET into nanoseconds
+ * @note Split into whole and partial nanosecond parts so that the
+ *       femtosecond product does not overflow for long uptimes
+ *
+ * @return uint64_t Nanoseconds counted, 0 if no HPET is initialized
+ */
+uint64_t hpet_get_nanoseconds() {
+    if (!hpet || !hpet_period_fs) {
+        return 0;
+    }
+    uint64_t ticks = hpet->main_counter_value;
+    return (ticks / HPET_FS_PER_NS) * hpet_period_fs +
+           ((ticks % HPET_FS_PER_NS) * hpet_period_fs) / HPET_FS_PER_NS;
+}
+
 /**
  * @brief Helper for reading the revision number of the HPET
  * 
@@ -201,10 +219,12 @@ STATUS hpet_init() {
     }
 
     /* Map as memory mapped IO device, should be visible to all               */
-    vm_map(NULL, PHYS_TO_VIRT(hpet_sdt->address.address),
-           (uint64_t) hpet_sdt->address.address, 1, VM_MMIO);
-
-    hpet = (HPET *) PHYS_TO_VIRT(hpet_sdt->address.address);
+    hpet = (HPET *) vm_map_mmio("HPET", hpet_sdt->address.address,
+                                PAGE_SIZE);
+    if (!hpet) {
+        kloge("INIT HPET: Could not map the HPET registers!\n");
+        return SYS_ERR;
+    }
 
     /* Read the revision number and print it out                              */
     if (hpet_sdt->hw_rev_id == 0) {
@@ -253,6 +273,7 @@ STATUS hpet_init() {
 
     klogi("INIT HPET: HPET frequency detected as %d HZ\n", freq);
     hpet_period = counter_clk_period / 1000000;
+    hpet_period_fs = counter_clk_period;
 
     #if HPET_LONE_MODE
     klogi("INIT HPET: Current value of main counter: %d\n",
@@ -66,10 +66,15 @@ uint64_t madt_get_local_apic_base() {
 
 /**
  * @brief Main MADT initialization function
+ * @verbatim
+ * Also called again by acpi_relocate once the tables have moved, so the
+ * records are always looked up from scratch.
  */
 void madt_init() {
     klogi("INIT MADT: starting...\n");
     madt = (MADT *) acpi_get_sdt("APIC");
+    num_local_apic = 0;
+    num_io_apics = 0;
 
     if (!madt) {
         kloge("MADT INIT: \"APIC\" signature not found!\n");
@@ -0,0 +1,307 @@
+/**
+ * @file numa.c
+ * @author Zack Bostock
+ * @brief NUMA topology from the SRAT and SLIT ACPI tables
+ * @verbatim
+ * The SRAT assigns each processor (by local APIC ID) and each range of
+ * physical memory a proximity domain, and the SLIT gives the relative
+ * distance between every pair of domains. Domains are numbered by the
+ * firmware and can be sparse, so they are renumbered into nodes 0 to
+ * numa_num_nodes() - 1 in the order they are first seen.
+ *
+ * Everything is copied into static tables, since this runs before the
+ * physical allocator (which splits its free pools by node) and the ACPI
+ * tables are moved later on by acpi_relocate. Without an SRAT the whole
+ * machine is node 0.
+ * @ref ACPI Specification 6.5, sections 5.2.16 and 5.2.17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <sys/acpi/numa.h>
+#include <sys/cpu.h>
+
+static uint32_t num_nodes = 1;
+static uint32_t node_domains[NUMA_MAX_NODES] = {0};
+static uint32_t num_ranges = 0;
+static NUMA_RANGE ranges[NUMA_MAX_RANGES];
+static uint32_t num_cpus = 0;
+static NUMA_CPU cpus[MAX_CPUS];
+static uint8_t distances[NUMA_MAX_NODES][NUMA_MAX_NODES];
+/* Per node, every node ordered from nearest to farthest */
+static uint8_t fallbacks[NUMA_MAX_NODES][NUMA_MAX_NODES];
+
+/**
+ * @brief Gets the node of a proximity domain, giving it the next node
+ *        number if it has not been seen yet
+ *
+ * @param domain Proximity domain from the SRAT
+ * @return uint32_t Node, 0 if there are too many nodes to track
+ */
+static uint32_t numa_domain_node(uint32_t domain) {
+    for (uint32_t i = 0; i < num_nodes; i++) {
+        if (node_domains[i] == domain) {
+            return i;
+        }
+    }
+    if (num_nodes >= NUMA_MAX_NODES) {
+        kloge("NUMA: proximity domain %d is past the node limit\n", domain);
+        return 0;
+    }
+    node_domains[num_nodes] = domain;
+    return num_nodes++;
+}
+
+/**
+ * @brief Adds a memory range, keeping the ranges sorted by base address
+ *
+ * @param base Physical base address
+ * @param length Length in bytes
+ * @param node Node the range belongs to
+ */
+static void numa_add_range(uint64_t base, uint64_t length, uint32_t node) {
+    if (num_ranges >= NUMA_MAX_RANGES) {
+        kloge("NUMA: too many memory ranges, %x - %x is ignored\n", base,
+              base + length);
+        return;
+    }
+
+    uint32_t i = num_ranges++;
+    for (; i > 0 && ranges[i - 1].base > base; i--) {
+        ranges[i] = ranges[i - 1];
+    }
+    ranges[i].base = base;
+    ranges[i].length = length;
+    ranges[i].node = node;
+}
+
+/**
+ * @brief Records the node of a processor
+ *
+ * @param apic_id Local APIC ID of the processor
+ * @param node Node of the processor
+ */
+static void numa_add_cpu(uint32_t apic_id, uint32_t node) {
+    if (num_cpus >= MAX_CPUS) {
+        return;
+    }
+    cpus[num_cpus].apic_id = apic_id;
+    cpus[num_cpus].node = node;
+    num_cpus++;
+}
+
+/**
+ * @brief Walks the SRAT and records the processors and memory ranges
+ *
+ * @param srat Static Resource Affinity Table
+ */
+static void numa_parse_srat(SRAT *srat) {
+    uint64_t size = srat->header.length - sizeof(SRAT);
+    num_nodes = 0;
+
+    for (uint64_t i = 0; i < size;) {
+        SRAT_RECORD_HEADER *record = (SRAT_RECORD_HEADER *)(srat->records + i);
+        if (!record->length) {
+            break;
+        }
+
+        switch (record->type) {
+            case SRAT_RECORD_TYPE_LAPIC: {
+                SRAT_RECORD_LAPIC *lapic = (SRAT_RECORD_LAPIC *) record;
+                if (!(lapic->flags & SRAT_FLAG_ENABLED)) {
+                    break;
+                }
+                uint32_t domain = lapic->domain_low |
+                                  (lapic->domain_high[0] << 8) |
+                                  (lapic->domain_high[1] << 16) |
+                                  ((uint32_t) lapic->domain_high[2] << 24);
+                numa_add_cpu(lapic->apic_id, numa_domain_node(domain));
+                break;
+            }
+            case SRAT_RECORD_TYPE_MEMORY: {
+                SRAT_RECORD_MEMORY *mem = (SRAT_RECORD_MEMORY *) record;
+                if (!(mem->flags & SRAT_FLAG_ENABLED) || !mem->length) {
+                    break;
+                }
+                numa_add_range(mem->base, mem->length,
+                               numa_domain_node(mem->domain));
+                break;
+            }
+            case SRAT_RECORD_TYPE_X2APIC: {
+                SRAT_RECORD_X2APIC *x2apic = (SRAT_RECORD_X2APIC *) record;
+                if (!(x2apic->flags & SRAT_FLAG_ENABLED)) {
+                    break;
+                }
+                numa_add_cpu(x2apic->x2apic_id,
+                             numa_domain_node(x2apic->domain));
+                break;
+            }
+        }
+        i += record->length;
+    }
+
+    if (!num_nodes) {
+        num_nodes = 1;
+        node_domains[0] = 0;
+    }
+}
+
+/**
+ * @brief Fills in the distances between nodes from the SLIT, and the order
+ *        in which each node falls back to the others
+ *
+ * @param slit System Locality Information Table, NULL if there is none
+ */
+static void numa_parse_slit(SLIT *slit) {
+    uint64_t n = slit ? slit->num_localities : 0;
+
+    for (uint32_t i = 0; i < num_nodes; i++) {
+        for (uint32_t j = 0; j < num_nodes; j++) {
+            if (node_domains[i] < n && node_domains[j] < n) {
+                distances[i][j] =
+                    slit->entries[node_domains[i] * n + node_domains[j]];
+            } else {
+                distances[i][j] = i == j ? NUMA_LOCAL_DISTANCE :
+                                           NUMA_REMOTE_DISTANCE;
+            }
+        }
+    }
+
+    /* Insertion sort by distance, a node always comes first in its own */
+    for (uint32_t i = 0; i < num_nodes; i++) {
+        uint32_t count = 0;
+        fallbacks[i][count++] = i;
+        for (uint32_t j = 0; j < num_nodes; j++) {
+            if (j == i) {
+                continue;
+            }
+            uint32_t k = count++;
+            for (; k > 1 && distances[i][fallbacks[i][k - 1]] >
+                            distances[i][j]; k--) {
+                fallbacks[i][k] = fallbacks[i][k - 1];
+            }
+            fallbacks[i][k] = j;
+        }
+    }
+}
+
+/**
+ * @brief Gets the number of NUMA nodes
+ *
+ * @return uint32_t Number of nodes, at least 1
+ */
+uint32_t numa_num_nodes() {
+    return num_nodes;
+}
+
+/**
+ * @brief Gets the number of memory ranges listed in the SRAT
+ *
+ * @return uint32_t Number of ranges, 0 without an SRAT
+ */
+uint32_t numa_num_ranges() {
+    return num_ranges;
+}
+
+/**
+ * @brief Gets the memory ranges listed in the SRAT, sorted by base address
+ *
+ * @return NUMA_RANGE * Memory ranges
+ */
+NUMA_RANGE *numa_get_ranges() {
+    return ranges;
+}
+
+/**
+ * @brief Gets the node of a processor
+ *
+ * @param apic_id Local APIC ID of the processor
+ * @return uint32_t Node of the processor, 0 if not listed in the SRAT
+ */
+uint32_t numa_apic_node(uint32_t apic_id) {
+    for (uint32_t i = 0; i < num_cpus; i++) {
+        if (cpus[i].apic_id == apic_id) {
+            return cpus[i].node;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Gets the relative distance between two nodes
+ *
+ * @param from Node making the access
+ * @param to Node being accessed
+ * @return uint8_t Distance, NUMA_LOCAL_DISTANCE if from and to are the same
+ */
+uint8_t numa_distance(uint32_t from, uint32_t to) {
+    if (from >= num_nodes || to >= num_nodes) {
+        return NUMA_REMOTE_DISTANCE;
+    }
+    return distances[from][to];
+}
+
+/**
+ * @brief Gets the nodes to allocate from on behalf of a node, nearest first
+ *
+ * @param node Node the allocation is for
+ * @param index Position in the fallback order, below numa_num_nodes()
+ * @return uint32_t Node to try, index 0 is always node itself
+ */
+uint32_t numa_fallback(uint32_t node, uint32_t index) {
+    if (node >= num_nodes) {
+        node = 0;
+    }
+    return fallbacks[node][index];
+}
+
+/**
+ * @brief Main NUMA initialization function, must run before pm_init
+ * @verbatim
+ * Also sets the node of the calling (boot) processor, which is what the
+ * physical allocator uses to pick the local node.
+ */
+void numa_init() {
+    klogi("INIT NUMA: starting...\n");
+    num_ranges = 0;
+    num_cpus = 0;
+
+    SRAT *srat = (SRAT *) acpi_get_sdt("SRAT");
+    if (srat) {
+        numa_parse_srat(srat);
+    } else {
+        num_nodes = 1;
+        node_domains[0] = 0;
+    }
+    numa_parse_slit((SLIT *) acpi_get_sdt("SLIT"));
+
+    for (uint32_t i = 0; i < num_ranges; i++) {
+        klogi("NUMA: node %d: %x - %x\n", ranges[i].node, ranges[i].base,
+              ranges[i].base + ranges[i].length);
+    }
+
+    /* Tag every processor found by madt_init with its node */
+    MADT_RECORD_LAPIC **lapics = madt_get_local_apics();
+    for (uint32_t i = 0; i < madt_get_num_local_apics(); i++) {
+        klogi("NUMA: CPU %d (APIC ID %d) on node %d\n",
+              lapics[i]->process_id, lapics[i]->apic_id,
+              numa_apic_node(lapics[i]->apic_id));
+    }
+
+    for (uint32_t i = 0; i < num_nodes; i++) {
+        klogi("NUMA: node %d (domain %d) distances:", i, node_domains[i]);
+        for (uint32_t j = 0; j < num_nodes; j++) {
+            klogi(" %d", distances[i][j]);
+        }
+        klogi("\n");
+    }
+
+    uint32_t eax, ebx, ecx, edx;
+    if (cpuid(1, &eax, &ebx, &ecx, &edx) == SYS_OK) {
+        this_cpu()->node = numa_apic_node(ebx >> 24);
+    }
+
+    klogi("INIT NUMA: finished (%d nodes, boot CPU on node %d)...\n",
+          num_nodes, this_cpu()->node);
+}
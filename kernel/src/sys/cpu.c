@@ -10,9 +10,15 @@
 
 #include <sys/cpu.h>
 #include <sys/cpu_features.h>
+#include <sys/fpu.h>
 #include <common/memory.h>
 
+CPU_LOCAL cpu_locals[MAX_CPUS] = {0};
+
 static char cpu_manufacturer[13] = {0};
+/* Cache topology, filled in by cpu_detect_caches */
+static CPU_CACHE cpu_caches[CPU_MAX_CACHES];
+static uint8_t num_cpu_caches = 0;
 /*
     Some predefined vendors that GCC recognizes where the value of EBX is
     already known.
@@ -38,8 +44,12 @@ static VENDOR vendor_amd = {
  */
 STATUS check_cpu_support(CPUID_FEATURE feature) {
     uint32_t registers[4];
-    cpuid(feature.feature, &registers[CPUID_EAX], &registers[CPUID_EBX],
-          &registers[CPUID_ECX], &registers[CPUID_EDX]);
+    if (cpuid_count(feature.feature, feature.param, &registers[CPUID_EAX],
+                    &registers[CPUID_EBX], &registers[CPUID_ECX],
+                    &registers[CPUID_EDX]) != SYS_OK) {
+        /* Leaf is above the highest one this CPU supports */
+        return SYS_ERR;
+    }
 
     if (registers[feature.registers] & feature.mask) {
         return SYS_OK;
@@ -129,6 +139,141 @@ void get_cpu_family(int *f, int *stepping, int *mn) {
     }
 }
 
+/**
+ * @brief Records every cache described by a deterministic cache parameters
+ *        leaf (4 on Intel, 0x8000001D on AMD, which share a layout)
+ *
+ * @param leaf Leaf to read, one subleaf per cache
+ */
+static void cpu_read_cache_leaf(uint32_t leaf) {
+    uint32_t registers[4];
+
+    for (uint32_t i = 0; num_cpu_caches < CPU_MAX_CACHES; i++) {
+        STATUS ret = cpuid_count(leaf, i, &registers[CPUID_EAX],
+                                 &registers[CPUID_EBX], &registers[CPUID_ECX],
+                                 &registers[CPUID_EDX]);
+        /* A type of 0 ends the list */
+        if (ret != SYS_OK || !(registers[CPUID_EAX] & 0x1F)) {
+            break;
+        }
+
+        CPU_CACHE *cache = &cpu_caches[num_cpu_caches++];
+        cache->type = registers[CPUID_EAX] & 0x1F;
+        cache->level = (registers[CPUID_EAX] >> 5) & 0x7;
+        cache->shared_threads = ((registers[CPUID_EAX] >> 14) & 0xFFF) + 1;
+        cache->line_size = (registers[CPUID_EBX] & 0xFFF) + 1;
+        cache->partitions = ((registers[CPUID_EBX] >> 12) & 0x3FF) + 1;
+        cache->ways = ((registers[CPUID_EBX] >> 22) & 0x3FF) + 1;
+        cache->sets = registers[CPUID_ECX] + 1;
+        cache->size = (uint64_t) cache->ways * cache->partitions *
+                      cache->line_size * cache->sets;
+    }
+}
+
+/**
+ * @brief Decodes the associativity field of cpuid 0x80000006
+ *
+ * @param code 4-bit associativity field
+ * @return uint32_t Number of ways, 0 if disabled or fully associative
+ */
+static uint32_t cpu_legacy_ways(uint32_t code) {
+    static const uint32_t ways[16] = {0, 1, 2, 0, 4, 0, 8, 0, 16, 0, 32, 48,
+                                      64, 96, 128, 0};
+    return ways[code & 0xF];
+}
+
+/**
+ * @brief Records the L2 and L3 caches from cpuid 0x80000006, for CPUs
+ *        without a deterministic cache parameters leaf
+ */
+static void cpu_read_cache_legacy() {
+    uint32_t registers[4];
+    if (cpuid(0x80000006, &registers[CPUID_EAX], &registers[CPUID_EBX],
+              &registers[CPUID_ECX], &registers[CPUID_EDX]) != SYS_OK) {
+        return;
+    }
+
+    uint64_t sizes[2] = {
+        ((registers[CPUID_ECX] >> 16) & 0xFFFF) * 1024ULL,
+        ((registers[CPUID_EDX] >> 18) & 0x3FFF) * 512ULL * 1024,
+    };
+    uint32_t ways[2] = {
+        cpu_legacy_ways(registers[CPUID_ECX] >> 12),
+        cpu_legacy_ways(registers[CPUID_EDX] >> 12),
+    };
+    uint16_t line_size = registers[CPUID_ECX] & 0xFF;
+
+    for (uint8_t i = 0; i < 2; i++) {
+        if (!sizes[i] || !ways[i] || !line_size) {
+            continue;
+        }
+        CPU_CACHE *cache = &cpu_caches[num_cpu_caches++];
+        cache->type = CPU_CACHE_UNIFIED;
+        cache->level = i + 2;
+        cache->shared_threads = 0;
+        cache->line_size = line_size;
+        cache->partitions = 1;
+        cache->ways = ways[i];
+        cache->sets = sizes[i] / (ways[i] * line_size);
+        cache->size = sizes[i];
+    }
+}
+
+/**
+ * @brief Detects the size and geometry of every cache level
+ * @verbatim
+ * AMD CPUs with topology extensions describe their caches in 0x8000001D,
+ * Intel CPUs in leaf 4. Anything else only gets the L2 and L3 sizes from
+ * the older 0x80000006 leaf.
+ */
+static void cpu_detect_caches() {
+    num_cpu_caches = 0;
+    if (check_cpu_support(cpuid_feature_topoext) == SYS_OK) {
+        cpu_read_cache_leaf(0x8000001D);
+    }
+    if (!num_cpu_caches) {
+        cpu_read_cache_leaf(0x4);
+    }
+    if (!num_cpu_caches) {
+        cpu_read_cache_legacy();
+    }
+}
+
+/**
+ * @brief Gets the number of caches found by cpu_detect_caches
+ *
+ * @return uint8_t Number of caches
+ */
+uint8_t cpu_num_caches() {
+    return num_cpu_caches;
+}
+
+/**
+ * @brief Gets a cache found by cpu_detect_caches
+ *
+ * @param index Cache, below cpu_num_caches()
+ * @return CPU_CACHE * Cache, NULL if index is out of range
+ */
+CPU_CACHE *cpu_get_cache(uint8_t index) {
+    return index < num_cpu_caches ? &cpu_caches[index] : NULL;
+}
+
+/**
+ * @brief Gets the last level cache, the highest level data or unified cache
+ *
+ * @return CPU_CACHE * Last level cache, NULL if no caches were found
+ */
+CPU_CACHE *cpu_llc() {
+    CPU_CACHE *llc = NULL;
+    for (uint8_t i = 0; i < num_cpu_caches; i++) {
+        if (cpu_caches[i].type != CPU_CACHE_INSTRUCTION &&
+            (!llc || cpu_caches[i].level > llc->level)) {
+            llc = &cpu_caches[i];
+        }
+    }
+    return llc;
+}
+
 /**
  * @brief Get the CPU cache info
  *
@@ -138,12 +283,22 @@ void get_cpu_family(int *f, int *stepping, int *mn) {
  */
 void get_cpu_cache_info(int *cache_line_size, int *l2_cache_size,
                         int *l3_cache_size) {
-    uint32_t registers[4];
-    __cpuid(0x80000006, registers[CPUID_EAX], registers[CPUID_EBX],
-            registers[CPUID_ECX], registers[CPUID_EDX]);
-    *cache_line_size = registers[CPUID_ECX] & 0xFF;
-    *l2_cache_size = (registers[CPUID_ECX] >> 16) & 0xFFFF;
-    *l3_cache_size = (registers[CPUID_EDX] >> 18) & 0x3FFF;
+    *cache_line_size = 0;
+    *l2_cache_size = 0;
+    *l3_cache_size = 0;
+    for (uint8_t i = 0; i < num_cpu_caches; i++) {
+        CPU_CACHE *cache = &cpu_caches[i];
+        if (cache->type == CPU_CACHE_INSTRUCTION) {
+            continue;
+        }
+        if (cache->level == 1) {
+            *cache_line_size = cache->line_size;
+        } else if (cache->level == 2) {
+            *l2_cache_size = cache->size / 1024;
+        } else if (cache->level == 3) {
+            *l3_cache_size = cache->size / 1024;
+        }
+    }
 }
 
 /**
@@ -173,6 +328,14 @@ void print_cpu_info() {
     klogi("Cache Lines: %d Bytes\n", cache_line_size);
     klogi("L2 cache:    %d KB\n", l2_cache_size);
     klogi("L3 cache:    %d KB\n", l3_cache_size);
+    for (uint8_t i = 0; i < num_cpu_caches; i++) {
+        CPU_CACHE *cache = &cpu_caches[i];
+        klogi("L%d %s: %d KB, %d-way, %d sets, %d B lines, shared by %d\n",
+              cache->level, cache->type == CPU_CACHE_DATA ? "data" :
+              cache->type == CPU_CACHE_INSTRUCTION ? "instruction" :
+              "unified", cache->size / 1024, cache->ways, cache->sets,
+              cache->line_size, cache->shared_threads);
+    }
 }
 
 /**
@@ -184,6 +347,13 @@ void cpu_init(size_t cpu_number) {
 
     klogi("INIT CPU %d: starting...\n", cpu_number);
 
+    /* Point the GS base at this CPU's data so this_cpu() can find it */
+    CPU_LOCAL *local = &cpu_locals[cpu_number];
+    local->self = local;
+    local->cpu_number = cpu_number;
+    local->online = TRUE;
+    write_msr(MSR_GS_BASE_ADDR, (uint64_t) local);
+
     /* Check for PAT support and enable */
     /*
         NOTE: Functionality -
@@ -206,6 +376,25 @@ void cpu_init(size_t cpu_number) {
         write_msr(MSR_PAT, pat_value);
     }
 
+    /* PGE: Global pages are kept in the TLB across CR3 reloads, which the */
+    /* kernel half uses since it is mapped the same in every address space */
+    if (check_cpu_support(cpuid_feature_pge) == SYS_OK) {
+        klogi("CPU INIT: CPU %d enabling global pages\n", cpu_number);
+        WRITE_TO_CR4_BIT(CR4_PAGE_GLOBAL_ENABLE);
+    }
+
+    /* PCIDE: TLB entries are tagged with the PCID in CR3, so switching */
+    /* address spaces does not have to flush them (see tlb.c). Needs PGE so */
+    /* the kernel half does not end up cached once per PCID, and can only */
+    /* be turned on while the PCID in CR3 is 0. */
+    if (check_cpu_support(cpuid_feature_pcid) == SYS_OK &&
+        check_cpu_support(cpuid_feature_pge) == SYS_OK &&
+        !(read_cr(cr3) & CR3_PCID_MASK)) {
+        klogi("CPU INIT: CPU %d enabling process context identifiers\n",
+              cpu_number);
+        WRITE_TO_CR4_BIT(CR4_PCID_ENABLE);
+    }
+
     /* OSFXSR: Enables 128-bit SSE support.   */
     /* OSXMMEXCPT: Enables the #XF exception. */
     /*
@@ -218,7 +407,11 @@ void cpu_init(size_t cpu_number) {
     WRITE_TO_CR4_BIT(CR4_FXSAVE_FXRSTOR_INSTRUCTIONS);
     WRITE_TO_CR4_BIT(CR4_UNMASKED_SIMD_FLOATING_POINT_EXCEPTIONS);
 
+    /* OSXSAVE and XCR0, for kernel_fpu_begin/end (see fpu.c) */
+    fpu_init(cpu_number);
+
     /* Print out the CPU manufacturer */
+    cpu_detect_caches();
     klogi("Printing out CPU %d's info\n", cpu_number);
     print_cpu_info();
     klogi("INIT CPU %d: finished...\n", cpu_number);
@@ -0,0 +1,229 @@
+/**
+ * @file fpu.c
+ * @author Zack Bostock
+ * @brief Kernel use of the FPU and SIMD registers
+ * @verbatim
+ * fpu_init enables every state component the CPU has that the kernel knows
+ * how to save (x87, SSE, AVX and AVX-512) in XCR0. Whatever is in those
+ * registers when the kernel wants to use them belongs to someone else, so
+ * kernel_fpu_begin saves it into a per-CPU area and kernel_fpu_end puts it
+ * back. XSAVEOPT skips components which are still in their initial state
+ * or unchanged since the last restore, CPUs without XSAVE fall back to
+ * FXSAVE (x87 and SSE only).
+ *
+ * Interrupts stay disabled between the two, which also keeps the section
+ * from being preempted or moved to another CPU. Sections nest, only the
+ * outermost one saves and restores.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <sys/fpu.h>
+#include <sys/cpu.h>
+#include <sys/cpu_features.h>
+#include <sys/mmu.h>
+#include <simd/simd.h>
+
+static FPU_INFO fpu_info = {0};
+
+/**
+ * @brief Writes an extended control register
+ *
+ * @param index Register, 0 for XCR0
+ * @param value Value to write
+ */
+static inline void fpu_xsetbv(uint32_t index, uint64_t value) {
+    __asm__ volatile("xsetbv" : : "c"(index), "a"((uint32_t) value),
+                     "d"((uint32_t) (value >> 32)) : "memory");
+}
+
+/**
+ * @brief Saves the enabled state components
+ *
+ * @param area Save area, 64 byte aligned
+ */
+static inline void fpu_save(uint8_t *area) {
+    uint32_t low = (uint32_t) fpu_info.xcr0;
+    uint32_t high = (uint32_t) (fpu_info.xcr0 >> 32);
+
+    if (fpu_info.xsaveopt) {
+        __asm__ volatile("xsaveopt64 (%0)"
+                         : : "r"(area), "a"(low), "d"(high) : "memory");
+    } else if (fpu_info.xsave) {
+        __asm__ volatile("xsave64 (%0)"
+                         : : "r"(area), "a"(low), "d"(high) : "memory");
+    } else {
+        __asm__ volatile("fxsave64 (%0)" : : "r"(area) : "memory");
+    }
+}
+
+/**
+ * @brief Restores the state components saved by fpu_save
+ *
+ * @param area Save area
+ */
+static inline void fpu_restore(uint8_t *area) {
+    uint32_t low = (uint32_t) fpu_info.xcr0;
+    uint32_t high = (uint32_t) (fpu_info.xcr0 >> 32);
+
+    if (fpu_info.xsave) {
+        __asm__ volatile("xrstor64 (%0)"
+                         : : "r"(area), "a"(low), "d"(high) : "memory");
+    } else {
+        __asm__ volatile("fxrstor64 (%0)" : : "r"(area) : "memory");
+    }
+}
+
+/**
+ * @brief Detects the extended state features and enables them on a CPU,
+ *        called from cpu_init
+ *
+ * @param cpu_number CPU being initialized, features are read on CPU 0
+ */
+void fpu_init(size_t cpu_number) {
+    /* The FPU is present (no emulation), and wait honours CR0.TS */
+    write_cr(cr0, (read_cr(cr0) & ~(1 << CR0_EMULATION)) |
+                  (1 << CR0_MONITOR_CO_PROCESSOR));
+
+    if (cpu_number == 0) {
+        fpu_info.xsave = check_cpu_support(cpuid_feature_xsave) == SYS_OK;
+        fpu_info.xcr0 = XCR0_X87 | XCR0_SSE;
+        fpu_info.state_size = FPU_FXSAVE_SIZE;
+    }
+
+    if (!fpu_info.xsave) {
+        klogi("CPU INIT: CPU %d saves SSE state with fxsave\n", cpu_number);
+        return;
+    }
+
+    WRITE_TO_CR4_BIT(CR4_PROCESSOR_EXTENDED_STATES_ENABLE);
+
+    uint32_t eax, ebx, ecx, edx;
+    if (cpu_number == 0 && cpuid_count(0xD, 0, &eax, &ebx, &ecx, &edx) ==
+                           SYS_OK) {
+        fpu_info.xsaveopt =
+            check_cpu_support(cpuid_feature_xsaveopt) == SYS_OK;
+        if (check_cpu_support(cpuid_feature_avx) == SYS_OK &&
+            (eax & XCR0_AVX)) {
+            fpu_info.xcr0 |= XCR0_AVX;
+            fpu_info.avx = TRUE;
+            fpu_info.avx2 = check_cpu_support(cpuid_feature_avx2) == SYS_OK;
+        }
+        if (fpu_info.avx &&
+            check_cpu_support(cpuid_feature_avx512f) == SYS_OK &&
+            (eax & XCR0_AVX512) == XCR0_AVX512) {
+            fpu_info.xcr0 |= XCR0_AVX512;
+            fpu_info.avx512 = TRUE;
+        }
+    }
+
+    fpu_xsetbv(0, fpu_info.xcr0);
+
+    /* EBX is the size needed by the components enabled in XCR0 */
+    if (cpu_number == 0 && cpuid_count(0xD, 0, &eax, &ebx, &ecx, &edx) ==
+                           SYS_OK) {
+        fpu_info.state_size = ebx;
+    }
+
+    klogi("CPU INIT: CPU %d XCR0 %x (AVX: %s, AVX2: %s, AVX-512: %s), "
+          "%d byte save area\n", cpu_number, fpu_info.xcr0,
+          fpu_info.avx ? "yes" : "no", fpu_info.avx2 ? "yes" : "no",
+          fpu_info.avx512 ? "yes" : "no", fpu_info.state_size);
+}
+
+/**
+ * @brief Allocates the save area of the calling CPU, must run after
+ *        pm_init and before its first kernel_fpu_begin
+ */
+void fpu_alloc_state() {
+    CPU_LOCAL *local = this_cpu();
+    if (local->fpu_state) {
+        return;
+    }
+
+    /* Page aligned, and the XSAVE header must start out zeroed */
+    uint64_t phys = pm_get(NUM_PAGES(fpu_info.state_size), 0x0, PM_ZERO,
+                           __func__, __LINE__);
+    local->fpu_state = (uint8_t *) PHYS_TO_VIRT(phys);
+}
+
+/**
+ * @brief Starts a section in which the kernel may use vector registers
+ * @verbatim
+ * Disables interrupts until the matching kernel_fpu_end, so sections must
+ * be short.
+ */
+void kernel_fpu_begin() {
+    uint64_t flags = interrupts_save();
+    CPU_LOCAL *local = this_cpu();
+
+    if (local->fpu_depth++) {
+        return;
+    }
+    if (!local->fpu_state) {
+        kloge("FPU: CPU %d has no save area, see fpu_alloc_state\n",
+              local->cpu_number);
+        halt();
+    }
+
+    local->fpu_rflags = flags;
+    fpu_save(local->fpu_state);
+}
+
+/**
+ * @brief Ends a section started with kernel_fpu_begin
+ */
+void kernel_fpu_end() {
+    CPU_LOCAL *local = this_cpu();
+
+    if (!local->fpu_depth) {
+        kloge("FPU: kernel_fpu_end without kernel_fpu_begin\n");
+        return;
+    }
+    if (--local->fpu_depth) {
+        return;
+    }
+
+    fpu_restore(local->fpu_state);
+    interrupts_restore(local->fpu_rflags);
+}
+
+/**
+ * @brief Checks if the AVX2 routines of simd.h may be used
+ *
+ * @return uint8_t TRUE if AVX2 is available and enabled in XCR0
+ */
+uint8_t fpu_has_avx2() {
+    return fpu_info.avx2;
+}
+
+/**
+ * @brief Checks if AVX-512 state is enabled in XCR0
+ *
+ * @return uint8_t TRUE if AVX-512 foundation is available
+ */
+uint8_t fpu_has_avx512() {
+    return fpu_info.avx512;
+}
+
+/**
+ * @brief Copies memory with AVX2 when the copy is long enough to pay for
+ *        saving the extended state, otherwise with memcpy
+ *
+ * @param dst Destination, must not overlap src
+ * @param src Source
+ * @param num Number of bytes
+ * @return void * dst
+ */
+void *fpu_memcpy(void *dst, const void *src, size_t num) {
+    if (!fpu_info.avx2 || num < FPU_COPY_THRESHOLD ||
+        !this_cpu()->fpu_state) {
+        return memcpy(dst, src, num);
+    }
+
+    kernel_fpu_begin();
+    memcpy_avx2(dst, src, num);
+    kernel_fpu_end();
+    return dst;
+}
@@ -113,25 +113,38 @@ void isr_handler(REGISTERS *regs) {
     halt();
   } else {
     /* Reserved interrupt, hang the system */
-    kloge("Unhandled Exception!\n");
-    klogi("%s.\nError code: %d (%x)\n\n",
-          exceptions[regs->interrupt], regs->error_code, regs->error_code);
-    walk_memory((void *) regs->rbp, 8);
-    stack_walk((void *) regs->rbp, 4);
-    klogi("\nRIP   : (%x)\nCS    : (%x)\nRFLAGS: (%x)\n"
-            "RSP   : (%x)\nSS    : (%x)\n"
-            "RAX   : %x\nRBX   : %x\nRCX   : %x\nRDX   : %x\n"
-            "RSI   : %x\nRDI   : %x\nRBP   : %x\n"
-            "R8    : %x\nR9    : %x\nR10   : %x\nR11   : %x\n"
-            "R12   : %x\nR13   : %x\nR14   : %x\nR15   : %x\n\n",
-            regs->rip, regs->cs, regs->rflags, regs->rsp, regs->ss, regs->rax,
-            regs->rbx, regs->rcx, regs->rdx, regs->rsi, regs->rdi, regs->rbp,
-            regs->r8, regs->r9, regs->r10, regs->r11, regs->r12, regs->r13,
-            regs->r14, regs->r15);
-    halt();
+    isr_fatal(regs);
   }
 }
 
+/**
+ * @brief Dumps the state of an exception which cannot be recovered from and
+ *        hangs the system
+ * @verbatim
+ * Also used by registered exception handlers (e.g. the page fault handler)
+ * once they find that they cannot service the exception.
+ *
+ * @param regs Information about the calling process.
+ */
+void isr_fatal(REGISTERS *regs) {
+  kloge("Unhandled Exception!\n");
+  klogi("%s.\nError code: %d (%x)\n\n",
+        exceptions[regs->interrupt], regs->error_code, regs->error_code);
+  walk_memory((void *) regs->rbp, 8);
+  stack_walk((void *) regs->rbp, 4);
+  klogi("\nRIP   : (%x)\nCS    : (%x)\nRFLAGS: (%x)\n"
+          "RSP   : (%x)\nSS    : (%x)\n"
+          "RAX   : %x\nRBX   : %x\nRCX   : %x\nRDX   : %x\n"
+          "RSI   : %x\nRDI   : %x\nRBP   : %x\n"
+          "R8    : %x\nR9    : %x\nR10   : %x\nR11   : %x\n"
+          "R12   : %x\nR13   : %x\nR14   : %x\nR15   : %x\n\n",
+          regs->rip, regs->cs, regs->rflags, regs->rsp, regs->ss, regs->rax,
+          regs->rbx, regs->rcx, regs->rdx, regs->rsi, regs->rdi, regs->rbp,
+          regs->r8, regs->r9, regs->r10, regs->r11, regs->r12, regs->r13,
+          regs->r14, regs->r15);
+  halt();
+}
+
 /**
  * @brief Helper for registering handlers for specific ISRs.
  * @verbatim
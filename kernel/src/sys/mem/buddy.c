@@ -0,0 +1,351 @@
+/**
+ * @file buddy.c
+ * @author Zack Bostock
+ * @brief Binary buddy physical memory allocator
+ * @verbatim
+ * Free memory is kept as naturally aligned blocks of 2^order pages for
+ * orders 0 to BUDDY_MAX_ORDER, with one free list per order. The list links
+ * live inside the free blocks themselves (through the higher half direct
+ * map), so the only side storage is one byte per frame recording the order
+ * of the free block which starts at that frame.
+ *
+ * Allocating splits the smallest large enough block in half until it fits,
+ * and freeing merges a block with its buddy (block ^ 2^order) for as long as
+ * the buddy is free, so both are O(log n). Requests which are not a power of
+ * two give the unused tail of the block straight back to the free lists.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <sys/mem/buddy.h>
+#include <sys/mmu.h>
+
+/**
+ * @brief Helper to get the free list link stored in a free block
+ *
+ * @param b Buddy allocator
+ * @param page First frame of the block
+ * @return BUDDY_BLOCK * Link inside the block
+ */
+static inline BUDDY_BLOCK *buddy_block(BUDDY *b, uint64_t page) {
+    return (BUDDY_BLOCK *) PHYS_TO_VIRT((b->first_page + page) * PAGE_SIZE);
+}
+
+/**
+ * @brief Helper to get the first frame of a block from its free list link
+ *
+ * @param b Buddy allocator
+ * @param block Free list link
+ * @return uint64_t First frame of the block
+ */
+static inline uint64_t buddy_page(BUDDY *b, BUDDY_BLOCK *block) {
+    return VIRT_TO_PHYS(block) / PAGE_SIZE - b->first_page;
+}
+
+/**
+ * @brief Pushes a block onto the free list of its order
+ *
+ * @param b Buddy allocator
+ * @param page First frame of the block
+ * @param order Order of the block
+ */
+static void buddy_list_add(BUDDY *b, uint64_t page, uint8_t order) {
+    BUDDY_BLOCK *block = buddy_block(b, page);
+    block->prev = NULL;
+    block->next = b->free_lists[order];
+    if (block->next) {
+        block->next->prev = block;
+    }
+    b->free_lists[order] = block;
+    b->free_blocks[order]++;
+    b->orders[page] = order;
+}
+
+/**
+ * @brief Unlinks a block from the free list of its order
+ *
+ * @param b Buddy allocator
+ * @param page First frame of the block
+ * @param order Order of the block
+ */
+static void buddy_list_remove(BUDDY *b, uint64_t page, uint8_t order) {
+    BUDDY_BLOCK *block = buddy_block(b, page);
+    if (block->prev) {
+        block->prev->next = block->next;
+    } else {
+        b->free_lists[order] = block->next;
+    }
+    if (block->next) {
+        block->next->prev = block->prev;
+    }
+    b->free_blocks[order]--;
+    b->orders[page] = BUDDY_NOT_FREE;
+}
+
+/**
+ * @brief Finds the free block which contains a frame
+ *
+ * @param b Buddy allocator
+ * @param page Frame to look for
+ * @param order Returns the order of the block
+ * @return uint64_t First frame of the block, BUDDY_NONE if the frame is used
+ */
+static uint64_t buddy_find_head(BUDDY *b, uint64_t page, uint8_t *order) {
+    for (uint8_t o = 0; o <= BUDDY_MAX_ORDER; o++) {
+        uint64_t head = page & ~(BUDDY_ORDER_PAGES(o) - 1);
+        if (b->orders[head] != BUDDY_NOT_FREE && b->orders[head] >= o) {
+            *order = b->orders[head];
+            return head;
+        }
+    }
+    return BUDDY_NONE;
+}
+
+/**
+ * @brief Frees a single aligned block, merging it with its buddies
+ *
+ * @param b Buddy allocator
+ * @param page First frame of the block
+ * @param order Order of the block
+ */
+static void buddy_free_block(BUDDY *b, uint64_t page, uint8_t order) {
+    while (order < BUDDY_MAX_ORDER) {
+        uint64_t buddy = page ^ BUDDY_ORDER_PAGES(order);
+        if (buddy + BUDDY_ORDER_PAGES(order) > b->num_pages ||
+            b->orders[buddy] != order) {
+            break;
+        }
+        buddy_list_remove(b, buddy, order);
+        page &= ~BUDDY_ORDER_PAGES(order);
+        order++;
+    }
+    buddy_list_add(b, page, order);
+}
+
+/**
+ * @brief Calculates the number of bytes needed to track a number of frames
+ *
+ * @param num_pages Number of physical frames to track
+ * @return uint64_t Bytes of storage needed by buddy_init
+ */
+uint64_t buddy_storage_size(uint64_t num_pages) {
+    return num_pages;
+}
+
+/**
+ * @brief Initializes a buddy allocator with every frame marked as used
+ * @verbatim
+ * Frames are numbered from first_page, so blocks are only naturally aligned
+ * in physical memory if first_page is aligned to the largest block.
+ *
+ * @param b Buddy allocator to initialize
+ * @param storage Memory of at least buddy_storage_size bytes
+ * @param first_page Physical frame number of frame 0
+ * @param num_pages Number of physical frames to track
+ */
+void buddy_init(BUDDY *b, void *storage, uint64_t first_page,
+                uint64_t num_pages) {
+    b->orders = (uint8_t *) storage;
+    b->first_page = first_page;
+    b->num_pages = num_pages;
+    for (uint8_t o = 0; o <= BUDDY_MAX_ORDER; o++) {
+        b->free_lists[o] = NULL;
+        b->free_blocks[o] = 0;
+    }
+    memset(b->orders, BUDDY_NOT_FREE, num_pages);
+}
+
+/**
+ * @brief Frees a range of frames
+ * @verbatim
+ * The range is split into the largest naturally aligned blocks which fit.
+ * Blocks whose first frame is already free are skipped (double free), but
+ * partially free blocks are not detected.
+ *
+ * @param b Buddy allocator
+ * @param page First frame of the range
+ * @param count Number of frames
+ * @return uint64_t Number of frames which were actually freed
+ */
+uint64_t buddy_free(BUDDY *b, uint64_t page, uint64_t count) {
+    uint64_t end = page + count;
+    uint64_t freed = 0;
+
+    if (end > b->num_pages) {
+        end = b->num_pages;
+    }
+
+    while (page < end) {
+        uint8_t order;
+        uint64_t head = buddy_find_head(b, page, &order);
+        if (head != BUDDY_NONE) {
+            /* Already free, skip over the rest of that block */
+            page = head + BUDDY_ORDER_PAGES(order);
+            continue;
+        }
+
+        order = 0;
+        while (order < BUDDY_MAX_ORDER &&
+               !(page & BUDDY_ORDER_PAGES(order)) &&
+               page + BUDDY_ORDER_PAGES(order + 1) <= end) {
+            order++;
+        }
+
+        buddy_free_block(b, page, order);
+        freed += BUDDY_ORDER_PAGES(order);
+        page += BUDDY_ORDER_PAGES(order);
+    }
+    return freed;
+}
+
+/**
+ * @brief Allocates runs larger than the biggest block by looking for
+ *        consecutive free blocks of the maximum order
+ *
+ * @param b Buddy allocator
+ * @param count Number of frames
+ * @param min_page Lowest frame index which may be returned
+ * @return uint64_t First frame of the run, BUDDY_NONE if not found
+ */
+static uint64_t buddy_alloc_large(BUDDY *b, uint64_t count,
+                                  uint64_t min_page) {
+    uint64_t step = BUDDY_ORDER_PAGES(BUDDY_MAX_ORDER);
+    uint64_t page = (min_page + step - 1) & ~(step - 1);
+
+    while (page + count <= b->num_pages) {
+        uint64_t end = page;
+        while (end < page + count && b->orders[end] == BUDDY_MAX_ORDER) {
+            end += step;
+        }
+
+        if (end >= page + count) {
+            for (uint64_t p = page; p < end; p += step) {
+                buddy_list_remove(b, p, BUDDY_MAX_ORDER);
+            }
+            buddy_free(b, page + count, end - (page + count));
+            return page;
+        }
+        page = end + step;
+    }
+    return BUDDY_NONE;
+}
+
+/**
+ * @brief Allocates a run of frames
+ *
+ * @param b Buddy allocator
+ * @param count Number of frames
+ * @param min_page Lowest frame index which may be returned
+ * @return uint64_t First frame of the run, BUDDY_NONE if not found
+ */
+uint64_t buddy_alloc(BUDDY *b, uint64_t count, uint64_t min_page) {
+    if (!count) {
+        return BUDDY_NONE;
+    }
+    if (count > BUDDY_ORDER_PAGES(BUDDY_MAX_ORDER)) {
+        return buddy_alloc_large(b, count, min_page);
+    }
+
+    uint8_t order = 0;
+    while (BUDDY_ORDER_PAGES(order) < count) {
+        order++;
+    }
+
+    for (uint8_t o = order; o <= BUDDY_MAX_ORDER; o++) {
+        BUDDY_BLOCK *block = b->free_lists[o];
+        /* Only walk the list when the caller asked for a lower bound */
+        while (block && buddy_page(b, block) < min_page) {
+            block = block->next;
+        }
+        if (!block) {
+            continue;
+        }
+
+        uint64_t page = buddy_page(b, block);
+        buddy_list_remove(b, page, o);
+
+        /* Split, giving the upper halves back */
+        while (o > order) {
+            o--;
+            buddy_list_add(b, page + BUDDY_ORDER_PAGES(o), o);
+        }
+
+        /* Return the unused tail of the block */
+        if (BUDDY_ORDER_PAGES(order) > count) {
+            buddy_free(b, page + count, BUDDY_ORDER_PAGES(order) - count);
+        }
+        return page;
+    }
+    return BUDDY_NONE;
+}
+
+/**
+ * @brief Checks if every frame in a range is free
+ *
+ * @param b Buddy allocator
+ * @param page First frame of the range
+ * @param count Number of frames
+ * @return uint8_t TRUE if the whole range is free, FALSE otherwise
+ */
+uint8_t buddy_test_free(BUDDY *b, uint64_t page, uint64_t count) {
+    uint64_t end = page + count;
+    if (end > b->num_pages) {
+        return FALSE;
+    }
+
+    while (page < end) {
+        uint8_t order;
+        uint64_t head = buddy_find_head(b, page, &order);
+        if (head == BUDDY_NONE) {
+            return FALSE;
+        }
+        page = head + BUDDY_ORDER_PAGES(order);
+    }
+    return TRUE;
+}
+
+/**
+ * @brief Allocates a specific range of frames
+ *
+ * @param b Buddy allocator
+ * @param page First frame of the range
+ * @param count Number of frames
+ * @return STATUS SYS_OK if reserved, SYS_ERR if part of it was not free
+ */
+STATUS buddy_reserve(BUDDY *b, uint64_t page, uint64_t count) {
+    if (!buddy_test_free(b, page, count)) {
+        return SYS_ERR;
+    }
+
+    uint64_t end = page + count;
+    while (page < end) {
+        uint8_t order;
+        uint64_t head = buddy_find_head(b, page, &order);
+        uint64_t block_end = head + BUDDY_ORDER_PAGES(order);
+
+        /* Take the whole block, then give back what is outside the range */
+        buddy_list_remove(b, head, order);
+        if (head < page) {
+            buddy_free(b, head, page - head);
+        }
+        if (block_end > end) {
+            buddy_free(b, end, block_end - end);
+        }
+        page = block_end;
+    }
+    return SYS_OK;
+}
+
+/**
+ * @brief Prints the number of free blocks of each order
+ *
+ * @param b Buddy allocator
+ */
+void buddy_print_stats(BUDDY *b) {
+    klogi("Buddy free blocks by order:");
+    for (uint8_t o = 0; o <= BUDDY_MAX_ORDER; o++) {
+        klogi(" %d:%d", o, b->free_blocks[o]);
+    }
+    klogi("\n");
+}
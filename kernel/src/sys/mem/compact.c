@@ -0,0 +1,361 @@
+/**
+ * @file compact.c
+ * @author Zack Bostock
+ * @brief Compaction of physical memory
+ * @verbatim
+ * Runs of free frames are split up over time by frames which stay in use.
+ * Most of those can't move, since their physical address is known to
+ * whoever holds them (kmalloc and slab memory is used through the direct
+ * map, paging structures are pointed at by other tables). Frames backing
+ * the vmalloc window are different: they are only reachable through the
+ * direct map and the single 4 KB leaf which maps them into their area, so
+ * they can be copied to another frame and remapped without their owner
+ * noticing. Those frames are tagged PAGE_TYPE_MOVABLE, and their PAGE_INFO
+ * keeps the page of the window they are mapped at.
+ *
+ * When a run of more than one frame can't be found, pm_get first gives the
+ * frames cached in the magazine, the zero pool and the color bins back so
+ * that they coalesce. If that isn't enough, compact_alloc looks for the
+ * aligned window of the zone which only holds free and movable frames and
+ * needs the fewest moves, takes its free frames, and moves every movable
+ * frame out of it. The whole window then belongs to the caller.
+ *
+ * Frames handed to devices by physical address must therefore never come
+ * from vmalloc.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <sys/mem/compact.h>
+#include <sys/mmu.h>
+
+static COMPACT_STATS compact_stats = {0};
+
+/**
+ * @brief Tags a frame which backs a page of the vmalloc window as movable
+ *
+ * @param phys Physical address of the frame
+ * @param virt_addr Virtual address the frame is mapped at, frames mapped
+ *                  outside of the vmalloc window are left alone
+ */
+void compact_set_movable(uint64_t phys, uint64_t virt_addr) {
+    PAGE_INFO *info = pm_page_info(phys);
+    if (!info || !VM_IS_VMALLOC(virt_addr)) {
+        return;
+    }
+    info->type = PAGE_TYPE_MOVABLE;
+    info->vmalloc_page = (virt_addr - VM_VMALLOC_START) / PAGE_SIZE;
+}
+
+/**
+ * @brief Removes the movable tag of a frame before it is freed
+ *
+ * @param phys Physical address of the frame
+ */
+void compact_clear_movable(uint64_t phys) {
+    PAGE_INFO *info = pm_page_info(phys);
+    if (info && info->type == PAGE_TYPE_MOVABLE) {
+        info->type = PAGE_TYPE_NONE;
+    }
+}
+
+/**
+ * @brief Gives the free frames held outside of the physical allocator back
+ *        to it, so they coalesce into runs again
+ *
+ * @return uint64_t Number of frames given back
+ */
+uint64_t compact_drain() {
+    uint64_t drained = pm_magazine_drain() + zero_pool_drain() +
+                       page_color_drain();
+
+    LOCK_LOCK(&compact_stats.lock);
+    compact_stats.drained += drained;
+    UNLOCK_LOCK(&compact_stats.lock);
+    return drained;
+}
+
+/**
+ * @brief Gets the zone a request compacts, like pm_backend_alloc it only
+ *        ends up in ZONE_DMA32 if asked to or if there is no normal memory
+ *
+ * @param flags Flags of pm_get, only PM_DMA32 is looked at
+ * @return uint8_t Zone to compact
+ */
+static uint8_t compact_zone(uint64_t flags) {
+    if (flags & PM_DMA32) {
+        return ZONE_DMA32;
+    }
+    for (uint64_t i = 0; i < pm_num_pools(); i++) {
+        if (pm_get_pool(i)->zone == ZONE_NORMAL) {
+            return ZONE_NORMAL;
+        }
+    }
+    return ZONE_DMA32;
+}
+
+/**
+ * @brief Finds the window of a zone which needs the fewest moves to become
+ *        a free run
+ * @verbatim
+ * Windows are aligned to the size of the request rounded up to a power of
+ * two (at most PM_POOL_ALIGN_PAGES), so that a freed run merges back into
+ * large buddy blocks. A window holding a frame which is neither free nor
+ * movable is skipped, as is every other window overlapping that frame.
+ *
+ * Nothing is locked while scanning, the result is only a hint which
+ * compact_take_window checks again.
+ *
+ * @param num_pages Number of frames in the window
+ * @param min_page Lowest frame the window may start at
+ * @param zone Zone to search
+ * @return uint64_t First frame of the window, PM_NO_PAGE if there is none
+ */
+static uint64_t compact_find_window(uint64_t num_pages, uint64_t min_page,
+                                    uint8_t zone) {
+    uint64_t align = 1;
+    while (align < num_pages && align < PM_POOL_ALIGN_PAGES) {
+        align <<= 1;
+    }
+
+    uint64_t best = PM_NO_PAGE;
+    uint64_t best_moves = UINT64_MAX;
+
+    for (uint64_t p = 0; p < pm_num_pools(); p++) {
+        PM_POOL *pool = pm_get_pool(p);
+        if (pool->zone != zone) {
+            continue;
+        }
+
+        uint64_t start = pool->first_page > min_page ? pool->first_page :
+                                                       min_page;
+        start = (start + align - 1) & ~(align - 1);
+
+        while (start + num_pages <= PM_POOL_END(pool)) {
+            uint64_t moves = 0;
+            uint64_t page = start;
+            for (; page < start + num_pages; page++) {
+                if (pm_pool_test_free(pool, page, 1)) {
+                    continue;
+                }
+                if (pm_page_info(page * PAGE_SIZE)->type !=
+                    PAGE_TYPE_MOVABLE) {
+                    break;
+                }
+                moves++;
+            }
+
+            if (page < start + num_pages) {
+                /* First window past the frame which can't move */
+                start = (page / align + 1) * align;
+                continue;
+            }
+            if (moves < best_moves) {
+                best = start;
+                best_moves = moves;
+                if (!moves) {
+                    return best;
+                }
+            }
+            start += align;
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief Gives back the frames of a window which were taken so far, movable
+ *        frames which were not moved yet still belong to their area
+ *
+ * @param start First frame of the window
+ * @param end Frame after the last frame to give back
+ */
+static void compact_release(uint64_t start, uint64_t end) {
+    for (uint64_t page = start; page < end; page++) {
+        uint64_t phys = page * PAGE_SIZE;
+        if (pm_page_info(phys)->type != PAGE_TYPE_MOVABLE) {
+            pm_put_frames(&phys, 1);
+        }
+    }
+}
+
+/**
+ * @brief Moves a movable frame to a frame outside of the window being
+ *        compacted, the kernel address space lock must be held
+ *
+ * @param page Frame to move
+ * @return STATUS SYS_OK if moved, SYS_ERR if the frame is no longer mapped
+ *         or there is no frame to move it to
+ */
+static STATUS compact_migrate(uint64_t page) {
+    uint64_t old_phys = page * PAGE_SIZE;
+    PAGE_INFO *info = pm_page_info(old_phys);
+    if (info->type != PAGE_TYPE_MOVABLE) {
+        return SYS_ERR;
+    }
+
+    /* An area which is not in the tree anymore is in the middle of vfree */
+    uint64_t virt_addr = VM_VMALLOC_START +
+                         (uint64_t) info->vmalloc_page * PAGE_SIZE;
+    VMA *vma = vma_find(&kernel_addr_space.vmas, virt_addr);
+    if (!vma || vma->type == VMA_TYPE_FIXED) {
+        return SYS_ERR;
+    }
+
+    /* Every free frame of the window is taken, so this lands outside it */
+    uint64_t new_phys;
+    if (!pm_get_frames(&new_phys, 1)) {
+        return SYS_ERR;
+    }
+    if (vm_migrate_page(virt_addr, old_phys, new_phys) != SYS_OK) {
+        pm_put_frames(&new_phys, 1);
+        return SYS_ERR;
+    }
+
+    compact_set_movable(new_phys, virt_addr);
+    info->type = PAGE_TYPE_NONE;
+    compact_stats.migrated++;
+    return SYS_OK;
+}
+
+/**
+ * @brief Takes every frame of a window, the kernel address space lock must
+ *        be held
+ * @verbatim
+ * The free frames are taken first, so that nothing moved out of the window
+ * can be given a frame inside it. Frames which were taken are tagged
+ * PAGE_TYPE_NONE, which tells them apart from the movable frames still to
+ * be moved if the window has to be given back.
+ *
+ * @param start First frame of the window
+ * @param num_pages Number of frames in the window
+ * @return STATUS SYS_OK if the window now belongs to the caller, SYS_ERR
+ *         if it changed since it was found
+ */
+static STATUS compact_take_window(uint64_t start, uint64_t num_pages) {
+    uint64_t end = start + num_pages;
+
+    for (uint64_t page = start; page < end;) {
+        if (pm_page_info(page * PAGE_SIZE)->type == PAGE_TYPE_MOVABLE) {
+            page++;
+            continue;
+        }
+
+        uint64_t run = 0;
+        while (page + run < end &&
+               pm_page_info((page + run) * PAGE_SIZE)->type !=
+               PAGE_TYPE_MOVABLE &&
+               pm_test_free((page + run) * PAGE_SIZE, 1)) {
+            run++;
+        }
+        if (!run || pm_allocate(page * PAGE_SIZE, run) != SYS_OK) {
+            compact_release(start, page);
+            return SYS_ERR;
+        }
+        for (uint64_t i = 0; i < run; i++) {
+            pm_page_info((page + i) * PAGE_SIZE)->type = PAGE_TYPE_NONE;
+        }
+        page += run;
+    }
+
+    for (uint64_t page = start; page < end; page++) {
+        if (pm_page_info(page * PAGE_SIZE)->type == PAGE_TYPE_MOVABLE &&
+            compact_migrate(page) != SYS_OK) {
+            compact_release(start, end);
+            return SYS_ERR;
+        }
+    }
+    return SYS_OK;
+}
+
+/**
+ * @brief Makes a run of free frames by moving movable frames out of the way
+ * @verbatim
+ * Called by pm_get once a request for more than one frame fails, even after
+ * compact_drain. If the caller holds the kernel address space lock (e.g.
+ * while handling a fault), nothing can be moved and the run fails.
+ *
+ * @param num_pages Number of frames
+ * @param min_page Lowest frame which may be returned
+ * @param flags Flags of pm_get, only PM_DMA32 is looked at
+ * @return uint64_t First frame of the run, PM_NO_PAGE if there is none
+ */
+uint64_t compact_alloc(uint64_t num_pages, uint64_t min_page, uint64_t flags) {
+    uint64_t page = PM_NO_PAGE;
+
+    LOCK_LOCK(&compact_stats.lock);
+    compact_stats.runs++;
+
+    if (LOCK_TRY(&kernel_addr_space.lock) != SYS_OK) {
+        compact_stats.busy++;
+    } else {
+        uint8_t zone = compact_zone(flags);
+        uint64_t start = compact_find_window(num_pages, min_page, zone);
+        if (start != PM_NO_PAGE &&
+            compact_take_window(start, num_pages) == SYS_OK) {
+            page = start;
+        }
+        UNLOCK_LOCK(&kernel_addr_space.lock);
+    }
+
+    if (page != PM_NO_PAGE) {
+        compact_stats.successes++;
+    } else {
+        compact_stats.failures++;
+    }
+    UNLOCK_LOCK(&compact_stats.lock);
+    return page;
+}
+
+/**
+ * @brief Gets the unusable free space index of memory for runs of an order
+ * @verbatim
+ * The share of free frames which are not part of a free run of at least
+ * 2^order frames, scaled to COMPACT_INDEX_SCALE. 0 means every free frame
+ * can serve such a run, COMPACT_INDEX_SCALE means none can. Frames cached
+ * outside of the physical allocator count as used.
+ *
+ * @param order Order of the runs
+ * @return uint64_t Fragmentation index, 0 if no frame is free
+ */
+uint64_t compact_fragmentation_index(uint8_t order) {
+    uint64_t min_run = (uint64_t) 1 << order;
+    uint64_t free_pages = 0;
+    uint64_t usable_pages = 0;
+
+    for (uint64_t p = 0; p < pm_num_pools(); p++) {
+        PM_POOL *pool = pm_get_pool(p);
+        uint64_t run = 0;
+        for (uint64_t page = pool->first_page; page <= PM_POOL_END(pool);
+             page++) {
+            if (page < PM_POOL_END(pool) && pm_pool_test_free(pool, page, 1)) {
+                run++;
+                continue;
+            }
+            free_pages += run;
+            if (run >= min_run) {
+                usable_pages += run;
+            }
+            run = 0;
+        }
+    }
+
+    if (!free_pages) {
+        return 0;
+    }
+    return (free_pages - usable_pages) * COMPACT_INDEX_SCALE / free_pages;
+}
+
+/**
+ * @brief Prints the fragmentation index and how compaction has done so far
+ */
+void compact_print_stats() {
+    klogi("Compaction: fragmentation index %d of %d (%d KB runs), runs: %d, "
+          "successes: %d, failures: %d, busy: %d, migrated: %d, "
+          "drained: %d\n", compact_fragmentation_index(COMPACT_ORDER),
+          COMPACT_INDEX_SCALE, (PAGE_SIZE << COMPACT_ORDER) / 1024,
+          compact_stats.runs, compact_stats.successes,
+          compact_stats.failures, compact_stats.busy, compact_stats.migrated,
+          compact_stats.drained);
+}
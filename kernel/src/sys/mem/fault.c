@@ -0,0 +1,113 @@
+/**
+ * @file fault.c
+ * @author Zack Bostock
+ * @brief Page fault handler
+ * @verbatim
+ * Faults on pages of an area reserved with vm_reserve are expected, the
+ * first access to each page is what backs it with a frame (see
+ * vm_handle_fault). Every other fault is fatal.
+ *
+ * The time taken to resolve a fault is measured with the TSC rather than
+ * the HPET, since a single HPET read costs about as much as the fault.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <sys/mem/fault.h>
+#include <sys/mmu.h>
+#include <sys/interrupts/isr.h>
+
+static FAULT_STATS fault_stats = {0};
+
+/**
+ * @brief Counts the time taken by a resolved fault
+ *
+ * @param cycles TSC cycles from entering the handler until the page was
+ *        mapped
+ */
+static void fault_account(uint64_t cycles) {
+    uint64_t bucket = 0;
+    if (cycles >> FAULT_HIST_SHIFT) {
+        bucket = 63 - __builtin_clzll(cycles) - FAULT_HIST_SHIFT;
+    }
+    if (bucket >= FAULT_HIST_BUCKETS) {
+        bucket = FAULT_HIST_BUCKETS - 1;
+    }
+
+    fault_stats.resolved++;
+    fault_stats.total_cycles += cycles;
+    if (cycles > fault_stats.max_cycles) {
+        fault_stats.max_cycles = cycles;
+    }
+    fault_stats.histogram[bucket]++;
+}
+
+/**
+ * @brief Handler of interrupt 14
+ *
+ * @param regs Information about the faulting code
+ */
+static void fault_handler(REGISTERS *regs) {
+    uint64_t start = read_tsc();
+    uint64_t address = read_cr(cr2);
+
+    fault_stats.faults++;
+    if (vm_handle_fault(address, regs->error_code) == SYS_OK) {
+        fault_account(read_tsc() - start);
+        return;
+    }
+
+    kloge("Page fault at %x: %s page on %s by %s code\n", address,
+          regs->error_code & PF_PRESENT ? "protection violation" :
+                                          "not present",
+          regs->error_code & PF_FETCH ? "fetch" :
+          regs->error_code & PF_WRITE ? "write" : "read",
+          regs->error_code & PF_USER ? "user" : "kernel");
+    isr_fatal(regs);
+}
+
+/**
+ * @brief Registers the page fault handler, after which areas reserved with
+ *        vm_reserve can be touched
+ */
+void fault_init() {
+    klogi("INIT FAULT: starting...\n");
+    isr_register_handler(ISR_PAGE_FAULT, fault_handler);
+    klogi("INIT FAULT: finished...\n");
+}
+
+/**
+ * @brief Gets a copy of the fault counters
+ *
+ * @param stats Filled in with the counters
+ */
+void fault_get_stats(FAULT_STATS *stats) {
+    *stats = fault_stats;
+}
+
+/**
+ * @brief Prints the number of faults and how long they took to resolve
+ */
+void fault_print_stats() {
+    klogi("Page faults: %d, resolved: %d, mean: %d cycles, max: %d cycles\n",
+          fault_stats.faults, fault_stats.resolved,
+          fault_stats.resolved ?
+          fault_stats.total_cycles / fault_stats.resolved : 0,
+          fault_stats.max_cycles);
+    for (uint64_t i = 0; i < FAULT_HIST_BUCKETS; i++) {
+        if (!fault_stats.histogram[i]) {
+            continue;
+        }
+        /* The last bucket also counts everything slower */
+        if (i == FAULT_HIST_BUCKETS - 1) {
+            klogi("\t>= %d cycles: %d\n",
+                  (uint64_t) 1 << (i + FAULT_HIST_SHIFT),
+                  fault_stats.histogram[i]);
+        } else {
+            klogi("\t< %d cycles: %d\n",
+                  (uint64_t) 1 << (i + FAULT_HIST_SHIFT + 1),
+                  fault_stats.histogram[i]);
+        }
+    }
+}
@@ -0,0 +1,245 @@
+/**
+ * @file frame_bitmap.c
+ * @author Zack Bostock
+ * @brief Physical frame bitmap search engine
+ * @verbatim
+ * Each physical 4 KB frame is represented by one bit, where a set bit means
+ * the frame is free. The bitmap is operated on 64 bits at a time:
+ *
+ * - Runs of free frames are found with trailing zero counts on the word and
+ *   its complement instead of probing one bit at a time.
+ * - The bitmap is split into regions of FRAME_BITMAP_REGION_PAGES frames,
+ *   each with a free frame count maintained with a population count on
+ *   every update. Regions with no free frames are skipped outright.
+ * - A next-fit cursor remembers where the last allocation ended so that
+ *   repeated searches do not rescan the (usually full) low memory.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <sys/mem/frame_bitmap.h>
+#include <common/memory.h>
+
+/**
+ * @brief Calculates the number of bytes needed to track a number of frames
+ *
+ * @param num_pages Number of physical frames to track
+ * @return uint64_t Bytes of storage needed by frame_bitmap_init
+ */
+uint64_t frame_bitmap_storage_size(uint64_t num_pages) {
+    return FRAME_BITMAP_WORDS(num_pages) * sizeof(uint64_t) +
+           FRAME_BITMAP_REGIONS(num_pages) * sizeof(uint32_t);
+}
+
+/**
+ * @brief Initializes a frame bitmap with every frame marked as used
+ *
+ * @param fb Frame bitmap to initialize
+ * @param storage Memory of at least frame_bitmap_storage_size bytes
+ * @param num_pages Number of physical frames to track
+ */
+void frame_bitmap_init(FRAME_BITMAP *fb, void *storage, uint64_t num_pages) {
+    fb->num_pages = num_pages;
+    fb->num_words = FRAME_BITMAP_WORDS(num_pages);
+    fb->num_regions = FRAME_BITMAP_REGIONS(num_pages);
+    fb->words = (uint64_t *) storage;
+    fb->region_free = (uint32_t *) (fb->words + fb->num_words);
+    fb->cursor = 0;
+
+    /* Everything starts out used, including the padding past num_pages */
+    memset(storage, 0, frame_bitmap_storage_size(num_pages));
+}
+
+/**
+ * @brief Marks a range of frames as free
+ *
+ * @param fb Frame bitmap to operate on
+ * @param page First frame index
+ * @param count Number of frames
+ * @return uint64_t Number of frames which were used before this call
+ */
+uint64_t frame_bitmap_set_free(FRAME_BITMAP *fb, uint64_t page,
+                               uint64_t count) {
+    uint64_t changed = 0;
+
+    if (page >= fb->num_pages) {
+        return 0;
+    }
+    if (count > fb->num_pages - page) {
+        count = fb->num_pages - page;
+    }
+
+    while (count) {
+        uint64_t bit = page % BITS_PER_WORD;
+        uint64_t n = BITS_PER_WORD - bit < count ? BITS_PER_WORD - bit : count;
+        uint64_t mask = BIT_RANGE_MASK(bit, n);
+        uint64_t *word = &fb->words[page / BITS_PER_WORD];
+        uint64_t flipped = bit_popcount64(mask & ~(*word));
+
+        *word |= mask;
+        fb->region_free[page / FRAME_BITMAP_REGION_PAGES] += flipped;
+        changed += flipped;
+        page += n;
+        count -= n;
+    }
+    return changed;
+}
+
+/**
+ * @brief Marks a range of frames as used
+ *
+ * @param fb Frame bitmap to operate on
+ * @param page First frame index
+ * @param count Number of frames
+ * @return uint64_t Number of frames which were free before this call
+ */
+uint64_t frame_bitmap_set_used(FRAME_BITMAP *fb, uint64_t page,
+                               uint64_t count) {
+    uint64_t changed = 0;
+
+    if (page >= fb->num_pages) {
+        return 0;
+    }
+    if (count > fb->num_pages - page) {
+        count = fb->num_pages - page;
+    }
+
+    while (count) {
+        uint64_t bit = page % BITS_PER_WORD;
+        uint64_t n = BITS_PER_WORD - bit < count ? BITS_PER_WORD - bit : count;
+        uint64_t mask = BIT_RANGE_MASK(bit, n);
+        uint64_t *word = &fb->words[page / BITS_PER_WORD];
+        uint64_t flipped = bit_popcount64(mask & *word);
+
+        *word &= ~mask;
+        fb->region_free[page / FRAME_BITMAP_REGION_PAGES] -= flipped;
+        changed += flipped;
+        page += n;
+        count -= n;
+    }
+    return changed;
+}
+
+/**
+ * @brief Checks if every frame in a range is free
+ *
+ * @param fb Frame bitmap to operate on
+ * @param page First frame index
+ * @param count Number of frames
+ * @return uint8_t TRUE if the whole range is free, FALSE otherwise
+ */
+uint8_t frame_bitmap_test_free(FRAME_BITMAP *fb, uint64_t page,
+                               uint64_t count) {
+    if (page >= fb->num_pages || count > fb->num_pages - page) {
+        return FALSE;
+    }
+
+    while (count) {
+        uint64_t bit = page % BITS_PER_WORD;
+        uint64_t n = BITS_PER_WORD - bit < count ? BITS_PER_WORD - bit : count;
+        uint64_t mask = BIT_RANGE_MASK(bit, n);
+
+        if ((fb->words[page / BITS_PER_WORD] & mask) != mask) {
+            return FALSE;
+        }
+        page += n;
+        count -= n;
+    }
+    return TRUE;
+}
+
+/**
+ * @brief Looks for a run of free frames without modifying the bitmap
+ * @verbatim
+ * New runs are only started below end, but a run which was started before
+ * end is allowed to continue past it so that runs straddling the next-fit
+ * cursor are not missed when the search wraps around.
+ *
+ * @param fb Frame bitmap to search
+ * @param count Number of consecutive free frames needed
+ * @param page Frame index to start searching from
+ * @param end Frame index where no new runs are started
+ * @return uint64_t First frame of the run, FRAME_BITMAP_NONE if not found
+ */
+static uint64_t frame_bitmap_scan(FRAME_BITMAP *fb, uint64_t count,
+                                  uint64_t page, uint64_t end) {
+    uint64_t run_start = 0;
+    uint64_t run_len = 0;
+
+    while (page < fb->num_pages && (run_len || page < end)) {
+        /* Nothing free in this region, a run cannot start or continue here */
+        if (!fb->region_free[page / FRAME_BITMAP_REGION_PAGES]) {
+            run_len = 0;
+            page = (page / FRAME_BITMAP_REGION_PAGES + 1) *
+                   FRAME_BITMAP_REGION_PAGES;
+            continue;
+        }
+
+        uint64_t bit = page % BITS_PER_WORD;
+        uint64_t avail = BITS_PER_WORD - bit;
+        uint64_t word = fb->words[page / BITS_PER_WORD] >> bit;
+
+        if (!run_len) {
+            if (!word) {
+                page += avail;
+                continue;
+            }
+            /* Jump straight to the first free frame in the word */
+            uint64_t skip = bit_ctz64(word);
+            page += skip;
+            word >>= skip;
+            avail -= skip;
+            run_start = page;
+        }
+
+        /* Length of the run of set bits starting at bit 0 of the word */
+        uint64_t ones = ~word ? bit_ctz64(~word) : BITS_PER_WORD;
+        if (ones > avail) {
+            ones = avail;
+        }
+
+        run_len += ones;
+        if (run_len >= count) {
+            return run_start;
+        }
+
+        page += ones;
+        if (ones < avail) {
+            /* Hit a used frame, the run is broken */
+            run_len = 0;
+        }
+    }
+    return FRAME_BITMAP_NONE;
+}
+
+/**
+ * @brief Finds a run of free frames using next-fit and marks it as used
+ *
+ * @param fb Frame bitmap to search
+ * @param count Number of consecutive frames needed
+ * @param min_page Lowest frame index which may be returned
+ * @return uint64_t First frame of the run, FRAME_BITMAP_NONE if not found
+ */
+uint64_t frame_bitmap_find(FRAME_BITMAP *fb, uint64_t count,
+                           uint64_t min_page) {
+    if (!count || count > fb->num_pages || min_page >= fb->num_pages) {
+        return FRAME_BITMAP_NONE;
+    }
+
+    uint64_t start = fb->cursor > min_page ? fb->cursor : min_page;
+    uint64_t page = frame_bitmap_scan(fb, count, start, fb->num_pages);
+
+    /* Wrap around and search what was skipped by the cursor */
+    if (page == FRAME_BITMAP_NONE && start > min_page) {
+        page = frame_bitmap_scan(fb, count, min_page, start);
+    }
+
+    if (page == FRAME_BITMAP_NONE) {
+        return FRAME_BITMAP_NONE;
+    }
+
+    frame_bitmap_set_used(fb, page, count);
+    fb->cursor = page + count < fb->num_pages ? page + count : 0;
+    return page;
+}
@@ -0,0 +1,177 @@
+/**
+ * @file page_color.c
+ * @author Zack Bostock
+ * @brief Page coloring of physical frames
+ * @verbatim
+ * The last level cache is physically indexed, so the frame a page lands in
+ * decides which cache sets it can use. Frames whose numbers are equal
+ * modulo the number of colors (the bytes of one cache way divided by the
+ * page size) compete for the same sets. A buffer built out of scattered
+ * frames can therefore evict itself long before it fills the cache.
+ *
+ * Consumers which map many frames (vmalloc, slab caches) ask for a frame of
+ * a specific color and step through the colors, e.g. by virtual page. Free
+ * frames are binned by color, and an empty bin is refilled by taking a run
+ * of num_colors consecutive frames, which holds exactly one frame of each
+ * color. Frames which do not fit in their bin go straight back.
+ *
+ * On Intel CPUs the last level cache is also split into slices by a hash of
+ * the address, so coloring spreads a buffer over the sets of each slice
+ * rather than over every set.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <sys/mem/page_color.h>
+#include <sys/mmu.h>
+
+static PAGE_COLORS page_colors = {.num_colors = 1};
+
+/**
+ * @brief Derives the number of colors from the last level cache
+ */
+void page_color_init() {
+    CPU_CACHE *llc = cpu_llc();
+    uint64_t colors = 1;
+
+    if (llc && llc->ways) {
+        colors = llc->size / llc->ways / PAGE_SIZE;
+    }
+    if (colors > PAGE_COLOR_MAX) {
+        colors = PAGE_COLOR_MAX;
+    }
+    if (colors > 1) {
+        colors = (uint64_t) 1 << (63 - __builtin_clzll(colors));
+    } else {
+        colors = 1;
+    }
+
+    page_colors.num_colors = colors;
+    klogi("Page coloring: %d colors (L%d %d KB, %d-way)\n", colors,
+          llc ? llc->level : 0, llc ? llc->size / 1024 : 0,
+          llc ? llc->ways : 0);
+}
+
+/**
+ * @brief Gets the number of page colors
+ *
+ * @return uint64_t Number of colors, 1 if coloring is disabled
+ */
+uint64_t page_color_count() {
+    return page_colors.num_colors;
+}
+
+/**
+ * @brief Gets the color of a frame
+ *
+ * @param phys Physical address of the frame
+ * @return uint64_t Color of the frame
+ */
+uint64_t page_color_of(uint64_t phys) {
+    return (phys / PAGE_SIZE) & (page_colors.num_colors - 1);
+}
+
+/**
+ * @brief Fills the bins from one run of num_colors frames, page_colors.lock
+ *        must be held
+ */
+static void page_color_refill() {
+    uint64_t run = pm_try_get(page_colors.num_colors);
+    if (!run) {
+        return;
+    }
+
+    for (uint64_t i = 0; i < page_colors.num_colors; i++) {
+        uint64_t phys = run + i * PAGE_SIZE;
+        PAGE_COLOR_BIN *bin = &page_colors.bins[page_color_of(phys)];
+        if (bin->count < PAGE_COLOR_DEPTH) {
+            bin->frames[bin->count++] = phys;
+            page_colors.cached++;
+        } else {
+            pm_free(phys, 1);
+            page_colors.returned++;
+        }
+    }
+    page_colors.refills++;
+}
+
+/**
+ * @brief Gets a frame of a color
+ * @verbatim
+ * Bins are not refilled while memory is under pressure, so callers always
+ * need a fallback to an ordinary allocation.
+ *
+ * @param color Wanted color, taken modulo the number of colors
+ * @param flags PM_ZERO if the frame must be zeroed
+ * @return uint64_t Physical address of the frame, 0 if coloring is disabled
+ *         or no frame of the color is available
+ */
+uint64_t page_color_get(uint64_t color, uint64_t flags) {
+    if (page_colors.num_colors == 1) {
+        return 0;
+    }
+
+    uint64_t phys = 0;
+    LOCK_LOCK(&page_colors.lock);
+    PAGE_COLOR_BIN *bin =
+        &page_colors.bins[color & (page_colors.num_colors - 1)];
+    if (!bin->count && !pm_under_pressure()) {
+        page_color_refill();
+    }
+    if (bin->count) {
+        phys = bin->frames[--bin->count];
+        page_colors.cached--;
+        page_colors.hits++;
+    } else {
+        page_colors.misses++;
+    }
+    UNLOCK_LOCK(&page_colors.lock);
+
+    if (phys && (flags & PM_ZERO)) {
+        zero_pool_clear(phys, 1);
+    }
+    return phys;
+}
+
+/**
+ * @brief Gives every binned frame back to the physical allocator
+ *
+ * @return uint64_t Number of frames given back
+ */
+uint64_t page_color_drain() {
+    uint64_t count = 0;
+
+    LOCK_LOCK(&page_colors.lock);
+    for (uint64_t i = 0; i < page_colors.num_colors; i++) {
+        PAGE_COLOR_BIN *bin = &page_colors.bins[i];
+        pm_put_frames(bin->frames, bin->count);
+        count += bin->count;
+        bin->count = 0;
+    }
+    page_colors.cached = 0;
+    UNLOCK_LOCK(&page_colors.lock);
+    return count;
+}
+
+/**
+ * @brief Gets the number of free frames held in the bins
+ *
+ * @return uint64_t Number of frames
+ */
+uint64_t page_color_cached() {
+    return page_colors.cached;
+}
+
+/**
+ * @brief Prints how colored requests have been served so far
+ */
+void page_color_print_stats() {
+    if (page_colors.num_colors == 1) {
+        return;
+    }
+    klogi("Page colors: %d colors, %d frames binned, hits: %d, misses: %d, "
+          "refills: %d, returned: %d\n", page_colors.num_colors,
+          page_colors.cached, page_colors.hits, page_colors.misses,
+          page_colors.refills, page_colors.returned);
+}
@@ -0,0 +1,119 @@
+/**
+ * @file page_nt.c
+ * @author Zack Bostock
+ * @brief Clearing and copying whole pages with non-temporal stores
+ * @verbatim
+ * Pages which are zeroed or copied on behalf of someone else (frames for
+ * PM_ZERO requests, page tables, pages moved by compaction) are rarely read
+ * again soon, so writing them through the cache only evicts lines which are
+ * in use. movnti writes around the cache from a general purpose register,
+ * so unlike the SSE and AVX streaming stores it needs no kernel_fpu_begin.
+ *
+ * Non-temporal stores are weakly ordered, so an sfence is needed before
+ * anyone else may see the page. page_clear_nt and page_copy_nt fence after
+ * every page, the _run variants stream a whole run of virtually contiguous
+ * pages and fence once at the end. The copy prefetches its source with
+ * prefetchnta, which also keeps the source from displacing anything.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <sys/mem/page_nt.h>
+#include <sys/mmu.h>
+
+/**
+ * @brief Makes the non-temporal stores issued so far visible to everyone
+ */
+static inline void page_nt_fence() {
+    __asm__ volatile("sfence" : : : "memory");
+}
+
+/**
+ * @brief Clears pages with non-temporal stores, without fencing
+ *
+ * @param dst First page, page aligned
+ * @param num_pages Number of pages
+ */
+static void page_nt_clear(uint64_t *dst, uint64_t num_pages) {
+    uint64_t *end = dst + num_pages * PAGE_SIZE / sizeof(uint64_t);
+
+    for (; dst < end; dst += 4) {
+        __asm__ volatile("movnti %1, 0(%0)\n\t"
+                         "movnti %1, 8(%0)\n\t"
+                         "movnti %1, 16(%0)\n\t"
+                         "movnti %1, 24(%0)"
+                         : : "r"(dst), "r"((uint64_t) 0) : "memory");
+    }
+}
+
+/**
+ * @brief Copies pages with non-temporal stores, without fencing
+ *
+ * @param dst First destination page, page aligned
+ * @param src First source page, page aligned
+ * @param num_pages Number of pages
+ */
+static void page_nt_copy(uint64_t *dst, const uint64_t *src,
+                         uint64_t num_pages) {
+    uint64_t *end = dst + num_pages * PAGE_SIZE / sizeof(uint64_t);
+
+    /* One cache line (8 words) per iteration, prefetches never fault */
+    for (; dst < end; dst += 8, src += 8) {
+        __asm__ volatile("prefetchnta %c1(%0)"
+                         : : "r"(src), "i"(PAGE_NT_PREFETCH));
+        for (uint64_t i = 0; i < 8; i += 4) {
+            __asm__ volatile("movnti %1, 0(%0)\n\t"
+                             "movnti %2, 8(%0)\n\t"
+                             "movnti %3, 16(%0)\n\t"
+                             "movnti %4, 24(%0)"
+                             : : "r"(dst + i), "r"(src[i]), "r"(src[i + 1]),
+                                 "r"(src[i + 2]), "r"(src[i + 3])
+                             : "memory");
+        }
+    }
+}
+
+/**
+ * @brief Clears a page without pulling it into the cache
+ *
+ * @param page Page to clear, page aligned
+ */
+void page_clear_nt(void *page) {
+    page_nt_clear((uint64_t *) page, 1);
+    page_nt_fence();
+}
+
+/**
+ * @brief Copies a page without pulling either page into the cache
+ *
+ * @param dst Destination page, page aligned
+ * @param src Source page, page aligned, must not overlap dst
+ */
+void page_copy_nt(void *dst, const void *src) {
+    page_nt_copy((uint64_t *) dst, (const uint64_t *) src, 1);
+    page_nt_fence();
+}
+
+/**
+ * @brief Clears a run of virtually contiguous pages, fencing once
+ *
+ * @param start First page, page aligned
+ * @param num_pages Number of pages
+ */
+void page_clear_nt_run(void *start, uint64_t num_pages) {
+    page_nt_clear((uint64_t *) start, num_pages);
+    page_nt_fence();
+}
+
+/**
+ * @brief Copies a run of virtually contiguous pages, fencing once
+ *
+ * @param dst First destination page, page aligned
+ * @param src First source page, page aligned, the runs must not overlap
+ * @param num_pages Number of pages
+ */
+void page_copy_nt_run(void *dst, const void *src, uint64_t num_pages) {
+    page_nt_copy((uint64_t *) dst, (const uint64_t *) src, num_pages);
+    page_nt_fence();
+}
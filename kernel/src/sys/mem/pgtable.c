@@ -0,0 +1,117 @@
+/**
+ * @file pgtable.c
+ * @author Zack Bostock
+ * @brief Page table page allocator
+ * @verbatim
+ * Every x86_64 paging structure (PML4, PDPT, PD, PT) is exactly one 4 KB
+ * frame which has to start out zeroed. Frames are handed out from a small
+ * pool which is kept zeroed ahead of time, refilled PGTABLE_POOL_BATCH
+ * frames at a time with PM_ZERO frames (see zero_pool.c). Freed tables
+ * are zeroed (without going through the cache) and put back in the pool
+ * while there is room.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <sys/mem/pgtable.h>
+#include <sys/mmu.h>
+
+static PGTABLE_POOL pgtable_pool = {0};
+
+/**
+ * @brief Zeroes frames and adds them to the pool, pool lock must be held
+ *
+ * @param count Number of frames to add
+ */
+static void pgtable_refill(uint64_t count) {
+    if (count > PGTABLE_POOL_SIZE - pgtable_pool.count) {
+        count = PGTABLE_POOL_SIZE - pgtable_pool.count;
+    }
+
+    /* Taken from the zero pool while it has frames, cleared here otherwise */
+    for (uint64_t i = 0; i < count; i++) {
+        pgtable_pool.frames[pgtable_pool.count++] =
+            pm_get(1, 0x0, PM_ZERO, __func__, __LINE__);
+    }
+}
+
+/**
+ * @brief Fills the pool of zeroed page table frames
+ */
+void pgtable_init() {
+    LOCK_LOCK(&pgtable_pool.lock);
+    pgtable_refill(PGTABLE_POOL_SIZE);
+    UNLOCK_LOCK(&pgtable_pool.lock);
+}
+
+/**
+ * @brief Allocates a zeroed frame for a paging structure
+ *
+ * @return uint64_t Physical address of the frame
+ */
+uint64_t pgtable_alloc() {
+    LOCK_LOCK(&pgtable_pool.lock);
+    if (pgtable_pool.count) {
+        pgtable_pool.hits++;
+    } else {
+        pgtable_pool.misses++;
+        pgtable_refill(PGTABLE_POOL_BATCH);
+    }
+
+    uint64_t phys = 0;
+    if (pgtable_pool.count) {
+        phys = pgtable_pool.frames[--pgtable_pool.count];
+        pgtable_pool.in_use++;
+    }
+    UNLOCK_LOCK(&pgtable_pool.lock);
+
+    if (!phys) {
+        kloge("VM: Out of memory for page tables\n");
+        halt();
+    }
+
+    PAGE_INFO *info = pm_page_info(phys);
+    info->type = PAGE_TYPE_PGTABLE;
+    info->live_entries = 0;
+    return phys;
+}
+
+/**
+ * @brief Frees a frame allocated with pgtable_alloc
+ *
+ * @param phys Physical address of the frame
+ */
+void pgtable_free(uint64_t phys) {
+    /* A table freed twice is cached or back in the pool by now */
+    PAGE_INFO *info = pm_page_info(phys);
+    if (info->type != PAGE_TYPE_PGTABLE) {
+        kloge("VM: Page table %x was freed twice\n", phys);
+        halt();
+    }
+    info->type = PAGE_TYPE_NONE;
+
+    LOCK_LOCK(&pgtable_pool.lock);
+    pgtable_pool.in_use--;
+    if (pgtable_pool.count < PGTABLE_POOL_SIZE) {
+        page_clear_nt((void *) PHYS_TO_VIRT(phys));
+        pgtable_pool.frames[pgtable_pool.count++] = phys;
+        phys = 0;
+    }
+    UNLOCK_LOCK(&pgtable_pool.lock);
+
+    if (phys && pm_free(phys, 1) == SYS_ERR) {
+        kloge("VM: Failed to free page table %x\n", phys);
+        halt();
+    }
+}
+
+/**
+ * @brief Prints the usage of the page table pool
+ */
+void pgtable_print_stats() {
+    klogi("Page tables: %d in use (%d KB), %d zeroed in pool, "
+          "hits: %d, misses: %d\n", pgtable_pool.in_use,
+          pgtable_pool.in_use * PAGE_SIZE / 1024, pgtable_pool.count,
+          pgtable_pool.hits, pgtable_pool.misses);
+}
@@ -0,0 +1,150 @@
+/**
+ * @file pm_magazine.c
+ * @author Zack Bostock
+ * @brief Per-CPU caches of free physical frames
+ * @verbatim
+ * Every CPU keeps a small stack (magazine) of free 4 KB frames in its
+ * CPU_LOCAL data. Single frame allocations and frees are served from it with
+ * interrupts disabled but without taking the global physical memory lock.
+ *
+ * When the magazine runs empty, PM_MAGAZINE_BATCH frames are taken from the
+ * global allocator under one lock acquisition. When it runs full, the
+ * PM_MAGAZINE_BATCH oldest frames are given back the same way, so the most
+ * recently freed (and most likely cache hot) frames are reused first.
+ *
+ * Frames in a magazine are tagged PAGE_TYPE_CACHED in their PAGE_INFO. The
+ * backend may only be looked at under pm_lock, so this tag is what catches
+ * a frame being freed twice before it ever leaves the magazine. Whoever
+ * frees a frame owns it, so setting the tag needs no lock.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <sys/mem/pm_magazine.h>
+#include <sys/mmu.h>
+
+/**
+ * @brief Tags frames as held by a magazine, or clears the tag
+ *
+ * @param frames Physical addresses of the frames
+ * @param count Number of frames
+ * @param type PAGE_TYPE_CACHED or PAGE_TYPE_NONE
+ */
+static void pm_magazine_tag(uint64_t *frames, uint64_t count, uint8_t type) {
+    for (uint64_t i = 0; i < count; i++) {
+        pm_page_info(frames[i])->type = type;
+    }
+}
+
+/**
+ * @brief Gets a free frame from the calling CPU's magazine
+ *
+ * @return uint64_t Physical address of the frame, 0 if none are available
+ */
+uint64_t pm_magazine_get() {
+    uint64_t flags = interrupts_save();
+    PM_MAGAZINE *mag = &this_cpu()->pm_magazine;
+    uint64_t frame = 0;
+
+    if (mag->count) {
+        mag->hits++;
+    } else {
+        mag->misses++;
+        mag->count = pm_get_frames(mag->frames, PM_MAGAZINE_BATCH);
+        if (mag->count) {
+            pm_magazine_tag(mag->frames, mag->count, PAGE_TYPE_CACHED);
+            mag->refills++;
+        }
+    }
+
+    if (mag->count) {
+        frame = mag->frames[--mag->count];
+        pm_page_info(frame)->type = PAGE_TYPE_NONE;
+    }
+    interrupts_restore(flags);
+    return frame;
+}
+
+/**
+ * @brief Gives a frame to the calling CPU's magazine
+ *
+ * @param address Physical address of the frame
+ * @return STATUS SYS_OK if okay, SYS_ERR if the frame is already in a
+ *         magazine
+ */
+STATUS pm_magazine_put(uint64_t address) {
+    uint64_t flags = interrupts_save();
+    PM_MAGAZINE *mag = &this_cpu()->pm_magazine;
+    PAGE_INFO *info = pm_page_info(address);
+
+    if (info->type == PAGE_TYPE_CACHED) {
+        interrupts_restore(flags);
+        return SYS_ERR;
+    }
+    info->type = PAGE_TYPE_CACHED;
+
+    if (mag->count == PM_MAGAZINE_SIZE) {
+        pm_magazine_tag(mag->frames, PM_MAGAZINE_BATCH, PAGE_TYPE_NONE);
+        pm_put_frames(mag->frames, PM_MAGAZINE_BATCH);
+        mag->count -= PM_MAGAZINE_BATCH;
+        memmove(mag->frames, &mag->frames[PM_MAGAZINE_BATCH],
+                mag->count * sizeof(uint64_t));
+        mag->drains++;
+    }
+
+    mag->frames[mag->count++] = address;
+    interrupts_restore(flags);
+    return SYS_OK;
+}
+
+/**
+ * @brief Gives every frame of the calling CPU's magazine back to the global
+ *        allocator, so that they can coalesce with their neighbours
+ *
+ * @return uint64_t Number of frames given back
+ */
+uint64_t pm_magazine_drain() {
+    uint64_t flags = interrupts_save();
+    PM_MAGAZINE *mag = &this_cpu()->pm_magazine;
+    uint64_t count = mag->count;
+
+    if (count) {
+        pm_magazine_tag(mag->frames, count, PAGE_TYPE_NONE);
+        pm_put_frames(mag->frames, count);
+        mag->count = 0;
+        mag->drains++;
+    }
+    interrupts_restore(flags);
+    return count;
+}
+
+/**
+ * @brief Counts the frames cached across every online CPU
+ *
+ * @return uint64_t Number of cached frames
+ */
+uint64_t pm_magazine_cached() {
+    uint64_t cached = 0;
+    for (uint64_t i = 0; i < MAX_CPUS; i++) {
+        if (cpu_locals[i].online) {
+            cached += cpu_locals[i].pm_magazine.count;
+        }
+    }
+    return cached;
+}
+
+/**
+ * @brief Prints the magazine statistics of every online CPU
+ */
+void pm_magazine_print_stats() {
+    for (uint64_t i = 0; i < MAX_CPUS; i++) {
+        if (!cpu_locals[i].online) {
+            continue;
+        }
+        PM_MAGAZINE *mag = &cpu_locals[i].pm_magazine;
+        klogi("CPU %d magazine: %d cached, hits: %d, misses: %d, "
+              "refills: %d, drains: %d\n", i, mag->count, mag->hits,
+              mag->misses, mag->refills, mag->drains);
+    }
+}
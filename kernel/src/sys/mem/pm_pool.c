@@ -0,0 +1,165 @@
+/**
+ * @file pm_pool.c
+ * @author Zack Bostock
+ * @brief Free pools of the physical allocator
+ * @verbatim
+ * Physical memory is split into pools of consecutive frames which belong to
+ * the same NUMA node and zone, each with its own instance of the backend
+ * selected by PM_BACKEND. Frames are passed in and out by their physical
+ * frame number, the conversion to the backend's pool relative index is done
+ * here.
+ *
+ * Pools are not locked themselves, pm_lock covers all of them.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <sys/mem/pm_pool.h>
+#include <sys/mmu.h>
+
+/**
+ * @brief Calculates the number of bytes needed by a pool's backend
+ *
+ * @param num_pages Number of physical frames in the pool
+ * @return uint64_t Bytes of storage needed by pm_pool_init, 8 byte aligned
+ */
+uint64_t pm_pool_storage_size(uint64_t num_pages) {
+#if PM_BACKEND == PM_BACKEND_BUDDY
+    uint64_t size = buddy_storage_size(num_pages);
+#else
+    uint64_t size = frame_bitmap_storage_size(num_pages);
+#endif
+    return (size + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+}
+
+/**
+ * @brief Initializes a pool with every frame marked as used
+ *
+ * @param pool Pool to initialize
+ * @param storage Memory of at least pm_pool_storage_size bytes
+ * @param first_page Physical frame number of the first frame
+ * @param num_pages Number of physical frames in the pool
+ * @param node NUMA node the frames belong to
+ * @param zone Zone the frames belong to
+ */
+void pm_pool_init(PM_POOL *pool, void *storage, uint64_t first_page,
+                  uint64_t num_pages, uint32_t node, uint8_t zone) {
+    pool->first_page = first_page;
+    pool->num_pages = num_pages;
+    pool->free_pages = 0;
+    pool->node = node;
+    pool->zone = zone;
+    pool->allocs = 0;
+#if PM_BACKEND == PM_BACKEND_BUDDY
+    buddy_init(&pool->buddy, storage, first_page, num_pages);
+#else
+    frame_bitmap_init(&pool->frames, storage, num_pages);
+#endif
+}
+
+/**
+ * @brief Allocates a run of frames from a pool
+ *
+ * @param pool Pool to allocate from
+ * @param count Number of frames
+ * @param min_page Lowest physical frame number which may be returned
+ * @return uint64_t First frame of the run, PM_NO_PAGE if not found
+ */
+uint64_t pm_pool_alloc(PM_POOL *pool, uint64_t count, uint64_t min_page) {
+    if (min_page >= PM_POOL_END(pool) || count > pool->free_pages) {
+        return PM_NO_PAGE;
+    }
+    min_page = min_page > pool->first_page ? min_page - pool->first_page : 0;
+
+#if PM_BACKEND == PM_BACKEND_BUDDY
+    uint64_t page = buddy_alloc(&pool->buddy, count, min_page);
+    if (page == BUDDY_NONE) {
+        return PM_NO_PAGE;
+    }
+#else
+    uint64_t page = frame_bitmap_find(&pool->frames, count, min_page);
+    if (page == FRAME_BITMAP_NONE) {
+        return PM_NO_PAGE;
+    }
+#endif
+    pool->free_pages -= count;
+    pool->allocs++;
+    return pool->first_page + page;
+}
+
+/**
+ * @brief Frees a range of frames which lies inside a pool
+ *
+ * @param pool Pool the frames belong to
+ * @param page First physical frame number
+ * @param count Number of frames
+ * @return uint64_t Number of frames which were not already free
+ */
+uint64_t pm_pool_free(PM_POOL *pool, uint64_t page, uint64_t count) {
+    page -= pool->first_page;
+#if PM_BACKEND == PM_BACKEND_BUDDY
+    uint64_t freed = buddy_free(&pool->buddy, page, count);
+#else
+    uint64_t freed = frame_bitmap_set_free(&pool->frames, page, count);
+#endif
+    pool->free_pages += freed;
+    return freed;
+}
+
+/**
+ * @brief Checks if every frame in a range inside a pool is free
+ *
+ * @param pool Pool the frames belong to
+ * @param page First physical frame number
+ * @param count Number of frames
+ * @return uint8_t TRUE if every frame is free, FALSE otherwise
+ */
+uint8_t pm_pool_test_free(PM_POOL *pool, uint64_t page, uint64_t count) {
+    page -= pool->first_page;
+#if PM_BACKEND == PM_BACKEND_BUDDY
+    return buddy_test_free(&pool->buddy, page, count);
+#else
+    return frame_bitmap_test_free(&pool->frames, page, count);
+#endif
+}
+
+/**
+ * @brief Allocates a specific range of frames inside a pool
+ *
+ * @param pool Pool the frames belong to
+ * @param page First physical frame number
+ * @param count Number of frames
+ * @return STATUS SYS_OK if reserved, SYS_ERR if part of it was not free
+ */
+STATUS pm_pool_reserve(PM_POOL *pool, uint64_t page, uint64_t count) {
+    uint64_t index = page - pool->first_page;
+#if PM_BACKEND == PM_BACKEND_BUDDY
+    if (buddy_reserve(&pool->buddy, index, count) == SYS_ERR) {
+        return SYS_ERR;
+    }
+#else
+    if (!frame_bitmap_test_free(&pool->frames, index, count)) {
+        return SYS_ERR;
+    }
+    frame_bitmap_set_used(&pool->frames, index, count);
+#endif
+    pool->free_pages -= count;
+    return SYS_OK;
+}
+
+/**
+ * @brief Prints the range, node and usage of a pool
+ *
+ * @param pool Pool to print
+ * @param index Index of the pool, for the log
+ */
+void pm_pool_print_stats(PM_POOL *pool, uint64_t index) {
+    klogi("Pool %d: %x - %x, node %d, zone %s, %d MB free, allocs: %d\n",
+          index, pool->first_page * PAGE_SIZE, PM_POOL_END(pool) * PAGE_SIZE,
+          pool->node, pool->zone == ZONE_DMA32 ? "DMA32" : "normal",
+          pool->free_pages * PAGE_SIZE / (1024 * 1024), pool->allocs);
+#if PM_BACKEND == PM_BACKEND_BUDDY
+    buddy_print_stats(&pool->buddy);
+#endif
+}
@@ -0,0 +1,277 @@
+/**
+ * @file slab.c
+ * @author Zack Bostock
+ * @brief Slab allocator for small kernel objects
+ * @verbatim
+ * Requests up to SLAB_MAX_SIZE bytes are rounded up to a power of two size
+ * class and carved out of single 4 KB pages (slabs). Every slab starts with
+ * a SLAB header, followed by as many objects of its class as fit in the rest
+ * of the page. Free objects are linked through their own first 8 bytes, so
+ * there is no per-object overhead beyond the rounding to the class size.
+ * The next 8 bytes of a free object hold SLAB_FREE_POISON, so that freeing
+ * an object twice is caught instead of putting it on the free list twice.
+ *
+ * Slab pages are tagged PAGE_TYPE_SLAB in their PAGE_INFO, which is what
+ * kfree uses to tell them apart from the page allocations made for larger
+ * requests.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <sys/mem/slab.h>
+#include <sys/mmu.h>
+#include <common/bitops.h>
+
+_Static_assert(sizeof(SLAB) <= SLAB_HEADER_SIZE, "SLAB header too large");
+_Static_assert(SLAB_CAPACITY(SLAB_MAX_SIZE) > 1, "SLAB_MAX_SIZE too large");
+_Static_assert(sizeof(SLAB_OBJECT) <= SLAB_MIN_SIZE, "SLAB_OBJECT too large");
+
+#define SLAB_CACHE_INIT(shift) {                                            \
+    .obj_size = (1 << (shift)),                                             \
+    .capacity = SLAB_CAPACITY(1 << (shift)),                                \
+}
+
+static SLAB_CACHE slab_caches[SLAB_NUM_CLASSES] = {
+    SLAB_CACHE_INIT(4), SLAB_CACHE_INIT(5), SLAB_CACHE_INIT(6),
+    SLAB_CACHE_INIT(7), SLAB_CACHE_INIT(8), SLAB_CACHE_INIT(9),
+    SLAB_CACHE_INIT(10),
+};
+
+/**
+ * @brief Gets the size class which can hold a request
+ *
+ * @param size Number of bytes requested, at most SLAB_MAX_SIZE
+ * @return SLAB_CACHE * Cache of the smallest class which fits
+ */
+static inline SLAB_CACHE *slab_cache_for(uint64_t size) {
+    if (size <= SLAB_MIN_SIZE) {
+        return &slab_caches[0];
+    }
+    uint64_t shift = 64 - __builtin_clzll(size - 1);
+    return &slab_caches[shift - SLAB_MIN_SHIFT];
+}
+
+/**
+ * @brief Gets the slab header of the page an object lives in
+ *
+ * @param address Object
+ * @return SLAB * Header at the start of the page
+ */
+static inline SLAB *slab_of(void *address) {
+    return (SLAB *) ((uint64_t) address & ~((uint64_t) PAGE_SIZE - 1));
+}
+
+/**
+ * @brief Unlinks a slab from the partial list of its cache
+ *
+ * @param cache Cache of the slab
+ * @param slab Slab to unlink
+ */
+static void slab_list_remove(SLAB_CACHE *cache, SLAB *slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        cache->partial = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    slab->next = NULL;
+    slab->prev = NULL;
+}
+
+/**
+ * @brief Pushes a slab onto the partial list of its cache
+ *
+ * @param cache Cache of the slab
+ * @param slab Slab to push
+ */
+static void slab_list_add(SLAB_CACHE *cache, SLAB *slab) {
+    slab->prev = NULL;
+    slab->next = cache->partial;
+    if (slab->next) {
+        slab->next->prev = slab;
+    }
+    cache->partial = slab;
+}
+
+/**
+ * @brief Checks if an object is on the free list of its slab, cache lock
+ *        must be held
+ * @verbatim
+ * Only objects carrying SLAB_FREE_POISON can be free, so the list is only
+ * walked when an object in use happens to hold the poison value.
+ *
+ * @param slab Slab of the object
+ * @param obj Object
+ * @return uint8_t TRUE if the object is free
+ */
+static uint8_t slab_is_free(SLAB *slab, SLAB_OBJECT *obj) {
+    if (obj->poison != SLAB_FREE_POISON) {
+        return FALSE;
+    }
+    for (SLAB_OBJECT *free = slab->free_list; free; free = free->next) {
+        if (free == obj) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/**
+ * @brief Carves a new slab out of a single page, cache lock must be held
+ *
+ * @param cache Cache which needs the slab
+ * @return SLAB * New slab with every object free
+ */
+static SLAB *slab_grow(SLAB_CACHE *cache) {
+    uint64_t phys = page_color_get(cache->next_color++, 0);
+    if (!phys) {
+        phys = pm_get(1, 0x0, 0, __func__, __LINE__);
+    }
+    SLAB *slab = (SLAB *) PHYS_TO_VIRT(phys);
+    uint8_t *objects = (uint8_t *) slab + SLAB_HEADER_SIZE;
+
+    slab->magic = SLAB_MAGIC;
+    slab->in_use = 0;
+    slab->capacity = cache->capacity;
+    slab->cache = cache;
+    slab->free_list = NULL;
+
+    PAGE_INFO *info = pm_page_info(phys);
+    info->type = PAGE_TYPE_SLAB;
+    info->order = bit_ctz64(cache->obj_size);
+
+    /* Link back to front so objects are handed out in address order */
+    for (uint64_t i = cache->capacity; i > 0; i--) {
+        SLAB_OBJECT *obj =
+            (SLAB_OBJECT *) (objects + (i - 1) * cache->obj_size);
+        obj->next = slab->free_list;
+        obj->poison = SLAB_FREE_POISON;
+        slab->free_list = obj;
+    }
+
+    slab_list_add(cache, slab);
+    cache->num_slabs++;
+    cache->empty_slabs++;
+    return slab;
+}
+
+/**
+ * @brief Allocates a small object
+ *
+ * @param size Number of bytes, at most SLAB_MAX_SIZE
+ * @return void * Object, NULL if size is too large for a slab
+ */
+void *slab_alloc(uint64_t size) {
+    if (size > SLAB_MAX_SIZE) {
+        return NULL;
+    }
+
+    SLAB_CACHE *cache = slab_cache_for(size);
+    LOCK_LOCK(&cache->lock);
+
+    SLAB *slab = cache->partial;
+    if (!slab) {
+        slab = slab_grow(cache);
+    }
+
+    SLAB_OBJECT *obj = slab->free_list;
+    slab->free_list = obj->next;
+    obj->poison = 0;
+    if (!slab->in_use++) {
+        cache->empty_slabs--;
+    }
+    if (slab->in_use == slab->capacity) {
+        slab_list_remove(cache, slab);
+    }
+    cache->in_use++;
+    cache->allocs++;
+
+    UNLOCK_LOCK(&cache->lock);
+    return obj;
+}
+
+/**
+ * @brief Frees an object allocated with slab_alloc
+ * @verbatim
+ * Once a class holds more than SLAB_MAX_EMPTY empty slabs, the page of a
+ * slab which becomes empty is given back to the physical allocator.
+ *
+ * @param address Object to free
+ * @return STATUS SYS_OK if okay, SYS_ERR if address is not a slab object
+ *         or is already free
+ */
+STATUS slab_free(void *address) {
+    SLAB *slab = slab_of(address);
+    if (slab->magic != SLAB_MAGIC) {
+        return SYS_ERR;
+    }
+
+    SLAB_CACHE *cache = slab->cache;
+    uint64_t offset = (uint64_t) address - (uint64_t) slab;
+    if (offset < SLAB_HEADER_SIZE ||
+        (offset - SLAB_HEADER_SIZE) % cache->obj_size) {
+        return SYS_ERR;
+    }
+
+    LOCK_LOCK(&cache->lock);
+
+    SLAB_OBJECT *obj = (SLAB_OBJECT *) address;
+    if (slab_is_free(slab, obj)) {
+        UNLOCK_LOCK(&cache->lock);
+        return SYS_ERR;
+    }
+    obj->next = slab->free_list;
+    obj->poison = SLAB_FREE_POISON;
+    slab->free_list = obj;
+
+    /* Full slabs are off the list until something is freed */
+    if (slab->in_use-- == slab->capacity) {
+        slab_list_add(cache, slab);
+    }
+    cache->in_use--;
+    cache->frees++;
+
+    if (!slab->in_use) {
+        if (cache->empty_slabs >= SLAB_MAX_EMPTY) {
+            slab_list_remove(cache, slab);
+            slab->magic = 0;
+            pm_page_info(VIRT_TO_PHYS(slab))->type = PAGE_TYPE_NONE;
+            cache->num_slabs--;
+            pm_free(VIRT_TO_PHYS(slab), 1);
+        } else {
+            cache->empty_slabs++;
+        }
+    }
+
+    UNLOCK_LOCK(&cache->lock);
+    return SYS_OK;
+}
+
+/**
+ * @brief Gets the usable size of a slab object
+ *
+ * @param address Object
+ * @return uint64_t Size of the object's class, 0 if not a slab object
+ */
+uint64_t slab_size(void *address) {
+    SLAB *slab = slab_of(address);
+    if (slab->magic != SLAB_MAGIC) {
+        return 0;
+    }
+    return slab->cache->obj_size;
+}
+
+/**
+ * @brief Prints the usage of every size class
+ */
+void slab_print_stats() {
+    for (uint64_t i = 0; i < SLAB_NUM_CLASSES; i++) {
+        SLAB_CACHE *cache = &slab_caches[i];
+        klogi("Slab %d B: %d slabs (%d empty), %d objects in use, "
+              "allocs: %d, frees: %d\n", cache->obj_size, cache->num_slabs,
+              cache->empty_slabs, cache->in_use, cache->allocs, cache->frees);
+    }
+}
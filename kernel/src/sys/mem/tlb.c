@@ -0,0 +1,345 @@
+/**
+ * @file tlb.c
+ * @author Zack Bostock
+ * @brief Batched TLB invalidation and process context identifiers
+ * @verbatim
+ * Instead of reading CR3 and issuing an invlpg every time an entry changes,
+ * vm_map and vm_unmap collect the changed pages in a TLB_GATHER and flush
+ * once when they are done. Up to TLB_FLUSH_THRESHOLD pages are invalidated
+ * one at a time, anything larger is handled by one full flush.
+ *
+ * Kernel half leaves are mapped global when the CPU supports PGE, so a CR3
+ * reload only throws away the lower half. Only batches which changed kernel
+ * half pages need the (more expensive) toggle of CR4.PGE to drop them too.
+ *
+ * Page tables freed while the batch is open are not reused until after the
+ * flush, since the paging structure caches may still point at them.
+ *
+ * When cpu_init enabled CR4.PCIDE, every address space gets a 12-bit PCID
+ * which tags its TLB entries, and tlb_switch loads CR3 with the no-flush
+ * bit so the entries survive switching away and back. PCIDs are handed out
+ * in order and never freed. Once all of them have been used a new
+ * generation starts and every address space gets a new PCID the next time
+ * it is switched to, and each CPU flushes all of its entries once before it
+ * loads a PCID of the new generation.
+ *
+ * Entries of an address space which is not loaded are invalidated with
+ * invpcid when the CPU has it, otherwise the address space is marked stale
+ * and its entries are dropped the next time it is switched to.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <sys/mem/tlb.h>
+#include <sys/mmu.h>
+#include <sys/cpu_features.h>
+
+static TLB_STATS tlb_stats = {0};
+
+/* Set in tlb_init if cpu_init enabled CR4.PCIDE */
+static uint8_t tlb_pcid = FALSE;
+static uint8_t tlb_invpcid = FALSE;
+
+/* Protects the PCID allocator */
+static LOCK pcid_lock = {0};
+static uint64_t pcid_generation = 1;
+static uint64_t pcid_next = PCID_FIRST;
+
+/**
+ * @brief Checks which TLB features cpu_init has turned on
+ */
+void tlb_init() {
+    tlb_pcid = (read_cr(cr4) & (1 << CR4_PCID_ENABLE)) != 0;
+    tlb_invpcid = tlb_pcid &&
+                  check_cpu_support(cpuid_feature_invpcid) == SYS_OK;
+
+    kernel_addr_space.pcid = PCID_KERNEL;
+    klogi("TLB: PCIDs %s, invpcid %s\n", tlb_pcid ? "enabled" : "disabled",
+          tlb_invpcid ? "enabled" : "disabled");
+}
+
+/**
+ * @brief Checks if PCIDs are in use
+ *
+ * @return uint8_t TRUE if address spaces are switched without flushing
+ */
+uint8_t tlb_pcid_enabled() {
+    return tlb_pcid;
+}
+
+/**
+ * @brief Issues an invpcid
+ *
+ * @param type One of the INVPCID_* types
+ * @param pcid PCID to invalidate, for INVPCID_ADDRESS and INVPCID_CONTEXT
+ * @param address Address to invalidate, for INVPCID_ADDRESS
+ */
+static inline void tlb_invpcid_op(uint64_t type, uint16_t pcid,
+                                  uint64_t address) {
+    INVPCID_DESC desc = {.pcid = pcid, .address = address};
+    __asm__ volatile("invpcid %0, %1" : : "m"(desc), "r"(type) : "memory");
+    tlb_stats.invpcids++;
+}
+
+/**
+ * @brief Checks if the PCID of an address space is from this generation
+ *
+ * @param as Address space
+ * @return uint8_t TRUE if entries tagged with its PCID may be cached
+ */
+static inline uint8_t tlb_pcid_valid(ADDR_SPACE *as) {
+    return as == &kernel_addr_space || as->pcid_generation == pcid_generation;
+}
+
+/**
+ * @brief Starts collecting invalidations for an address space
+ *
+ * @param tlb Batch to initialize
+ * @param as Address space which is about to be changed
+ */
+void tlb_gather_init(TLB_GATHER *tlb, ADDR_SPACE *as) {
+    tlb->as = as;
+    tlb->live = (read_cr(cr3) & PAGE_ADDR_MASK) == VIRT_TO_PHYS(as->pml4);
+    tlb->tagged = !tlb->live && tlb_pcid && tlb_pcid_valid(as);
+    tlb->global = FALSE;
+    tlb->flush_all = FALSE;
+    tlb->num_pages = 0;
+    tlb->num_tables = 0;
+    tlb_stats.gathers++;
+}
+
+/**
+ * @brief Records a changed leaf which may be cached in the TLB
+ *
+ * @param tlb Batch of the current change
+ * @param virt_addr Any address inside the page
+ */
+void tlb_gather_page(TLB_GATHER *tlb, uint64_t virt_addr) {
+    /* The kernel half is live in every address space */
+    if (VM_IS_KERNEL_HALF(virt_addr)) {
+        tlb->global = TRUE;
+    } else if (!tlb->live && !tlb->tagged) {
+        return;
+    }
+
+    if (tlb->flush_all) {
+        return;
+    }
+    if (tlb->num_pages == TLB_FLUSH_THRESHOLD) {
+        tlb->flush_all = TRUE;
+        return;
+    }
+    tlb->pages[tlb->num_pages++] = virt_addr;
+}
+
+/**
+ * @brief Records a changed range which may be cached as many 4 KB entries
+ *
+ * @param tlb Batch of the current change
+ * @param virt_addr Start of the range
+ * @param size Size of the range in bytes
+ */
+void tlb_gather_range(TLB_GATHER *tlb, uint64_t virt_addr, uint64_t size) {
+    if (size / PAGE_SIZE > TLB_FLUSH_THRESHOLD) {
+        if (VM_IS_KERNEL_HALF(virt_addr) || tlb->live || tlb->tagged) {
+            tlb->global = tlb->global || VM_IS_KERNEL_HALF(virt_addr);
+            tlb->flush_all = TRUE;
+        }
+        return;
+    }
+    for (uint64_t offset = 0; offset < size; offset += PAGE_SIZE) {
+        tlb_gather_page(tlb, virt_addr + offset);
+    }
+}
+
+/**
+ * @brief Invalidates a lower half page of an address space which is not
+ *        loaded on this CPU
+ *
+ * @param as Address space
+ * @param virt_addr Any address inside the page, 0 for every page
+ */
+static void tlb_flush_other(ADDR_SPACE *as, uint64_t virt_addr) {
+    if (!tlb_invpcid) {
+        as->pcid_stale = TRUE;
+    } else if (virt_addr) {
+        tlb_invpcid_op(INVPCID_ADDRESS, as->pcid, virt_addr);
+    } else {
+        tlb_invpcid_op(INVPCID_CONTEXT, as->pcid, 0);
+    }
+}
+
+/**
+ * @brief Flushes what has been collected so far and releases the deferred
+ *        page tables, leaving the batch open
+ *
+ * @param tlb Batch of the current change
+ */
+static void tlb_gather_flush(TLB_GATHER *tlb) {
+    /* invlpg only drops paging structure caches of the current PCID, but */
+    /* the kernel half tables are cached under every PCID */
+    if (tlb_pcid && tlb->global && tlb->num_tables) {
+        tlb->flush_all = TRUE;
+    }
+
+    if (tlb->flush_all) {
+        if (tlb->global || tlb->live) {
+            tlb_flush_all(tlb->global);
+        }
+        if (tlb->tagged) {
+            tlb_flush_other(tlb->as, 0);
+        }
+    } else {
+        for (uint64_t i = 0; i < tlb->num_pages; i++) {
+            uint64_t page = tlb->pages[i];
+            if (tlb->live || VM_IS_KERNEL_HALF(page)) {
+                __asm__ volatile("invlpg (%0)" : : "r"(page) : "memory");
+                tlb_stats.invlpgs++;
+            } else {
+                tlb_flush_other(tlb->as, page);
+            }
+        }
+    }
+
+    for (uint64_t i = 0; i < tlb->num_tables; i++) {
+        pgtable_free(tlb->tables[i]);
+    }
+
+    tlb->global = FALSE;
+    tlb->flush_all = FALSE;
+    tlb->num_pages = 0;
+    tlb->num_tables = 0;
+}
+
+/**
+ * @brief Defers freeing a page table until the batch has been flushed
+ *
+ * @param tlb Batch of the current change
+ * @param phys Physical address of the table
+ */
+void tlb_gather_table(TLB_GATHER *tlb, uint64_t phys) {
+    if (tlb->num_tables == TLB_GATHER_MAX_TABLES) {
+        tlb_gather_flush(tlb);
+    }
+    tlb->tables[tlb->num_tables++] = phys;
+    tlb_stats.deferred_tables++;
+}
+
+/**
+ * @brief Flushes everything which was collected and ends the batch
+ *
+ * @param tlb Batch of the current change
+ */
+void tlb_gather_finish(TLB_GATHER *tlb) {
+    tlb_gather_flush(tlb);
+}
+
+/**
+ * @brief Flushes every TLB entry of the calling CPU
+ * @verbatim
+ * Without global, only the non-global entries of the current PCID are
+ * dropped. With global, entries of every PCID are dropped.
+ *
+ * @param global TRUE to also flush global (kernel half) entries
+ */
+void tlb_flush_all(uint8_t global) {
+    uint64_t flags = interrupts_save();
+    uint64_t cr4 = read_cr(cr4);
+
+    if (global && tlb_invpcid) {
+        tlb_invpcid_op(INVPCID_ALL_GLOBAL, 0, 0);
+        tlb_stats.global_flushes++;
+    } else if (global && (cr4 & (1 << CR4_PAGE_GLOBAL_ENABLE))) {
+        /* Toggling PGE drops every entry, global or not */
+        write_cr(cr4, cr4 & ~(1 << CR4_PAGE_GLOBAL_ENABLE));
+        write_cr(cr4, cr4);
+        tlb_stats.global_flushes++;
+    } else {
+        write_cr(cr3, read_cr(cr3));
+        tlb_stats.full_flushes++;
+    }
+    interrupts_restore(flags);
+}
+
+/**
+ * @brief Gives an address space a PCID of the current generation, the PCID
+ *        lock must be held
+ *
+ * @param as Address space
+ */
+static void tlb_pcid_assign(ADDR_SPACE *as) {
+    if (pcid_next == PCID_COUNT) {
+        pcid_generation++;
+        pcid_next = PCID_FIRST;
+        tlb_stats.pcid_rollovers++;
+    }
+    as->pcid = pcid_next++;
+    as->pcid_generation = pcid_generation;
+    as->pcid_stale = FALSE;
+}
+
+/**
+ * @brief Loads an address space on the calling CPU
+ * @verbatim
+ * With PCIDs, the TLB entries of the address space which was loaded before
+ * are kept, and so are the ones of the new address space from the last time
+ * it was loaded, unless they went stale in the meantime.
+ *
+ * @param addr_space Address space to load, NULL for the kernel
+ */
+void tlb_switch(ADDR_SPACE *addr_space) {
+    ADDR_SPACE *as = CONVERT_ADDR_SPACE(addr_space);
+    uint64_t cr3 = VIRT_TO_PHYS(as->pml4);
+    uint64_t flags = interrupts_save();
+
+    tlb_stats.switches++;
+    this_cpu()->addr_space = as;
+    if (!tlb_pcid) {
+        write_cr(cr3, cr3);
+        tlb_stats.switch_flushes++;
+        interrupts_restore(flags);
+        return;
+    }
+
+    LOCK_LOCK(&pcid_lock);
+    if (!tlb_pcid_valid(as)) {
+        tlb_pcid_assign(as);
+    }
+    uint64_t generation = pcid_generation;
+    UNLOCK_LOCK(&pcid_lock);
+
+    /* PCIDs of the last generation are handed out again, so whatever this */
+    /* CPU still has cached under them belongs to someone else */
+    CPU_LOCAL *cpu = this_cpu();
+    if (cpu->pcid_generation != generation) {
+        if (tlb_invpcid) {
+            tlb_invpcid_op(INVPCID_ALL, 0, 0);
+        } else {
+            tlb_flush_all(TRUE);
+        }
+        cpu->pcid_generation = generation;
+    }
+
+    if (as->pcid_stale) {
+        as->pcid_stale = FALSE;
+        tlb_stats.switch_flushes++;
+        write_cr(cr3, cr3 | as->pcid);
+    } else {
+        write_cr(cr3, cr3 | as->pcid | CR3_NOFLUSH);
+    }
+    interrupts_restore(flags);
+}
+
+/**
+ * @brief Prints how invalidations have been carried out so far
+ */
+void tlb_print_stats() {
+    klogi("TLB: %d batches, %d invlpg, %d invpcid, %d full flushes, "
+          "%d global flushes, %d deferred tables\n", tlb_stats.gathers,
+          tlb_stats.invlpgs, tlb_stats.invpcids, tlb_stats.full_flushes,
+          tlb_stats.global_flushes, tlb_stats.deferred_tables);
+    klogi("TLB: %d switches, %d flushed, %d PCID generations rolled over\n",
+          tlb_stats.switches, tlb_stats.switch_flushes,
+          tlb_stats.pcid_rollovers);
+}
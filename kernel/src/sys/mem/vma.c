@@ -0,0 +1,493 @@
+/**
+ * @file vma.c
+ * @author Zack Bostock
+ * @brief Red-black interval trees of virtual memory areas
+ * @verbatim
+ * Each address space keeps the areas it has mapped in a VMA_TREE. Areas
+ * never overlap, so ordering them by start also orders them by end, and
+ * lookups by address, overlap checks and insertions are O(log n).
+ *
+ * Every node also caches the lowest start, highest end and largest hole
+ * between two areas of its subtree. These only depend on the node and its
+ * children, so they are recomputed on the way back up after a change and
+ * after every rotation. The largest hole is what lets vma_find_gap skip
+ * whole subtrees which cannot hold a request.
+ *
+ * The tree is intrusive and never allocates, the caller owns the VMAs.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <sys/mem/vma.h>
+
+/**
+ * @brief Recomputes the cached subtree information of a node from its
+ *        children
+ *
+ * @param vma Node to update
+ */
+static void vma_update(VMA *vma) {
+    uint64_t gap = 0;
+
+    vma->min_start = vma->start;
+    vma->max_end = vma->end;
+
+    if (vma->left) {
+        vma->min_start = vma->left->min_start;
+        gap = vma->left->max_gap;
+        if (vma->start - vma->left->max_end > gap) {
+            gap = vma->start - vma->left->max_end;
+        }
+    }
+    if (vma->right) {
+        vma->max_end = vma->right->max_end;
+        if (vma->right->max_gap > gap) {
+            gap = vma->right->max_gap;
+        }
+        if (vma->right->min_start - vma->end > gap) {
+            gap = vma->right->min_start - vma->end;
+        }
+    }
+    vma->max_gap = gap;
+}
+
+/**
+ * @brief Recomputes the cached subtree information from a node up to the
+ *        root
+ *
+ * @param vma Lowest node which changed, may be NULL
+ */
+static void vma_propagate(VMA *vma) {
+    for (; vma; vma = vma->parent) {
+        vma_update(vma);
+    }
+}
+
+/**
+ * @brief Replaces the link from a node's parent to it with another node
+ *
+ * @param tree Tree of the nodes
+ * @param old Node being replaced
+ * @param new Replacement, may be NULL
+ */
+static void vma_replace_child(VMA_TREE *tree, VMA *old, VMA *new) {
+    if (!old->parent) {
+        tree->root = new;
+    } else if (old == old->parent->left) {
+        old->parent->left = new;
+    } else {
+        old->parent->right = new;
+    }
+    if (new) {
+        new->parent = old->parent;
+    }
+}
+
+/**
+ * @brief Rotates a node down to the left
+ *
+ * @param tree Tree of the node
+ * @param vma Node whose right child takes its place
+ */
+static void vma_rotate_left(VMA_TREE *tree, VMA *vma) {
+    VMA *right = vma->right;
+
+    vma->right = right->left;
+    if (right->left) {
+        right->left->parent = vma;
+    }
+    vma_replace_child(tree, vma, right);
+    right->left = vma;
+    vma->parent = right;
+
+    vma_update(vma);
+    vma_update(right);
+}
+
+/**
+ * @brief Rotates a node down to the right
+ *
+ * @param tree Tree of the node
+ * @param vma Node whose left child takes its place
+ */
+static void vma_rotate_right(VMA_TREE *tree, VMA *vma) {
+    VMA *left = vma->left;
+
+    vma->left = left->right;
+    if (left->right) {
+        left->right->parent = vma;
+    }
+    vma_replace_child(tree, vma, left);
+    left->right = vma;
+    vma->parent = left;
+
+    vma_update(vma);
+    vma_update(left);
+}
+
+/**
+ * @brief Checks if a possibly missing node is black
+ *
+ * @param vma Node, NULL counts as black
+ * @return uint8_t TRUE if black
+ */
+static inline uint8_t vma_is_black(VMA *vma) {
+    return !vma || vma->color == VMA_BLACK;
+}
+
+/**
+ * @brief Inserts an area into a tree
+ *
+ * @param tree Tree to insert into
+ * @param vma Area to insert, start and end must be set
+ * @return STATUS SYS_OK if inserted, SYS_ERR if it is empty or overlaps an
+ *         area already in the tree
+ */
+STATUS vma_insert(VMA_TREE *tree, VMA *vma) {
+    if (vma->start >= vma->end ||
+        vma_find_overlap(tree, vma->start, vma->end)) {
+        return SYS_ERR;
+    }
+
+    VMA *parent = NULL;
+    VMA **link = &tree->root;
+    while (*link) {
+        parent = *link;
+        link = vma->start < parent->start ? &parent->left : &parent->right;
+    }
+
+    vma->parent = parent;
+    vma->left = NULL;
+    vma->right = NULL;
+    vma->color = VMA_RED;
+    *link = vma;
+    vma_propagate(vma);
+
+    /* Fix up two reds in a row, the root is always black */
+    while (vma->parent && vma->parent->color == VMA_RED) {
+        parent = vma->parent;
+        VMA *grandparent = parent->parent;
+
+        if (parent == grandparent->left) {
+            VMA *uncle = grandparent->right;
+            if (!vma_is_black(uncle)) {
+                parent->color = VMA_BLACK;
+                uncle->color = VMA_BLACK;
+                grandparent->color = VMA_RED;
+                vma = grandparent;
+                continue;
+            }
+            if (vma == parent->right) {
+                vma = parent;
+                vma_rotate_left(tree, vma);
+                parent = vma->parent;
+            }
+            parent->color = VMA_BLACK;
+            grandparent->color = VMA_RED;
+            vma_rotate_right(tree, grandparent);
+        } else {
+            VMA *uncle = grandparent->left;
+            if (!vma_is_black(uncle)) {
+                parent->color = VMA_BLACK;
+                uncle->color = VMA_BLACK;
+                grandparent->color = VMA_RED;
+                vma = grandparent;
+                continue;
+            }
+            if (vma == parent->left) {
+                vma = parent;
+                vma_rotate_right(tree, vma);
+                parent = vma->parent;
+            }
+            parent->color = VMA_BLACK;
+            grandparent->color = VMA_RED;
+            vma_rotate_left(tree, grandparent);
+        }
+    }
+    tree->root->color = VMA_BLACK;
+    tree->count++;
+    return SYS_OK;
+}
+
+/**
+ * @brief Restores the red-black properties after a black node was removed
+ *
+ * @param tree Tree which was changed
+ * @param vma Node which took the removed node's place, may be NULL
+ * @param parent Parent of vma
+ */
+static void vma_remove_fixup(VMA_TREE *tree, VMA *vma, VMA *parent) {
+    while (vma != tree->root && vma_is_black(vma)) {
+        if (vma == parent->left) {
+            VMA *sibling = parent->right;
+            if (sibling->color == VMA_RED) {
+                sibling->color = VMA_BLACK;
+                parent->color = VMA_RED;
+                vma_rotate_left(tree, parent);
+                sibling = parent->right;
+            }
+            if (vma_is_black(sibling->left) && vma_is_black(sibling->right)) {
+                sibling->color = VMA_RED;
+                vma = parent;
+                parent = vma->parent;
+                continue;
+            }
+            if (vma_is_black(sibling->right)) {
+                sibling->left->color = VMA_BLACK;
+                sibling->color = VMA_RED;
+                vma_rotate_right(tree, sibling);
+                sibling = parent->right;
+            }
+            sibling->color = parent->color;
+            parent->color = VMA_BLACK;
+            sibling->right->color = VMA_BLACK;
+            vma_rotate_left(tree, parent);
+        } else {
+            VMA *sibling = parent->left;
+            if (sibling->color == VMA_RED) {
+                sibling->color = VMA_BLACK;
+                parent->color = VMA_RED;
+                vma_rotate_right(tree, parent);
+                sibling = parent->left;
+            }
+            if (vma_is_black(sibling->left) && vma_is_black(sibling->right)) {
+                sibling->color = VMA_RED;
+                vma = parent;
+                parent = vma->parent;
+                continue;
+            }
+            if (vma_is_black(sibling->left)) {
+                sibling->right->color = VMA_BLACK;
+                sibling->color = VMA_RED;
+                vma_rotate_left(tree, sibling);
+                sibling = parent->left;
+            }
+            sibling->color = parent->color;
+            parent->color = VMA_BLACK;
+            sibling->left->color = VMA_BLACK;
+            vma_rotate_right(tree, parent);
+        }
+        vma = tree->root;
+    }
+    if (vma) {
+        vma->color = VMA_BLACK;
+    }
+}
+
+/**
+ * @brief Removes an area from a tree
+ *
+ * @param tree Tree the area is in
+ * @param vma Area to remove
+ */
+void vma_remove(VMA_TREE *tree, VMA *vma) {
+    VMA *child;
+    VMA *parent;
+    uint8_t removed_color = vma->color;
+
+    if (!vma->left || !vma->right) {
+        child = vma->left ? vma->left : vma->right;
+        parent = vma->parent;
+        vma_replace_child(tree, vma, child);
+    } else {
+        /* Two children, the successor takes the node's place */
+        VMA *next = vma->right;
+        while (next->left) {
+            next = next->left;
+        }
+        removed_color = next->color;
+        child = next->right;
+
+        if (next->parent == vma) {
+            parent = next;
+        } else {
+            parent = next->parent;
+            vma_replace_child(tree, next, next->right);
+            next->right = vma->right;
+            next->right->parent = next;
+        }
+        vma_replace_child(tree, vma, next);
+        next->left = vma->left;
+        next->left->parent = next;
+        next->color = vma->color;
+    }
+
+    /* The successor, if moved, is an ancestor of parent */
+    vma_propagate(parent);
+    if (removed_color == VMA_BLACK) {
+        vma_remove_fixup(tree, child, parent);
+    }
+
+    vma->parent = NULL;
+    vma->left = NULL;
+    vma->right = NULL;
+    tree->count--;
+}
+
+/**
+ * @brief Finds the area which contains an address
+ *
+ * @param tree Tree to search
+ * @param address Address to look for
+ * @return VMA * Area, NULL if the address is not in any area
+ */
+VMA *vma_find(VMA_TREE *tree, uint64_t address) {
+    VMA *vma = tree->root;
+    while (vma) {
+        if (address < vma->start) {
+            vma = vma->left;
+        } else if (address >= vma->end) {
+            vma = vma->right;
+        } else {
+            return vma;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Finds the lowest area which overlaps a range
+ *
+ * @param tree Tree to search
+ * @param start First byte of the range
+ * @param end One past the last byte of the range
+ * @return VMA * Lowest overlapping area, NULL if the range is free
+ */
+VMA *vma_find_overlap(VMA_TREE *tree, uint64_t start, uint64_t end) {
+    VMA *vma = tree->root;
+    VMA *found = NULL;
+
+    /* Lowest area which ends after start */
+    while (vma) {
+        if (vma->end > start) {
+            found = vma;
+            vma = vma->left;
+        } else {
+            vma = vma->right;
+        }
+    }
+    return found && found->start < end ? found : NULL;
+}
+
+/**
+ * @brief Checks if a hole between two areas can hold a request
+ *
+ * @param start Start of the hole
+ * @param end End of the hole
+ * @param low Lowest address which may be returned
+ * @param high Highest address (exclusive) the request may reach
+ * @param size Size of the request
+ * @param align Alignment of the request, a power of two
+ * @return uint64_t Lowest fitting address in the hole, VMA_NO_GAP if none
+ */
+static uint64_t vma_gap_fit(uint64_t start, uint64_t end, uint64_t low,
+                            uint64_t high, uint64_t size, uint64_t align) {
+    start = start < low ? low : start;
+    end = end > high ? high : end;
+    if (start >= end) {
+        return VMA_NO_GAP;
+    }
+
+    uint64_t aligned = (start + align - 1) & ~(align - 1);
+    if (aligned < start || aligned >= end || end - aligned < size) {
+        return VMA_NO_GAP;
+    }
+    return aligned;
+}
+
+/**
+ * @brief Searches a subtree for the lowest hole which can hold a request
+ *
+ * @param vma Root of the subtree, may be NULL
+ * @param lo End of the area before the subtree
+ * @param hi Start of the area after the subtree
+ * @param low Lowest address which may be returned
+ * @param high Highest address (exclusive) the request may reach
+ * @param size Size of the request
+ * @param align Alignment of the request, a power of two
+ * @return uint64_t Address of the hole, VMA_NO_GAP if none
+ */
+static uint64_t vma_gap_search(VMA *vma, uint64_t lo, uint64_t hi,
+                               uint64_t low, uint64_t high, uint64_t size,
+                               uint64_t align) {
+    if (!vma) {
+        return vma_gap_fit(lo, hi, low, high, size, align);
+    }
+    if (hi <= low || lo >= high) {
+        return VMA_NO_GAP;
+    }
+
+    /* Only the holes around the subtree can be inside [low, high) */
+    if (vma->max_end <= low) {
+        return vma_gap_fit(vma->max_end, hi, low, high, size, align);
+    }
+    if (vma->min_start >= high) {
+        return vma_gap_fit(lo, vma->min_start, low, high, size, align);
+    }
+
+    if (vma->max_gap < size && vma->min_start - lo < size &&
+        hi - vma->max_end < size) {
+        return VMA_NO_GAP;
+    }
+
+    uint64_t found = vma_gap_search(vma->left, lo, vma->start, low, high,
+                                    size, align);
+    if (found != VMA_NO_GAP) {
+        return found;
+    }
+    return vma_gap_search(vma->right, vma->end, hi, low, high, size, align);
+}
+
+/**
+ * @brief Finds the lowest free range of a size between two addresses
+ *
+ * @param tree Tree to search
+ * @param low Lowest address which may be returned
+ * @param high Highest address (exclusive) the range may reach
+ * @param size Size of the range in bytes
+ * @param align Alignment of the range, a power of two
+ * @return uint64_t Start of the free range, VMA_NO_GAP if there is none
+ */
+uint64_t vma_find_gap(VMA_TREE *tree, uint64_t low, uint64_t high,
+                      uint64_t size, uint64_t align) {
+    if (!size || !align || (align & (align - 1))) {
+        return VMA_NO_GAP;
+    }
+    return vma_gap_search(tree->root, 0, ~((uint64_t) 0), low, high, size,
+                          align);
+}
+
+/**
+ * @brief Gets the lowest area of a tree
+ *
+ * @param tree Tree
+ * @return VMA * Lowest area, NULL if the tree is empty
+ */
+VMA *vma_first(VMA_TREE *tree) {
+    VMA *vma = tree->root;
+    while (vma && vma->left) {
+        vma = vma->left;
+    }
+    return vma;
+}
+
+/**
+ * @brief Gets the next higher area in the same tree
+ *
+ * @param vma Area
+ * @return VMA * Next area, NULL if vma is the highest
+ */
+VMA *vma_next(VMA *vma) {
+    if (vma->right) {
+        vma = vma->right;
+        while (vma->left) {
+            vma = vma->left;
+        }
+        return vma;
+    }
+    while (vma->parent && vma == vma->parent->right) {
+        vma = vma->parent;
+    }
+    return vma->parent;
+}
@@ -0,0 +1,247 @@
+/**
+ * @file vmalloc.c
+ * @author Zack Bostock
+ * @brief Virtually contiguous allocations backed by scattered frames
+ * @verbatim
+ * Large kmalloc requests need a physically contiguous run of frames, which
+ * gets harder to find as memory fragments. vmalloc only needs a range of
+ * the vmalloc window (see vm_alloc_area), which is backed by whichever
+ * frames are free and mapped through vm_map.
+ *
+ * Whenever a 2 MB aligned part of the range is left to back, a 2 MB run is
+ * tried first so that it can be mapped with a single large page. After the
+ * first miss the rest of the allocation settles for single frames. Each
+ * page gets a frame whose color matches its virtual page number (see
+ * page_color.c), so the buffer spreads over every set of the last level
+ * cache. Anything coloring can't serve is taken from the physical allocator
+ * VMALLOC_BATCH at a time.
+ *
+ * Memory is zeroed like kmalloc's, so the two can be swapped for one
+ * another. Every frame is cleared before it is mapped, with non-temporal
+ * stores or by coming from the zero pool, rather than clearing the whole
+ * buffer through the cache afterwards.
+ *
+ * Single frames are only reachable through their mapping, so they are
+ * tagged movable for compaction (see compact.c).
+ *
+ * kvmalloc, kvrealloc and kvfree pick between kmalloc and vmalloc by size,
+ * for buffers such as vectors which may grow large.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <sys/mem/vmalloc.h>
+#include <sys/mmu.h>
+#include <common/kmalloc.h>
+
+static VMALLOC_STATS vmalloc_stats = {0};
+
+/**
+ * @brief Backs part of a vmalloc area with single frames
+ *
+ * @param virt_addr First page to back
+ * @param num_pages Number of pages to back, at most VMALLOC_BATCH
+ * @return uint64_t Number of pages backed, 0 if out of memory
+ */
+static uint64_t vmalloc_back_small(uint64_t virt_addr, uint64_t num_pages) {
+    uint64_t frames[VMALLOC_BATCH];
+    uint64_t got = 0;
+
+    for (; got < num_pages; got++) {
+        frames[got] = page_color_get(virt_addr / PAGE_SIZE + got, PM_ZERO);
+        if (!frames[got]) {
+            break;
+        }
+    }
+    for (; got < num_pages; got++) {
+        frames[got] = zero_pool_get();
+        if (!frames[got]) {
+            break;
+        }
+    }
+    uint64_t cleared = got;
+    got += pm_get_frames(&frames[got], num_pages - got);
+    for (uint64_t i = cleared; i < got; i++) {
+        zero_pool_clear(frames[i], 1);
+    }
+
+    /* Frames next to each other are mapped with one call */
+    for (uint64_t i = 0; i < got;) {
+        uint64_t j = i + 1;
+        while (j < got && frames[j] == frames[j - 1] + PAGE_SIZE) {
+            j++;
+        }
+        vm_map(NULL, virt_addr + i * PAGE_SIZE, frames[i], j - i, VM_DEFAULT);
+        i = j;
+    }
+    /* Only reachable through this mapping, so compaction may move them */
+    for (uint64_t i = 0; i < got; i++) {
+        compact_set_movable(frames[i], virt_addr + i * PAGE_SIZE);
+    }
+
+    vmalloc_stats.small_pages += got;
+    return got;
+}
+
+/**
+ * @brief Allocates virtually contiguous memory
+ *
+ * @param size Number of bytes to allocate
+ * @return void * Zeroed memory, NULL if out of memory or address space
+ */
+void *vmalloc(uint64_t size) {
+    uint64_t align = size >= PAGE_SIZE_2M ? PAGE_SIZE_2M : PAGE_SIZE;
+    VMA *vma = vm_alloc_area("vmalloc", size, align, VMA_TYPE_VMALLOC,
+                             VM_DEFAULT);
+    if (!vma) {
+        vmalloc_stats.failures++;
+        return NULL;
+    }
+
+    uint64_t virt_addr = vma->start;
+    uint64_t end = vma->start + NUM_PAGES(size) * PAGE_SIZE;
+    uint8_t large = TRUE;
+
+    while (virt_addr < end) {
+        if (large && !(virt_addr & (PAGE_SIZE_2M - 1)) &&
+            end - virt_addr >= PAGE_SIZE_2M) {
+            uint64_t phys = pm_try_get(PAGE_TABLE_ENTRIES);
+            if (phys && !(phys & (PAGE_SIZE_2M - 1))) {
+                page_clear_nt_run((void *) PHYS_TO_VIRT(phys),
+                                  PAGE_TABLE_ENTRIES);
+                vm_map(NULL, virt_addr, phys, PAGE_TABLE_ENTRIES, VM_DEFAULT);
+                vmalloc_stats.large_pages++;
+                virt_addr += PAGE_SIZE_2M;
+                continue;
+            }
+            if (phys) {
+                pm_free(phys, PAGE_TABLE_ENTRIES);
+            }
+            /* Memory is too fragmented, don't keep trying */
+            large = FALSE;
+        }
+
+        uint64_t num_pages = (end - virt_addr) / PAGE_SIZE;
+        if (num_pages > VMALLOC_BATCH) {
+            num_pages = VMALLOC_BATCH;
+        }
+        uint64_t got = vmalloc_back_small(virt_addr, num_pages);
+        if (!got) {
+            kloge("vmalloc: Out of memory when allocating %d bytes\n", size);
+            vm_unmap_region(NULL, vma->start);
+            vmalloc_stats.failures++;
+            return NULL;
+        }
+        virt_addr += got * PAGE_SIZE;
+    }
+
+    vmalloc_stats.allocs++;
+    return (void *) vma->start;
+}
+
+/**
+ * @brief Frees memory allocated with vmalloc
+ *
+ * @param address Address returned by vmalloc
+ */
+void vfree(void *address) {
+    if (!address) {
+        return;
+    }
+
+    VMA *vma = vm_find_region(NULL, (uint64_t) address);
+    if (!vma || vma->type != VMA_TYPE_VMALLOC ||
+        vma->start != (uint64_t) address) {
+        kloge("vfree: %x was not allocated with vmalloc\n", address);
+        return;
+    }
+
+    vm_unmap_region(NULL, (uint64_t) address);
+    vmalloc_stats.frees++;
+}
+
+/**
+ * @brief Gets the usable size of a vmalloc allocation
+ *
+ * @param address Address returned by vmalloc
+ * @return uint64_t Number of bytes, 0 if not a vmalloc allocation
+ */
+uint64_t vmalloc_size(void *address) {
+    VMA *vma = vm_find_region(NULL, (uint64_t) address);
+    if (!vma || vma->type != VMA_TYPE_VMALLOC) {
+        return 0;
+    }
+    /* Without the guard page */
+    return vma->end - vma->start - PAGE_SIZE;
+}
+
+/**
+ * @brief Allocates with kmalloc, or with vmalloc for large sizes
+ *
+ * @param size Number of bytes to allocate
+ * @return void * Zeroed memory, free with kvfree
+ */
+void *kvmalloc(uint64_t size) {
+    if (size >= KVMALLOC_THRESHOLD) {
+        return vmalloc(size);
+    }
+    return kmalloc(size);
+}
+
+/**
+ * @brief Resizes memory allocated with kvmalloc
+ * @verbatim
+ * Memory moves to vmalloc once it grows past KVMALLOC_THRESHOLD. Buffers
+ * which stay small are left to krealloc.
+ *
+ * @param address Address returned by kvmalloc or kvrealloc, may be NULL
+ * @param new_size New number of bytes
+ * @return void * Resized memory, free with kvfree
+ */
+void *kvrealloc(void *address, uint64_t new_size) {
+    uint8_t is_vmalloc = VM_IS_VMALLOC(address);
+    if (!is_vmalloc && new_size < KVMALLOC_THRESHOLD) {
+        return krealloc(address, new_size);
+    }
+    if (!address) {
+        return kvmalloc(new_size);
+    }
+
+    uint64_t old_size = is_vmalloc ? vmalloc_size(address) :
+                                     kmalloc_size(address);
+    if (is_vmalloc && new_size && new_size <= old_size) {
+        return address;
+    }
+
+    void *new_base = kvmalloc(new_size);
+    if (!new_base) {
+        return NULL;
+    }
+    memcpy(new_base, address, old_size < new_size ? old_size : new_size);
+    kvfree(address);
+    return new_base;
+}
+
+/**
+ * @brief Frees memory allocated with kvmalloc or kvrealloc
+ *
+ * @param address Address to free
+ */
+void kvfree(void *address) {
+    if (VM_IS_VMALLOC(address)) {
+        vfree(address);
+    } else {
+        kfree(address);
+    }
+}
+
+/**
+ * @brief Prints how vmalloc allocations have been backed so far
+ */
+void vmalloc_print_stats() {
+    klogi("vmalloc: %d allocs, %d frees, %d failures, "
+          "%d 2 MB pages, %d 4 KB pages\n", vmalloc_stats.allocs,
+          vmalloc_stats.frees, vmalloc_stats.failures,
+          vmalloc_stats.large_pages, vmalloc_stats.small_pages);
+}
@@ -0,0 +1,145 @@
+/**
+ * @file zero_pool.c
+ * @author Zack Bostock
+ * @brief Per-CPU pools of frames which were zeroed ahead of time
+ * @verbatim
+ * pm_get requests made with PM_ZERO take a frame from the pool of the
+ * calling CPU, so they do not pay for clearing it on the allocation path.
+ * Like the magazines (see pm_magazine.c), the pools live in CPU_LOCAL and
+ * are only touched with interrupts disabled, so a PM_ZERO request never
+ * takes a shared lock. The idle loop refills the pool of its CPU
+ * ZERO_POOL_BATCH frames at a time, and only clears a frame after it is out
+ * of the physical allocator, so interrupts stay enabled while clearing.
+ *
+ * Frames are cleared with non-temporal stores (see page_nt.c). Nobody
+ * reads a zeroed frame soon after it is cleared, so there is no point in
+ * pulling it into the cache and evicting something which is in use.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <sys/mem/zero_pool.h>
+#include <sys/mmu.h>
+
+/**
+ * @brief Takes a zeroed frame from the calling CPU's pool
+ *
+ * @return uint64_t Physical address of the frame, 0 if the pool is empty
+ */
+uint64_t zero_pool_get() {
+    uint64_t flags = interrupts_save();
+    ZERO_POOL *pool = &this_cpu()->zero_pool;
+    uint64_t phys = 0;
+
+    if (pool->count) {
+        phys = pool->frames[--pool->count];
+        pool->hits++;
+    } else {
+        pool->misses++;
+    }
+    interrupts_restore(flags);
+    return phys;
+}
+
+/**
+ * @brief Clears frames for a PM_ZERO request which the pool could not serve
+ *
+ * @param phys Physical address of the first frame
+ * @param num_pages Number of frames
+ */
+void zero_pool_clear(uint64_t phys, uint64_t num_pages) {
+    page_clear_nt_run((void *) PHYS_TO_VIRT(phys), num_pages);
+
+    uint64_t flags = interrupts_save();
+    this_cpu()->zero_pool.sync_bytes += num_pages * PAGE_SIZE;
+    interrupts_restore(flags);
+}
+
+/**
+ * @brief Zeroes up to ZERO_POOL_BATCH frames into the calling CPU's pool,
+ *        called from the idle loop
+ * @note Does nothing while memory is under pressure, see pm_under_pressure
+ */
+void zero_pool_idle() {
+    uint64_t frames[ZERO_POOL_BATCH];
+
+    if (pm_under_pressure()) {
+        return;
+    }
+
+    /* Interrupt handlers only ever take frames out, so this can only grow */
+    uint64_t want = ZERO_POOL_SIZE - this_cpu()->zero_pool.count;
+    if (want > ZERO_POOL_BATCH) {
+        want = ZERO_POOL_BATCH;
+    }
+    if (!want) {
+        return;
+    }
+
+    uint64_t got = pm_get_frames(frames, want);
+    for (uint64_t i = 0; i < got; i++) {
+        page_clear_nt((void *) PHYS_TO_VIRT(frames[i]));
+    }
+
+    uint64_t flags = interrupts_save();
+    ZERO_POOL *pool = &this_cpu()->zero_pool;
+    for (uint64_t i = 0; i < got; i++) {
+        pool->frames[pool->count++] = frames[i];
+    }
+    pool->background_bytes += got * PAGE_SIZE;
+    interrupts_restore(flags);
+}
+
+/**
+ * @brief Gives every frame of the calling CPU's pool back to the physical
+ *        allocator
+ *
+ * @return uint64_t Number of frames given back
+ */
+uint64_t zero_pool_drain() {
+    uint64_t flags = interrupts_save();
+    ZERO_POOL *pool = &this_cpu()->zero_pool;
+    uint64_t count = pool->count;
+
+    if (count) {
+        pm_put_frames(pool->frames, count);
+        pool->count = 0;
+    }
+    interrupts_restore(flags);
+    return count;
+}
+
+/**
+ * @brief Counts the zeroed frames ready across every online CPU
+ *
+ * @return uint64_t Number of frames
+ */
+uint64_t zero_pool_cached() {
+    uint64_t cached = 0;
+    for (uint64_t i = 0; i < MAX_CPUS; i++) {
+        if (cpu_locals[i].online) {
+            cached += cpu_locals[i].zero_pool.count;
+        }
+    }
+    return cached;
+}
+
+/**
+ * @brief Prints how PM_ZERO requests have been served so far, per online
+ *        CPU
+ */
+void zero_pool_print_stats() {
+    for (uint64_t i = 0; i < MAX_CPUS; i++) {
+        if (!cpu_locals[i].online) {
+            continue;
+        }
+        ZERO_POOL *pool = &cpu_locals[i].zero_pool;
+        uint64_t requests = pool->hits + pool->misses;
+        klogi("CPU %d zero pool: %d frames ready, hits: %d, misses: %d "
+              "(%d percent hit rate), cleared %d KB while idle, "
+              "%d KB on allocation\n", i, pool->count, pool->hits,
+              pool->misses, requests ? pool->hits * 100 / requests : 0,
+              pool->background_bytes / 1024, pool->sync_bytes / 1024);
+    }
+}
@@ -13,21 +13,137 @@
  */
 
 #include <sys/mmu.h>
+#include <sys/cpu_features.h>
 
 static KERNEL_MEM_INFO kmem = {0};
-vector_new_static(MEM_MAP, global_mem_map);
+/*
+  Protects kmem, the per-CPU magazines only take it to refill and drain.
+  Every CPU ends up here, so waiters queue on their own cache lines.
+*/
+static QLOCK pm_lock = {0};
 ADDR_SPACE kernel_addr_space = {0};
+/* Set in vm_init if the CPU supports 1 GB pages */
+static uint8_t vm_gb_pages = FALSE;
+/* Set in vm_init if kernel half leaves can be marked global */
+static uint8_t vm_global_pages = FALSE;
+/* Number of leaves created at each level, for the boot log */
+static uint64_t vm_leaves[VM_LEVEL_PML4] = {0};
+
+/**
+ * @brief Adds a pool to the end of the pool list, split in two if it
+ *        straddles the end of ZONE_DMA32
+ *
+ * @param start First frame
+ * @param end Frame past the last one
+ * @param node NUMA node of the frames
+ */
+static void pm_add_pool(uint64_t start, uint64_t end, uint32_t node) {
+    uint64_t dma32_end = PM_DMA32_LIMIT / PAGE_SIZE;
+
+    if (start < dma32_end && end > dma32_end) {
+        pm_add_pool(start, dma32_end, node);
+        start = dma32_end;
+    }
+
+    PM_POOL *pool = &kmem.pools[kmem.num_pools++];
+    pool->first_page = start;
+    pool->num_pages = end - start;
+    pool->node = node;
+    pool->zone = start < dma32_end ? ZONE_DMA32 : ZONE_NORMAL;
+    kmem.zones[pool->zone].num_pages += pool->num_pages;
+}
+
+/**
+ * @brief Splits the frames below the physical limit into pools, one for each
+ *        run of memory which belongs to the same NUMA node and zone
+ * @verbatim
+ * Boundaries are rounded down to PM_POOL_ALIGN_PAGES so that buddy blocks
+ * stay naturally aligned in physical memory, and holes between the ranges
+ * of the SRAT go to the pool in front of them. Without an SRAT there is a
+ * single pool for node 0, split at 4 GB if there is memory above it.
+ *
+ * @param num_pages Number of frames below the physical limit
+ */
+static void pm_split_pools(uint64_t num_pages) {
+    NUMA_RANGE *ranges = numa_get_ranges();
+    uint32_t num_ranges = numa_num_ranges();
+    uint32_t node = num_ranges ? ranges[0].node : 0;
+    uint64_t start = 0;
+
+    kmem.num_pools = 0;
+    for (uint32_t i = 0; i < num_ranges; i++) {
+        uint64_t boundary = (ranges[i].base / PAGE_SIZE) &
+                            ~(PM_POOL_ALIGN_PAGES - 1);
+        if (ranges[i].node == node || boundary <= start) {
+            continue;
+        }
+        /* Whatever is left over goes to the last pool, which may still */
+        /* be split at 4 GB */
+        if (boundary >= num_pages || kmem.num_pools >= PM_MAX_POOLS - 3) {
+            break;
+        }
+
+        pm_add_pool(start, boundary, node);
+        start = boundary;
+        node = ranges[i].node;
+    }
+    pm_add_pool(start, num_pages, node);
+}
+
+/**
+ * @brief Counts the free pages of a zone across every node
+ *
+ * @param zone ZONE_DMA32 or ZONE_NORMAL
+ * @return uint64_t Number of free pages
+ */
+static uint64_t pm_zone_free(uint8_t zone) {
+    uint64_t free_pages = 0;
+    for (uint64_t i = 0; i < kmem.num_pools; i++) {
+        if (kmem.pools[i].zone == zone) {
+            free_pages += kmem.pools[i].free_pages;
+        }
+    }
+    return free_pages;
+}
+
+/**
+ * @brief Sets the watermarks of every zone from its free pages
+ */
+static void pm_set_watermarks() {
+    for (uint8_t z = 0; z < PM_NUM_ZONES; z++) {
+        uint64_t min = pm_zone_free(z) / PM_WATERMARK_DIV;
+        if (min > PM_WATERMARK_MAX) {
+            min = PM_WATERMARK_MAX;
+        }
+        kmem.zones[z].watermark_min = min;
+        kmem.zones[z].watermark_low = 2 * min;
+    }
+}
 
 /**
  * @brief Physical memory initialization
  * @verbatim
- * Utilize a 8-bit integer as a representation of eight pages, then store in an
- * array. Each page is 4 KB on x86_64.
+ * Physical memory is split into pools by NUMA node and zone (see
+ * pm_split_pools and pm_pool.c), each with its own backend. The default
+ * backend is a bitmap where each bit represents a single page, grouped into
+ * 64-bit words so that the allocator can scan 64 pages at a time. Each page
+ * is 4 KB on x86_64. The bitmap is followed by a small table of per-region
+ * free counts (see frame_bitmap.c).
+ *
+ * When built with PM_BACKEND_BUDDY, the same location instead holds the
+ * per-frame order table of the buddy allocator (see buddy.c).
+ *
+ * The backends of every pool are stored back to back, followed by a 16
+ * byte PAGE_INFO per frame, which records who owns the frame (e.g. the size
+ * and callsite of kmalloc allocations).
  *
  * The minimum allocatable is 1 page (which is managed by the requesting process
- * after being allocated using the standard library). The total overhead,
- * assuming that one bit is used per entry is, around 2 MB assuming a total
- * memory size of 64 GB, or around half a 4KB page consumed.
+ * after being allocated using the standard library). The total overhead is
+ * mostly PAGE_INFO, around 256 MB assuming a total memory size of 64 GB
+ * (1/256 of memory), next to around 2 MB for the bitmap. All of it is
+ * stored in one place, so it must fit in a single usable memory map entry.
+ *
+ * numa_init must have run first, so that the pools can be split by node.
  *
  * @param req Request from Limine bootloader
  */
@@ -67,8 +183,16 @@ void pm_init(LIMINE_MEM_REQ req) {
       }
     }
 
-    /* Find a good location for the bitmap */
-    uint64_t bitmap_size = kmem.physical_limit / (PAGE_SIZE * PAGES_PER_BYTE);
+    /* Find a good location for the bitmap and the per-frame PAGE_INFO */
+    uint64_t num_pages = NUM_PAGES(kmem.physical_limit);
+    pm_split_pools(num_pages);
+    uint64_t info_offset = 0;
+    for (uint64_t i = 0; i < kmem.num_pools; i++) {
+        info_offset += pm_pool_storage_size(kmem.pools[i].num_pages);
+    }
+    info_offset = (info_offset + sizeof(PAGE_INFO) - 1) &
+                  ~(sizeof(PAGE_INFO) - 1);
+    uint64_t bitmap_size = info_offset + num_pages * sizeof(PAGE_INFO);
     for (uint64_t i = 0; i < res->entry_count; i++) {
       struct limine_memmap_entry *entry = res->entries[i];
 
@@ -84,11 +208,32 @@ void pm_init(LIMINE_MEM_REQ req) {
       }
     }
 
-    /* Zero out the memory to set as free */
-    memset(kmem.bitmap, 0, bitmap_size);
-    klogi("Physical Memory Bitmap Location: %x\n", kmem.bitmap);
+    if (!kmem.bitmap) {
+        kloge("PM INIT: No usable entry large enough for the bitmap!\n");
+        halt();
+    }
 
-    /* Populate the bitmap */
+    /* Every page starts out as used until the usable entries are freed */
+    kmem.bitmap_size = bitmap_size;
+    uint8_t *storage = kmem.bitmap;
+    for (uint64_t i = 0; i < kmem.num_pools; i++) {
+        PM_POOL *pool = &kmem.pools[i];
+        pm_pool_init(pool, storage, pool->first_page, pool->num_pages,
+                     pool->node, pool->zone);
+        storage += pm_pool_storage_size(pool->num_pages);
+    }
+    kmem.page_info = (PAGE_INFO *) (kmem.bitmap + info_offset);
+    memset(kmem.page_info, 0, num_pages * sizeof(PAGE_INFO));
+    klogi("Physical Memory Bitmap Location: %x (%s backend, %d pools)\n",
+          kmem.bitmap, PM_BACKEND_NAME, kmem.num_pools);
+
+    /*
+      Populate the bitmap. The storage itself is never freed, the buddy
+      backend writes free list links into the first frame of every free
+      block, which would land in the orders[] and PAGE_INFO arrays.
+    */
+    uint64_t storage_start = VIRT_TO_PHYS(kmem.bitmap);
+    uint64_t storage_end = storage_start + PAGE_ALIGN(bitmap_size);
     for (uint64_t i = 0; i < res->entry_count; i++) {
       struct limine_memmap_entry *entry = res->entries[i];
 
@@ -97,18 +242,60 @@ void pm_init(LIMINE_MEM_REQ req) {
       }
 
       /* TODO: Add non-aligned sections later to bitmap */
-      if (entry->type == LIMINE_MEMMAP_USABLE){
-        pm_free(entry->base, NUM_PAGES(entry->length));
+      if (entry->type != LIMINE_MEMMAP_USABLE) {
+        continue;
+      }
+      uint64_t start = entry->base;
+      uint64_t end = entry->base + NUM_PAGES(entry->length) * PAGE_SIZE;
+      if (start == storage_start) {
+        start = storage_end;
+      }
+      if (end > start) {
+        pm_free(start, (end - start) / PAGE_SIZE);
       }
     }
-
-    /* Mark bitmap as used memory */
-    pm_allocate(VIRT_TO_PHYS(kmem.bitmap), NUM_PAGES(bitmap_size));
+    pm_set_watermarks();
+    page_color_init();
     klogi("Printing usage info...\n");
     pm_used();
     klogi("INIT PM: finished...\n");
 }
 
+/**
+ * @brief Gives the memory map entries of a type, which pm_init left marked
+ *        as used, to the physical allocator
+ * @verbatim
+ * Only whole pages are freed, and like in pm_init the first MB is skipped.
+ * Whatever is kept in those entries must have been copied out first.
+ *
+ * @param req Memory map request
+ * @param type LIMINE_MEMMAP_* type of the entries to free
+ * @return uint64_t Number of bytes freed
+ */
+uint64_t pm_reclaim(LIMINE_MEM_REQ req, uint64_t type) {
+    LIMINE_MEM_RES *res = req.response;
+    uint64_t freed = 0;
+
+    for (uint64_t i = 0; res && i < res->entry_count; i++) {
+      struct limine_memmap_entry *entry = res->entries[i];
+
+      if (entry->type != type || entry->base + entry->length <= 0x100000) {
+        continue;
+      }
+
+      uint64_t start = PAGE_ALIGN(entry->base);
+      uint64_t end = (entry->base + entry->length) &
+                     ~((uint64_t) PAGE_SIZE - 1);
+      if (end <= start) {
+        continue;
+      }
+
+      pm_free(start, (end - start) / PAGE_SIZE);
+      freed += end - start;
+    }
+    return freed;
+}
+
 /**
  * @brief Helper function for printing out physical memory which is used.
  */
@@ -120,65 +307,338 @@ void pm_used() {
           kmem.physical_limit + MEM_VIRT_OFFSET,
           kmem.free_size / squared,
           (kmem.total_size - kmem.free_size) / squared);
+    for (uint64_t i = 0; i < kmem.num_pools; i++) {
+        pm_pool_print_stats(&kmem.pools[i], i);
+    }
+    for (uint8_t z = 0; z < PM_NUM_ZONES; z++) {
+        PM_ZONE *zone = &kmem.zones[z];
+        klogi("Zone %s: %d of %d MB free, watermarks min %d KB low %d KB, "
+              "fallbacks: %d\n", z == ZONE_DMA32 ? "DMA32" : "normal",
+              pm_zone_free(z) * PAGE_SIZE / squared,
+              zone->num_pages * PAGE_SIZE / squared,
+              zone->watermark_min * PAGE_SIZE / 1024,
+              zone->watermark_low * PAGE_SIZE / 1024, zone->fallbacks);
+    }
+    pm_numa_print_stats();
+    pm_magazine_print_stats();
+    zero_pool_print_stats();
+    page_color_print_stats();
+    compact_print_stats();
+}
+
+/**
+ * @brief Prints, for every NUMA node, how many allocations made on its
+ *        behalf were served by itself and how many by other nodes
+ * @note Allocations served by the magazines and the zero pool are not
+ *       counted, only their refills are
+ */
+void pm_numa_print_stats() {
+    for (uint32_t n = 0; n < numa_num_nodes(); n++) {
+        klogi("Node %d: local allocs: %d, remote allocs: %d\n", n,
+              kmem.local_allocs[n], kmem.remote_allocs[n]);
+    }
 }
 
 /**
- * @brief Sets bits int the physical memory bitmap
+ * @brief Gets the number of pools physical memory is split into
  *
- * @param address Starting address
- * @param num_pages Number of pages to allocate
+ * @return uint64_t Number of pools
  */
-static inline void bitmap_set(uint64_t address, uint64_t num_pages) {
-  for (uint64_t i = address; i < address + (num_pages * PAGE_SIZE);
-       i += PAGE_SIZE) {
-    /* Set the page to used by shifting over the number of pages */
-    kmem.bitmap[i / (PAGE_SIZE * PAGES_PER_BYTE)] &=
-              ~((1 << ((i / PAGE_SIZE) % PAGES_PER_BYTE)));
-  }
+uint64_t pm_num_pools() {
+    return kmem.num_pools;
 }
 
 /**
- * @brief Frees pages represented by the bitmap.
+ * @brief Gets a pool of the physical allocator, sorted by first frame
+ * @note The pool is not locked, only its layout is stable
  *
- * @param address Starting address
- * @param num_pages Number of pages requested to be freed
- * @return BITMAP_STATUS Returns ALLOCATED if allocated and FREE otherwise
+ * @param index Index of the pool, below pm_num_pools()
+ * @return PM_POOL * Pool
  */
-static inline BITMAP_STATUS bitmap_free(uint64_t address, uint64_t num_pages) {
-  for (uint64_t i = address; i < address + (num_pages * PAGE_SIZE);
-       i += PAGE_SIZE) {
-    if (!(kmem.bitmap[i / (PAGE_SIZE * PAGES_PER_BYTE)] &
-        (1 << ((i / PAGE_SIZE) % PAGES_PER_BYTE)))) {
-      return ALLOCATED;
+PM_POOL *pm_get_pool(uint64_t index) {
+    return &kmem.pools[index];
+}
+
+/**
+ * @brief Getter for the number of free bytes of physical memory
+ *
+ * @return uint64_t Free physical memory in bytes
+ */
+uint64_t pm_free_size() {
+    return kmem.free_size;
+}
+
+/**
+ * @brief Gets the NUMA node of the calling CPU
+ *
+ * @return uint32_t Node which allocations prefer by default
+ */
+static inline uint32_t pm_local_node() {
+    return this_cpu()->node;
+}
+
+/**
+ * @brief Gets the pool which contains a frame
+ *
+ * @param page Physical frame number
+ * @return PM_POOL * Pool of the frame, NULL if past the physical limit
+ */
+static inline PM_POOL *pm_pool_of(uint64_t page) {
+    for (uint64_t i = 0; i < kmem.num_pools; i++) {
+        if (page < PM_POOL_END(&kmem.pools[i])) {
+            return &kmem.pools[i];
+        }
     }
-  }
-  return FREE;
+    return NULL;
+}
+
+/**
+ * @brief Allocates from the pools of one zone, starting with a node and
+ *        falling back to the other nodes from nearest to farthest,
+ *        pm_lock must be held
+ * @note A run never spans two pools
+ *
+ * @param num_pages Number of pages
+ * @param min_page Lowest frame index which may be returned
+ * @param node Node the allocation is for
+ * @param zone Zone to allocate from
+ * @return uint64_t First frame, PM_NO_PAGE if not found
+ */
+static uint64_t pm_zone_alloc(uint64_t num_pages, uint64_t min_page,
+                              uint32_t node, uint8_t zone) {
+    for (uint32_t i = 0; i < numa_num_nodes(); i++) {
+        uint32_t target = numa_fallback(node, i);
+
+        for (uint64_t p = 0; p < kmem.num_pools; p++) {
+            if (kmem.pools[p].node != target || kmem.pools[p].zone != zone) {
+                continue;
+            }
+            uint64_t page = pm_pool_alloc(&kmem.pools[p], num_pages,
+                                          min_page);
+            if (page == PM_NO_PAGE) {
+                continue;
+            }
+
+            kmem.free_size -= num_pages * PAGE_SIZE;
+            if (target == node) {
+                kmem.local_allocs[node]++;
+            } else {
+                kmem.remote_allocs[node]++;
+            }
+            return page;
+        }
+    }
+    return PM_NO_PAGE;
+}
+
+/**
+ * @brief Allocates from the highest zone a request may use, pm_lock must
+ *        be held
+ * @verbatim
+ * Ordinary allocations come from ZONE_NORMAL, and only fall back to
+ * ZONE_DMA32 once every node is out of normal memory. Even then they stop
+ * at the DMA32 zone's minimum watermark, which is left for PM_DMA32
+ * requests. PM_DMA32 requests only ever use ZONE_DMA32.
+ *
+ * @param num_pages Number of pages
+ * @param min_page Lowest frame index which may be returned
+ * @param node Node the allocation is for
+ * @param flags Flags of pm_get, only PM_DMA32 is looked at
+ * @return uint64_t First frame, PM_NO_PAGE if not found
+ */
+static inline uint64_t pm_backend_alloc(uint64_t num_pages,
+                                        uint64_t min_page, uint32_t node,
+                                        uint64_t flags) {
+    int preferred = (flags & PM_DMA32) ? ZONE_DMA32 : ZONE_NORMAL;
+
+    for (int zone = preferred; zone >= ZONE_DMA32; zone--) {
+        uint64_t reserve = zone == preferred ? 0 :
+                           kmem.zones[zone].watermark_min;
+        if (pm_zone_free(zone) < num_pages + reserve) {
+            continue;
+        }
+
+        uint64_t page = pm_zone_alloc(num_pages, min_page, node, zone);
+        if (page != PM_NO_PAGE) {
+            if (zone != preferred) {
+                kmem.zones[zone].fallbacks++;
+            }
+            return page;
+        }
+    }
+    return PM_NO_PAGE;
+}
+
+/**
+ * @brief Frees to the pools a range falls in, pm_lock must be held
+ *
+ * @param page First frame
+ * @param num_pages Number of pages
+ * @return uint64_t Number of pages which were not already free
+ */
+static inline uint64_t pm_backend_free(uint64_t page, uint64_t num_pages) {
+    uint64_t end = page + num_pages;
+    uint64_t freed = 0;
+
+    for (PM_POOL *pool; page < end && (pool = pm_pool_of(page));) {
+        uint64_t count = end < PM_POOL_END(pool) ? end - page :
+                                                   PM_POOL_END(pool) - page;
+        freed += pm_pool_free(pool, page, count);
+        page += count;
+    }
+    kmem.free_size += freed * PAGE_SIZE;
+    return freed;
+}
+
+/**
+ * @brief Checks if a range of pages is free in the global allocator
+ * @note Pages cached in the per-CPU magazines count as used
+ *
+ * @param address Base address of the range
+ * @param num_pages Number of pages
+ * @return uint8_t TRUE if every page is free, FALSE otherwise
+ */
+uint8_t pm_test_free(uint64_t address, uint64_t num_pages) {
+    uint64_t page = address / PAGE_SIZE;
+    uint64_t end = page + num_pages;
+
+    while (page < end) {
+        PM_POOL *pool = pm_pool_of(page);
+        if (!pool) {
+            return FALSE;
+        }
+        uint64_t count = end < PM_POOL_END(pool) ? end - page :
+                                                   PM_POOL_END(pool) - page;
+        if (!pm_pool_test_free(pool, page, count)) {
+            return FALSE;
+        }
+        page += count;
+    }
+    return TRUE;
+}
+
+/**
+ * @brief Checks if the zone ordinary allocations are served from is below
+ *        its low watermark
+ * @verbatim
+ * Used by opportunistic users like the zero pool, which should not keep
+ * frames out of the allocator when memory is running low.
+ *
+ * @return uint8_t TRUE if under pressure, FALSE otherwise
+ */
+uint8_t pm_under_pressure() {
+    uint8_t zone = kmem.zones[ZONE_NORMAL].num_pages ? ZONE_NORMAL :
+                                                       ZONE_DMA32;
+    return pm_zone_free(zone) < kmem.zones[zone].watermark_low;
+}
+
+/**
+ * @brief Gets the NUMA node a physical address belongs to
+ *
+ * @param address Physical address
+ * @return uint32_t Node of the pool holding the frame, 0 if out of range
+ */
+uint32_t pm_page_node(uint64_t address) {
+    PM_POOL *pool = pm_pool_of(address / PAGE_SIZE);
+    return pool ? pool->node : 0;
+}
+
+/**
+ * @brief Gets the metadata of the frame containing a physical address
+ *
+ * @param address Physical address
+ * @return PAGE_INFO * Metadata of the frame, NULL if out of range
+ */
+PAGE_INFO *pm_page_info(uint64_t address) {
+    if (address >= kmem.physical_limit) {
+        return NULL;
+    }
+    return &kmem.page_info[address / PAGE_SIZE];
+}
+
+/**
+ * @brief Pushes a frame onto an intrusive frame list
+ *
+ * @param list List to push onto
+ * @param address Physical address of the frame
+ */
+void page_list_push(PAGE_LIST *list, uint64_t address) {
+    uint32_t pfn = address / PAGE_SIZE;
+    PAGE_INFO *info = &kmem.page_info[pfn];
+
+    info->prev = PAGE_LIST_END;
+    info->next = list->head;
+    if (list->head != PAGE_LIST_END) {
+        kmem.page_info[list->head].prev = pfn;
+    }
+    list->head = pfn;
+    list->count++;
+}
+
+/**
+ * @brief Unlinks a frame from an intrusive frame list
+ *
+ * @param list List the frame is on
+ * @param address Physical address of the frame
+ */
+void page_list_remove(PAGE_LIST *list, uint64_t address) {
+    PAGE_INFO *info = &kmem.page_info[address / PAGE_SIZE];
+
+    if (info->prev != PAGE_LIST_END) {
+        kmem.page_info[info->prev].next = info->next;
+    } else {
+        list->head = info->next;
+    }
+    if (info->next != PAGE_LIST_END) {
+        kmem.page_info[info->next].prev = info->prev;
+    }
+    info->next = PAGE_LIST_END;
+    info->prev = PAGE_LIST_END;
+    list->count--;
+}
+
+/**
+ * @brief Pops the first frame off an intrusive frame list
+ *
+ * @param list List to pop from
+ * @return uint64_t Physical address of the frame, 0 if the list is empty
+ */
+uint64_t page_list_pop(PAGE_LIST *list) {
+    if (list->head == PAGE_LIST_END) {
+        return 0;
+    }
+    uint64_t address = (uint64_t) list->head * PAGE_SIZE;
+    page_list_remove(list, address);
+    return address;
 }
 
 /**
  * @brief Sets the elements in the bitmap to free starting at some address
  *        for a requested number of pages.
+ * @verbatim
+ * Single pages are given to the per-CPU magazine of the calling CPU, which
+ * only gives them back to the global allocator in batches, unless they
+ * belong to another NUMA node or to ZONE_DMA32.
  *
  * @param address Base address to free from
  * @param num_pages number of physical pages to free
  * @return STATUS SYS_OK if okay, SYS_ERR if failure
  */
 STATUS pm_free(uint64_t address, uint64_t num_pages) {
-  STATUS ret = SYS_OK;
-  for (uint64_t i = address; i < address + (num_pages * PAGE_SIZE);
-      i += PAGE_SIZE) {
-    if (!bitmap_free(i, 1)) {
-      kmem.free_size += PAGE_SIZE;
-    } else {
-      /* Can be used to find double frees if a page is already free */
-      ret = SYS_ERR;
-    }
-
-    kmem.bitmap[i / (PAGE_SIZE * PAGES_PER_BYTE)] |=
-      1 << ((i / PAGE_SIZE) % PAGES_PER_BYTE);
+  /* Remote and DMA32 frames (when there is normal memory) skip the */
+  /* magazine, so it only ever hands out frames pm_get would prefer */
+  PM_POOL *pool = pm_pool_of(address / PAGE_SIZE);
+  if (num_pages == 1 && pool && pool->node == pm_local_node() &&
+      (pool->zone == ZONE_NORMAL || !kmem.zones[ZONE_NORMAL].num_pages)) {
+    return pm_magazine_put(address);
   }
 
-  return ret;
+  LOCK_LOCK(&pm_lock);
+  uint64_t freed = pm_backend_free(address / PAGE_SIZE, num_pages);
+  UNLOCK_LOCK(&pm_lock);
+
+  /* Can be used to find double frees if a page is already free */
+  return freed == num_pages ? SYS_OK : SYS_ERR;
 }
 
 /**
@@ -190,32 +650,82 @@ STATUS pm_free(uint64_t address, uint64_t num_pages) {
  * @return STATUS SYS_OK if okay, SYS_ERR if failure
  */
 STATUS pm_allocate(uint64_t address, uint64_t num_pages) {
-  if (!bitmap_free(address, num_pages)) {
-    return SYS_ERR;
+  STATUS ret = SYS_OK;
+  LOCK_LOCK(&pm_lock);
+  if (!pm_test_free(address, num_pages)) {
+    ret = SYS_ERR;
   }
 
-  bitmap_set(address, num_pages);
-  kmem.free_size -= num_pages * PAGE_SIZE;
-  return SYS_OK;
+  uint64_t page = address / PAGE_SIZE;
+  uint64_t end = page + num_pages;
+  while (ret == SYS_OK && page < end) {
+    PM_POOL *pool = pm_pool_of(page);
+    uint64_t count = end < PM_POOL_END(pool) ? end - page :
+                                               PM_POOL_END(pool) - page;
+    pm_pool_reserve(pool, page, count);
+    page += count;
+  }
+  if (ret == SYS_OK) {
+    kmem.free_size -= num_pages * PAGE_SIZE;
+  }
+  UNLOCK_LOCK(&pm_lock);
+  return ret;
 }
 
 /**
- * @brief Gets physical pages and returns the number allocated
+ * @brief Gets physical pages from a node, see pm_get
  *
- * @param num_pages number of pages which were initially allocated
- * @param address base address to where they were allocated
- * @param func function which is calling pm_get
- * @param line_number line number which is calling pm_get
- * @return uint64_t Address of page
+ * @param num_pages Number of pages
+ * @param min_page Lowest frame index which may be returned
+ * @param node Node to prefer, others are only used if it is out of memory
+ * @param flags PM_ZERO and PM_DMA32, see pm_get
+ * @param func Function which is calling pm_get
+ * @param line_number Line number which is calling pm_get
+ * @return uint64_t Address of the first page
  */
-uint64_t pm_get(uint64_t num_pages, uint64_t address, const char *func,
-                size_t line_number) {
-    for (uint64_t i = address; i < kmem.physical_limit; i += PAGE_SIZE) {
-        if (pm_allocate(i, num_pages) == SYS_OK) {
-            return i;
+static uint64_t pm_get_pages(uint64_t num_pages, uint64_t min_page,
+                             uint32_t node, uint64_t flags, const char *func,
+                             size_t line_number) {
+    uint64_t page = PM_NO_PAGE;
+
+    /* The zero pool and the magazine only hold local frames */
+    if (num_pages == 1 && !min_page && node == pm_local_node() &&
+        !(flags & PM_DMA32)) {
+        uint64_t frame = (flags & PM_ZERO) ? zero_pool_get() : 0;
+        if (frame) {
+            return frame;
+        }
+        frame = pm_magazine_get();
+        if (frame) {
+            page = frame / PAGE_SIZE;
         }
     }
 
+    if (page == PM_NO_PAGE) {
+        LOCK_LOCK(&pm_lock);
+        page = pm_backend_alloc(num_pages, min_page, node, flags);
+        UNLOCK_LOCK(&pm_lock);
+    }
+
+    /* Runs may only be split by cached frames, or by frames which move */
+    if (page == PM_NO_PAGE && num_pages > 1) {
+        if (compact_drain()) {
+            LOCK_LOCK(&pm_lock);
+            page = pm_backend_alloc(num_pages, min_page, node, flags);
+            UNLOCK_LOCK(&pm_lock);
+        }
+        if (page == PM_NO_PAGE) {
+            page = compact_alloc(num_pages, min_page, flags);
+        }
+    }
+
+    if (page != PM_NO_PAGE) {
+        if (flags & PM_ZERO) {
+            zero_pool_clear(page * PAGE_SIZE, num_pages);
+        }
+        return page * PAGE_SIZE;
+    }
+
    kloge("Out of physical memory\n");
    klogi("pm_get: %s:%d attempting to get %d pages from memory"
          "(%d bytes available)\n", func, line_number, num_pages, kmem.free_size);
@@ -228,167 +738,409 @@ uint64_t pm_get(uint64_t num_pages, uint64_t address, const char *func,
 }
 
 /**
- * @brief Maps a page entry to an address space
+ * @brief Gets physical pages and returns the number allocated
+ * @verbatim
+ * Pages come from the NUMA node of the calling CPU when it has any left.
+ * Single page requests without a base address are served from the per-CPU
+ * magazine of the calling CPU and never touch the global allocator unless
+ * the magazine needs refilling. With PM_ZERO they are served from the
+ * pool of frames zeroed while idle instead, and anything the pool cannot
+ * serve is cleared here.
  *
- * @param address_space Address apce to map entry to
- * @param virt_addr Virtual address of page entry
- * @param phys_addr Physical address of page entry
- * @param flags Virtual memory flags entry
+ * Pages come from ZONE_NORMAL unless it is exhausted, or PM_DMA32 asks for
+ * pages below 4 GB (see pm_backend_alloc). Runs of more than one page which
+ * can't be found are made by compacting memory (see compact.c) before
+ * giving up.
+ *
+ * @param num_pages number of pages which were initially allocated
+ * @param address base address to where they were allocated
+ * @param flags PM_ZERO if the pages must be zeroed, PM_DMA32 if they must
+ *        be below PM_DMA32_LIMIT
+ * @param func function which is calling pm_get
+ * @param line_number line number which is calling pm_get
+ * @return uint64_t Address of page
  */
-static void map_page_entry(ADDR_SPACE *address_space, uint64_t virt_addr,
-                           uint64_t phys_addr, uint64_t flags) {
-    ADDR_SPACE *addr_space = CONVERT_ADDR_SPACE(address_space);
+uint64_t pm_get(uint64_t num_pages, uint64_t address, uint64_t flags,
+                const char *func, size_t line_number) {
+    return pm_get_pages(num_pages, address / PAGE_SIZE, pm_local_node(),
+                        flags, func, line_number);
+}
 
-    uint16_t pte = (virt_addr >> 12) & 0x1FF;
-    uint16_t pde = (virt_addr >> 21) & 0x1FF;
-    uint16_t pdpe = (virt_addr >> 30) & 0x1FF;
-    uint16_t pml4e = (virt_addr >> 39) & 0x1FF;
+/**
+ * @brief Gets physical pages from a specific NUMA node
+ * @verbatim
+ * Falls back to the nearest other node when the node is out of memory, like
+ * pm_get does for the local node. Allocations from a remote node bypass the
+ * magazine and the zero pool.
+ *
+ * @param num_pages Number of pages
+ * @param node Node to allocate from
+ * @param flags PM_ZERO and PM_DMA32, see pm_get
+ * @param func Function which is calling pm_get_node
+ * @param line_number Line number which is calling pm_get_node
+ * @return uint64_t Address of the first page
+ */
+uint64_t pm_get_node(uint64_t num_pages, uint32_t node, uint64_t flags,
+                     const char *func, size_t line_number) {
+    if (node >= numa_num_nodes()) {
+        kloge("pm_get_node: %s:%d asked for unknown node %d\n", func,
+              line_number, node);
+        node = pm_local_node();
+    }
+    return pm_get_pages(num_pages, 0, node, flags, func, line_number);
+}
 
-    uint64_t *pml4 = addr_space->pml4;
-    uint64_t *pdpt;
-    uint64_t *pd;
-    uint64_t *pt;
+/**
+ * @brief Gets physically contiguous pages, without halting if there are none
+ * @verbatim
+ * For callers which have a fallback, e.g. vmalloc trying to back a 2 MB
+ * page before settling for single frames.
+ *
+ * @param num_pages Number of pages
+ * @return uint64_t Address of the first page, 0 if no run is free
+ */
+uint64_t pm_try_get(uint64_t num_pages) {
+    LOCK_LOCK(&pm_lock);
+    uint64_t page = pm_backend_alloc(num_pages, 0, pm_local_node(), 0);
+    UNLOCK_LOCK(&pm_lock);
+    return page == PM_NO_PAGE ? 0 : page * PAGE_SIZE;
+}
 
-    /* Set up levels of page */
-    pdpt = (uint64_t *) PHYS_TO_VIRT(pml4[pml4e] & ~(0xFFF));
-    if (CHECK_NOT_PRESENT(pml4[pml4e])) {
-        void *buffer = (void *) pm_get(DEFAULT_PAGES, 0x0, __func__, __LINE__);
-        if (!buffer) {
-            klogi("VM: Out of memory for PDPT of PML4 %x\n", pml4);
-            halt();
+/**
+ * @brief Takes a batch of single pages from the global allocator
+ *
+ * @param frames Buffer to store the physical addresses in
+ * @param count Number of pages wanted
+ * @return uint64_t Number of pages which were stored in frames
+ */
+uint64_t pm_get_frames(uint64_t *frames, uint64_t count) {
+    uint64_t got = 0;
+    uint32_t node = pm_local_node();
+    LOCK_LOCK(&pm_lock);
+    for (; got < count; got++) {
+        uint64_t page = pm_backend_alloc(1, 0, node, 0);
+        if (page == PM_NO_PAGE) {
+            break;
         }
-        pdpt = (uint64_t *) PHYS_TO_VIRT(buffer);
-        memset(pdpt, 0, PAGE_SIZE * DEFAULT_PAGES);
-        pml4[pml4e] = MAKE_TABLE_ENTRY(VIRT_TO_PHYS(pdpt), VM_USERMODE);
-        vector_append(&addr_space->memory_list, VIRT_TO_PHYS(pdpt));
+        frames[got] = page * PAGE_SIZE;
     }
+    UNLOCK_LOCK(&pm_lock);
+    return got;
+}
 
-    pd = (uint64_t *) PHYS_TO_VIRT(pdpt[pdpe] & ~(0xFFF));
-    if (CHECK_NOT_PRESENT(pdpt[pdpe])) {
-        void *buffer = (void *) pm_get(DEFAULT_PAGES, 0x0, __func__, __LINE__);
-        if (!buffer) {
-            klogi("VM: Out of memory for PD of PML4 %x\n", pml4);
-            halt();
+/**
+ * @brief Gives a batch of single pages back to the global allocator
+ *
+ * @param frames Physical addresses of the pages
+ * @param count Number of pages
+ */
+void pm_put_frames(uint64_t *frames, uint64_t count) {
+    LOCK_LOCK(&pm_lock);
+    for (uint64_t i = 0; i < count; i++) {
+        if (!pm_backend_free(frames[i] / PAGE_SIZE, 1)) {
+            kloge("PM: frame %x was freed twice\n", frames[i]);
         }
-        pd = (uint64_t *) PHYS_TO_VIRT(buffer);
-        memset(pd, 0, PAGE_SIZE * DEFAULT_PAGES);
-        pdpt[pdpe] = MAKE_TABLE_ENTRY(VIRT_TO_PHYS(pd), VM_USERMODE);
-        vector_append(&addr_space->memory_list, VIRT_TO_PHYS(pd));
     }
+    UNLOCK_LOCK(&pm_lock);
+}
 
-    pt = (uint64_t *) PHYS_TO_VIRT(pd[pde] & ~(0xFFF));
-    if (CHECK_NOT_PRESENT(pd[pde])) {
-        void *buffer = (void *) pm_get(DEFAULT_PAGES, 0x0, __func__, __LINE__);
-        if (!buffer) {
-            klogi("VM: Out of memory for PT of PML4 %x\n", pml4);
-            halt();
-        }
-        pt = (uint64_t *) PHYS_TO_VIRT(buffer);
-        memset(pt, 0, PAGE_SIZE * DEFAULT_PAGES);
-        pd[pde] = MAKE_TABLE_ENTRY(VIRT_TO_PHYS(pt), VM_USERMODE);
-        vector_append(&addr_space->memory_list, VIRT_TO_PHYS(pt));
-    }
+/**
+ * @brief Allocates a zeroed paging structure for an address space
+ *
+ * @param as Address space which will own the table
+ * @return uint64_t * Table, through the higher half direct map
+ */
+static uint64_t *vm_alloc_table(ADDR_SPACE *as) {
+    uint64_t phys = pgtable_alloc();
+    page_list_push(&as->tables, phys);
+    return (uint64_t *) PHYS_TO_VIRT(phys);
+}
 
-    pt[pte] = MAKE_TABLE_ENTRY(phys_addr & ~(0xFFF), flags);
+/**
+ * @brief Gets the number of present entries in a table
+ *
+ * @param table Paging structure
+ * @return uint16_t * Live entry count kept in the table's PAGE_INFO
+ */
+static inline uint16_t *vm_table_live(uint64_t *table) {
+    return &kmem.page_info[VIRT_TO_PHYS(table) / PAGE_SIZE].live_entries;
+}
 
-    uint64_t cr3_value = read_cr(cr3);
-    if (cr3_value == (uint64_t)(VIRT_TO_PHYS(addr_space->pml4))) {
-        __asm__ volatile ("invlpg (%0)" : : "r"(virt_addr));
+/**
+ * @brief Writes a paging structure entry, keeping the live entry count of
+ *        the table it is in up to date
+ *
+ * @param entry Entry to write
+ * @param value New value of the entry
+ */
+static inline void vm_set_entry(uint64_t *entry, uint64_t value) {
+    uint16_t *live = vm_table_live((uint64_t *) ((uint64_t) entry & ~(0xFFF)));
+    if (CHECK_PRESENT(value) && CHECK_NOT_PRESENT(*entry)) {
+        (*live)++;
+    } else if (CHECK_NOT_PRESENT(value) && CHECK_PRESENT(*entry)) {
+        (*live)--;
     }
+    *entry = value;
 }
 
 /**
- * @brief Unmaps a page entry from an address space
+ * @brief Gets the address space which owns the tables mapping an address
+ * @verbatim
+ * The kernel half of every PML4 points at the kernel's PDPTs, so changes to
+ * it are always made to (and accounted to) the kernel address space.
  *
- * @param addr_space Address space to unmap page from
- * @param virt_addr Virtual address of page entry
+ * @param as Address space, NULL for the kernel
+ * @param virt_addr Virtual address being changed
+ * @return ADDR_SPACE * Owning address space
  */
-static void unmap_page_entry(ADDR_SPACE *addr_space, uint64_t virt_addr) {
-    ADDR_SPACE *as = CONVERT_ADDR_SPACE(addr_space);
+static inline ADDR_SPACE *vm_owner(ADDR_SPACE *as, uint64_t virt_addr) {
+    if (!as || VM_IS_KERNEL_HALF(virt_addr)) {
+        return &kernel_addr_space;
+    }
+    return as;
+}
 
-    uint16_t pte = (virt_addr >> 12) & 0x1FF;
-    uint16_t pde = (virt_addr >> 21) & 0x1FF;
-    uint16_t pdpe = (virt_addr >> 30) & 0x1FF;
-    uint16_t pml4e = (virt_addr >> 39) & 0x1FF;
+/**
+ * @brief Frees a paging structure allocated with vm_alloc_table once the
+ *        current batch of invalidations has been flushed
+ *
+ * @param tlb Batch of the current change
+ * @param as Address space which owns the table
+ * @param table Table to free
+ */
+static void vm_free_table(TLB_GATHER *tlb, ADDR_SPACE *as, uint64_t *table) {
+    page_list_remove(&as->tables, VIRT_TO_PHYS(table));
+    tlb_gather_table(tlb, VIRT_TO_PHYS(table));
+}
 
-    uint64_t *pml4 = as->pml4;
-    if (CHECK_NOT_PRESENT(pml4[pml4e])) {
-        return;
+/**
+ * @brief Frees a table and every table below it
+ *
+ * @param tlb Batch of the current change
+ * @param as Address space which owns the table
+ * @param table Table to free
+ * @param level Level of the entries in table
+ */
+static void vm_free_subtree(TLB_GATHER *tlb, ADDR_SPACE *as, uint64_t *table,
+                            uint8_t level) {
+    if (level > VM_LEVEL_PT) {
+        for (size_t i = 0; i < PAGE_TABLE_ENTRIES; i++) {
+            if (CHECK_PRESENT(table[i]) && !(table[i] & VM_LARGE)) {
+                vm_free_subtree(tlb, as,
+                    (uint64_t *) PHYS_TO_VIRT(table[i] & PAGE_ADDR_MASK),
+                    level - 1);
+            }
+        }
     }
+    vm_free_table(tlb, as, table);
+}
 
-    uint64_t *pdpt = (uint64_t *) PHYS_TO_VIRT(pml4[pml4e] & ~(0x1FF));
-    if (CHECK_NOT_PRESENT(pdpt[pdpe])) {
-        return;
+/**
+ * @brief Converts 4 KB page flags into the flags of a leaf at a level
+ *
+ * @param flags Virtual memory flags
+ * @param level Level of the leaf
+ * @return uint64_t Flags for the leaf entry
+ */
+static inline uint64_t vm_leaf_flags(uint64_t flags, uint8_t level) {
+    if (level == VM_LEVEL_PT) {
+        return flags;
     }
-
-    uint64_t *pd = (uint64_t *) PHYS_TO_VIRT(pdpt[pdpe] & ~(0x1FF));
-    if (CHECK_NOT_PRESENT(pd[pde])) {
-        return;
+    /* Bit 7 is the page size bit above the PT, PAT moves to bit 12 */
+    if (flags & VM_PAT) {
+        flags = (flags & ~VM_PAT) | VM_LARGE_PAT;
     }
+    return flags | VM_LARGE;
+}
 
-    uint64_t *pt = (uint64_t *) PHYS_TO_VIRT(pd[pde] & ~(0x1FF));
-    if (CHECK_NOT_PRESENT(pt[pte])) {
-        return;
+/**
+ * @brief Converts the flags of a leaf at a level back into 4 KB page flags
+ *
+ * @param entry Leaf entry
+ * @param level Level of the leaf
+ * @return uint64_t Virtual memory flags
+ */
+static inline uint64_t vm_entry_flags(uint64_t entry, uint8_t level) {
+    uint64_t flags = entry & ~PAGE_ADDR_MASK;
+    if (level == VM_LEVEL_PT) {
+        return flags;
     }
-
-    pt[pte] = 0;
-
-    uint64_t cr3_val = read_cr(cr3);
-    if (cr3_val == (uint64_t)(VIRT_TO_PHYS(as->pml4))) {
-        __asm__ volatile("invlpg (%0)" : : "r"(virt_addr));
+    flags &= ~(VM_LARGE | VM_PAT);
+    if (entry & VM_LARGE_PAT) {
+        flags |= VM_PAT;
     }
+    return flags;
+}
 
-    pd[pde] = 0;
-    if (pm_free(VIRT_TO_PHYS(pt), DEFAULT_PAGES) == SYS_ERR) {
-        klogi("VM: Failed to free pt\n");
-        halt();
+/**
+ * @brief Finds the leaf entry which maps a virtual address
+ *
+ * @param as Address space to search
+ * @param virt_addr Virtual address
+ * @param level Returns the level of the leaf, or the level of the entry
+ *              which was not present
+ * @return uint64_t * Leaf entry, NULL if the address is not mapped
+ */
+static uint64_t *vm_lookup(ADDR_SPACE *as, uint64_t virt_addr,
+                           uint8_t *level) {
+    uint64_t *table = as->pml4;
+
+    for (uint8_t l = VM_LEVEL_PML4; ; l--) {
+        uint64_t *entry = &table[VM_LEVEL_INDEX(virt_addr, l)];
+        *level = l;
+        if (CHECK_NOT_PRESENT(*entry)) {
+            return NULL;
+        }
+        if (l == VM_LEVEL_PT ||
+            (l <= VM_LEVEL_PDPT && (*entry & VM_LARGE))) {
+            return entry;
+        }
+        table = (uint64_t *) PHYS_TO_VIRT(*entry & PAGE_ADDR_MASK);
     }
+}
 
-    size_t i;
-    for (i = 0; i < vector_len(&as->memory_list); i++) {
-        if (vector_at(&as->memory_list, i) == VIRT_TO_PHYS(pt)) {
-            vector_erase(&as->memory_list, i);
-            break;
-        }
+/**
+ * @brief Splits a large leaf into a table of leaves one level down which
+ *        map the same memory with the same flags
+ *
+ * @param tlb Batch of the current change
+ * @param as Address space of the leaf
+ * @param entry Large leaf entry
+ * @param level Level of the leaf
+ * @param virt_addr Any virtual address inside the large page
+ */
+static void vm_split(TLB_GATHER *tlb, ADDR_SPACE *as, uint64_t *entry,
+                     uint8_t level, uint64_t virt_addr) {
+    uint64_t *table = vm_alloc_table(as);
+    uint64_t base = VM_LEVEL_ADDR(*entry, level);
+    uint64_t flags = vm_leaf_flags(vm_entry_flags(*entry, level), level - 1);
+    uint64_t step = VM_LEVEL_SIZE(level - 1);
+
+    for (size_t i = 0; i < PAGE_TABLE_ENTRIES; i++) {
+        table[i] = (base + i * step) | flags;
     }
+    *vm_table_live(table) = PAGE_TABLE_ENTRIES;
 
-    for (i = 0; i < PAGE_SIZE; i++) {
-        if (pd[i] != 0) {
-            return;
+    *entry = MAKE_TABLE_ENTRY(VIRT_TO_PHYS(table), VM_USERMODE);
+    tlb_gather_page(tlb, virt_addr);
+}
+
+/**
+ * @brief Gets the entry at a level which maps a virtual address, creating
+ *        tables and splitting large leaves on the way down
+ *
+ * @param tlb Batch of the current change
+ * @param as Address space to walk
+ * @param virt_addr Virtual address
+ * @param level Level of the wanted entry
+ * @return uint64_t * Entry at level
+ */
+static uint64_t *vm_walk(TLB_GATHER *tlb, ADDR_SPACE *as, uint64_t virt_addr,
+                         uint8_t level) {
+    uint64_t *table = as->pml4;
+
+    for (uint8_t l = VM_LEVEL_PML4; l > level; l--) {
+        uint64_t *entry = &table[VM_LEVEL_INDEX(virt_addr, l)];
+        if (CHECK_NOT_PRESENT(*entry)) {
+            uint64_t *child = vm_alloc_table(as);
+            vm_set_entry(entry, MAKE_TABLE_ENTRY(VIRT_TO_PHYS(child),
+                                                 VM_USERMODE));
+        } else if (l <= VM_LEVEL_PDPT && (*entry & VM_LARGE)) {
+            vm_split(tlb, as, entry, l, virt_addr);
         }
+        table = (uint64_t *) PHYS_TO_VIRT(*entry & PAGE_ADDR_MASK);
     }
+    return &table[VM_LEVEL_INDEX(virt_addr, level)];
+}
 
-    pdpt[pdpe] = 0;
-    if (pm_free(VIRT_TO_PHYS(pd), DEFAULT_PAGES) == SYS_ERR) {
-        klogi("VM: Failed to free pd\n");
-        halt();
+/**
+ * @brief Frees the tables above a cleared entry which have become empty
+ * @verbatim
+ * Emptiness is checked with the live entry count of each table, so this is
+ * O(1) per level instead of a scan of the table.
+ *
+ * @param tlb Batch of the current change
+ * @param as Address space which was modified
+ * @param virt_addr Virtual address of the cleared entry
+ * @param level Level of the cleared entry
+ */
+static void vm_release_tables(TLB_GATHER *tlb, ADDR_SPACE *as,
+                              uint64_t virt_addr, uint8_t level) {
+    uint64_t *entries[VM_LEVEL_PML4 + 1];
+    uint64_t *table = as->pml4;
+
+    for (uint8_t l = VM_LEVEL_PML4; l >= level; l--) {
+        entries[l] = &table[VM_LEVEL_INDEX(virt_addr, l)];
+        table = (uint64_t *) PHYS_TO_VIRT(*entries[l] & PAGE_ADDR_MASK);
     }
 
-    for (i = 0; i < vector_len(&as->memory_list); i++) {
-        if (vector_at(&as->memory_list, i) == VIRT_TO_PHYS(pd)) {
-            vector_erase(&as->memory_list, i);
-            break;
+    /* The PML4 itself is never freed, nor are the shared kernel PDPTs */
+    uint8_t top = VM_IS_KERNEL_HALF(virt_addr) ? VM_LEVEL_PDPT : VM_LEVEL_PML4;
+    for (uint8_t l = level; l < top; l++) {
+        uint64_t *t = (uint64_t *) ((uint64_t) entries[l] & ~(0xFFF));
+        if (*vm_table_live(t)) {
+            return;
         }
+        vm_set_entry(entries[l + 1], 0);
+        vm_free_table(tlb, as, t);
     }
+}
 
-    for (i = 0; i < PAGE_SIZE; i++) {
-        if (pdpt[i] != 0) {
+/**
+ * @brief Maps a page entry to an address space
+ * @verbatim
+ * A leaf above the PT maps a 2 MB (PD) or 1 GB (PDPT) page. If the address
+ * is already mapped by a larger leaf with the same physical address and
+ * flags, nothing is done instead of splitting that leaf.
+ *
+ * Only entries which were present before need invalidating, x86 never
+ * caches translations of entries which are not present.
+ *
+ * @param tlb Batch of the current change
+ * @param address_space Address apce to map entry to
+ * @param virt_addr Virtual address of page entry
+ * @param phys_addr Physical address of page entry
+ * @param flags Virtual memory flags entry
+ * @param level Level of the leaf to create
+ */
+static void map_page_entry(TLB_GATHER *tlb, ADDR_SPACE *address_space,
+                           uint64_t virt_addr, uint64_t phys_addr,
+                           uint64_t flags, uint8_t level) {
+    ADDR_SPACE *addr_space = vm_owner(address_space, virt_addr);
+
+    uint8_t cur_level;
+    uint64_t *leaf = vm_lookup(addr_space, virt_addr, &cur_level);
+    if (leaf && cur_level > level) {
+        uint64_t offset = virt_addr & (VM_LEVEL_SIZE(cur_level) - 1);
+        if (VM_LEVEL_ADDR(*leaf, cur_level) + offset == phys_addr &&
+            (vm_entry_flags(*leaf, cur_level) & VM_FLAGS_MASK) ==
+            (flags & VM_FLAGS_MASK)) {
             return;
         }
     }
 
-    pml4[pml4e] = 0;
-    if (pm_free(VIRT_TO_PHYS(pdpt), DEFAULT_PAGES) == SYS_ERR) {
-        klogi("VM: Failed to free pdpt\n");
-        halt();
-    }
+    uint64_t *entry = vm_walk(tlb, addr_space, virt_addr, level);
 
-    for (i = 0; i < vector_len(&as->memory_list); i++) {
-        if (vector_at(&as->memory_list, i) == VIRT_TO_PHYS(pdpt)) {
-            vector_erase(&as->memory_list, i);
-            break;
+    if (CHECK_PRESENT(*entry)) {
+        if (level > VM_LEVEL_PT && !(*entry & VM_LARGE)) {
+            /* A large leaf replaces whatever tables were mapping the range */
+            vm_free_subtree(tlb, addr_space,
+                            (uint64_t *) PHYS_TO_VIRT(*entry & PAGE_ADDR_MASK),
+                            level - 1);
+            tlb_gather_range(tlb, virt_addr, VM_LEVEL_SIZE(level));
+        } else {
+            tlb_gather_page(tlb, virt_addr);
         }
     }
+
+    /* Kernel half mappings are the same everywhere, keep them across CR3 */
+    if (vm_global_pages && VM_IS_KERNEL_HALF(virt_addr)) {
+        flags |= VM_GLOBAL;
+    }
+
+    vm_set_entry(entry, (phys_addr & PAGE_ADDR_MASK) |
+                        vm_leaf_flags(flags, level));
+    vm_leaves[level]++;
 }
 
 /**
@@ -401,81 +1153,505 @@ static void unmap_page_entry(ADDR_SPACE *addr_space, uint64_t virt_addr) {
 uint64_t vm_get_phys_addr(ADDR_SPACE *addr_space, uint64_t virt_addr) {
     ADDR_SPACE *as = CONVERT_ADDR_SPACE(addr_space);
 
-    uint16_t pte = (virt_addr >> 12) & 0x1FF;
-    uint16_t pde = (virt_addr >> 21) & 0x1FF;
-    uint16_t pdpe = (virt_addr >> 30) & 0x1FF;
-    uint16_t pml4e = (virt_addr >> 39) & 0x1FF;
-
-    uint64_t *pml4 = as->pml4;
-    if (CHECK_NOT_PRESENT(pml4[pml4e])) {
-        return (uint64_t) NULL;
-    }
-
-    uint64_t *pdpt = (uint64_t *) PHYS_TO_VIRT(pml4[pml4e] & ~(0x1FF));
-    if (CHECK_NOT_PRESENT(pdpt[pdpe])) {
-        return (uint64_t) NULL;
-    }
-
-    uint64_t *pd = (uint64_t *) PHYS_TO_VIRT(pdpt[pdpe] & ~(0x1FF));
-    if (CHECK_NOT_PRESENT(pd[pte])) {
+    uint8_t level;
+    uint64_t *leaf = vm_lookup(as, virt_addr, &level);
+    if (!leaf) {
         return (uint64_t) NULL;
     }
 
-    uint64_t *pt = (uint64_t *) PHYS_TO_VIRT(pd[pde] & ~(0x1FF));
-    if (CHECK_NOT_PRESENT(pt[pte])) {
-        return (uint64_t) NULL;
-    }
-
-    return (pt[pte] & 0xFFFFFFFFFFFFF000);
+    /* Page granular, as for 4 KB leaves */
+    uint64_t offset = virt_addr & (VM_LEVEL_SIZE(level) - 1) & ~(0xFFF);
+    return VM_LEVEL_ADDR(*leaf, level) + offset;
 }
 
 /**
  * @brief Unmaps a page from an address space
+ * @verbatim
+ * Large pages which are only partially covered by the range are split
+ * first, so that the rest of the large page stays mapped. The TLB is
+ * flushed once, after every page has been unmapped.
  *
  * @param addr_space Address space to unmap page from
  * @param virt_addr Virtual address of the first page to unmap
  * @param num_pages Number of pages to unmap
  */
 void vm_unmap(ADDR_SPACE *addr_space, uint64_t virt_addr, uint64_t num_pages) {
-    if (!addr_space) {
-        /* Have to unmap the corresponding virtual address */
-        size_t len = vector_len(&global_mem_map);
-        for (size_t i = 0; i < len; i++) {
-            if (vector_at(&global_mem_map, i).virt_addr == virt_addr) {
-                vector_erase(&global_mem_map, i)
-                break;
-            }
+    uint64_t end = virt_addr + num_pages * PAGE_SIZE;
+    ADDR_SPACE *target = CONVERT_ADDR_SPACE(addr_space);
+    TLB_GATHER tlb;
+    tlb_gather_init(&tlb, target);
+
+    while (virt_addr < end) {
+        ADDR_SPACE *as = vm_owner(addr_space, virt_addr);
+        uint8_t level;
+        uint64_t *leaf = vm_lookup(as, virt_addr, &level);
+        uint64_t size = VM_LEVEL_SIZE(level);
+        uint64_t next = (virt_addr & ~(size - 1)) + size;
+
+        if (!leaf) {
+            /* Nothing is mapped up to the end of the missing entry */
+            virt_addr = next;
+            continue;
+        }
+
+        if (level > VM_LEVEL_PT &&
+            ((virt_addr & (size - 1)) || next > end)) {
+            vm_split(&tlb, as, leaf, level, virt_addr);
+            continue;
         }
+
+        vm_set_entry(leaf, 0);
+        tlb_gather_page(&tlb, virt_addr);
+        vm_release_tables(&tlb, as, virt_addr, level);
+        virt_addr = next;
+    }
+
+    tlb_gather_finish(&tlb);
+}
+
+/**
+ * @brief Moves the frame behind a 4 KB page of the kernel half to another
+ *        frame, the kernel address space lock must be held
+ * @verbatim
+ * The page is unmapped and flushed before its contents are copied, so no
+ * write can land in the old frame after the copy. An access in between
+ * faults, and vm_handle_fault waits on the lock until the page is back.
+ *
+ * @param virt_addr Virtual address of the page
+ * @param old_phys Frame the page must currently be mapped to
+ * @param new_phys Frame to move the page to
+ * @return STATUS SYS_OK if moved, SYS_ERR if virt_addr is not mapped to
+ *         old_phys by a 4 KB leaf
+ */
+STATUS vm_migrate_page(uint64_t virt_addr, uint64_t old_phys,
+                       uint64_t new_phys) {
+    ADDR_SPACE *as = &kernel_addr_space;
+    uint8_t level;
+    uint64_t *leaf = vm_lookup(as, virt_addr, &level);
+    if (!leaf || level != VM_LEVEL_PT ||
+        (*leaf & PAGE_ADDR_MASK) != old_phys) {
+        return SYS_ERR;
     }
 
-    for (size_t i = 0; i < num_pages * PAGE_SIZE; i += PAGE_SIZE) {
-        unmap_page_entry(addr_space, virt_addr + i);
+    uint64_t flags = *leaf & ~PAGE_ADDR_MASK;
+    TLB_GATHER tlb;
+    tlb_gather_init(&tlb, as);
+    vm_set_entry(leaf, 0);
+    tlb_gather_page(&tlb, virt_addr);
+    tlb_gather_finish(&tlb);
+
+    page_copy_nt((void *) PHYS_TO_VIRT(new_phys),
+                 (void *) PHYS_TO_VIRT(old_phys));
+    vm_set_entry(leaf, new_phys | flags);
+    return SYS_OK;
+}
+
+/**
+ * @brief Picks the largest page which can map the start of a range
+ *
+ * @param virt_addr Virtual address of the range
+ * @param phys_addr Physical address of the range
+ * @param length Bytes left in the range
+ * @return uint8_t Level of the leaf to use
+ */
+static uint8_t vm_pick_level(uint64_t virt_addr, uint64_t phys_addr,
+                             uint64_t length) {
+    uint64_t align = virt_addr | phys_addr;
+    if (vm_gb_pages && !(align & (PAGE_SIZE_1G - 1)) &&
+        length >= PAGE_SIZE_1G) {
+        return VM_LEVEL_PDPT;
+    }
+    if (!(align & (PAGE_SIZE_2M - 1)) && length >= PAGE_SIZE_2M) {
+        return VM_LEVEL_PD;
     }
+    return VM_LEVEL_PT;
 }
 
 /**
  * @brief Maps a number of pages to an address space
+ * @verbatim
+ * 2 MB pages, and 1 GB pages when the CPU supports them, are used wherever
+ * the virtual and physical addresses are aligned and the range is long
+ * enough. Nothing is recorded in the address space's VMA tree, use
+ * vm_map_region for that.
  *
  * @param addr_space Address space to map pages to
  * @param virt_addr Virtual address of the pages
  * @param phys_addr Physical address of the pages
- * @param num_pages Number of pages to map
+ * @param num_pages Number of 4 KB pages to map
  * @param flags Flags of the pages to map
  */
 void vm_map(ADDR_SPACE *addr_space, uint64_t virt_addr, uint64_t phys_addr,
             uint64_t num_pages, uint64_t flags) {
-    if (!addr_space) {
-        MEM_MAP m = {
-            .virt_addr = virt_addr,
-            .phys_addr = phys_addr,
-            .flags = flags,
-            .num_pages = num_pages
-        };
-        vector_append(&global_mem_map, m);
+    uint64_t length = num_pages * PAGE_SIZE;
+    uint64_t offset = 0;
+    ADDR_SPACE *target = CONVERT_ADDR_SPACE(addr_space);
+    TLB_GATHER tlb;
+    tlb_gather_init(&tlb, target);
+
+    while (offset < length) {
+        uint8_t level = vm_pick_level(virt_addr + offset, phys_addr + offset,
+                                      length - offset);
+        map_page_entry(&tlb, addr_space, virt_addr + offset,
+                       phys_addr + offset, flags, level);
+        offset += VM_LEVEL_SIZE(level);
+    }
+
+    tlb_gather_finish(&tlb);
+}
+
+/**
+ * @brief Records an area in the VMA tree of its owner, the owner's lock
+ *        must be held
+ *
+ * @param as Address space which owns the area
+ * @param name Name of the area, must have static storage
+ * @param virt_addr Virtual address of the area
+ * @param phys_addr Physical address mapped at virt_addr
+ * @param num_pages Number of 4 KB pages in the area
+ * @param flags Flags the area is mapped with
+ * @return VMA * New area, NULL if it overlaps an existing one
+ */
+static VMA *vm_insert_region(ADDR_SPACE *as, const char *name,
+                             uint64_t virt_addr, uint64_t phys_addr,
+                             uint64_t num_pages, uint64_t flags) {
+    VMA *vma = kmalloc(sizeof(VMA));
+    if (!vma) {
+        return NULL;
+    }
+
+    vma->start = virt_addr;
+    vma->end = virt_addr + num_pages * PAGE_SIZE;
+    vma->phys_addr = phys_addr;
+    vma->flags = flags;
+    vma->name = name;
+    vma->type = VMA_TYPE_FIXED;
+
+    if (vma_insert(&as->vmas, vma) != SYS_OK) {
+        kfree(vma);
+        return NULL;
+    }
+    return vma;
+}
+
+/**
+ * @brief Maps a physically contiguous area and records it in the VMA tree
+ *        of the address space
+ * @verbatim
+ * Areas in the kernel half are recorded in the kernel address space, since
+ * that half is shared by every address space.
+ *
+ * @param addr_space Address space to map the area to, NULL for the kernel
+ * @param name Name of the area, must have static storage
+ * @param virt_addr Page aligned virtual address of the area
+ * @param phys_addr Physical address to map at virt_addr
+ * @param num_pages Number of 4 KB pages to map
+ * @param flags Flags of the pages to map
+ * @return VMA * New area, NULL if it overlaps an existing area (in which
+ *         case nothing is mapped)
+ */
+VMA *vm_map_region(ADDR_SPACE *addr_space, const char *name,
+                   uint64_t virt_addr, uint64_t phys_addr, uint64_t num_pages,
+                   uint64_t flags) {
+    ADDR_SPACE *as = vm_owner(addr_space, virt_addr);
+
+    LOCK_LOCK(&as->lock);
+    VMA *vma = vm_insert_region(as, name, virt_addr, phys_addr, num_pages,
+                                flags);
+    UNLOCK_LOCK(&as->lock);
+
+    if (vma) {
+        vm_map(addr_space, virt_addr, phys_addr, num_pages, flags);
+    }
+    return vma;
+}
+
+/**
+ * @brief Maps device memory into a free part of the kernel area
+ * @verbatim
+ * The direct map only has device memory which the memory map lists as
+ * reserved, and maps it with the same VM_MMIO flags, so device memory is
+ * never mapped twice with different cache types.
+ *
+ * @param name Name of the device, must have static storage
+ * @param phys_addr Physical address of the registers, need not be aligned
+ * @param size Number of bytes to map
+ * @return uint64_t Virtual address of phys_addr, 0 if the area is full
+ */
+uint64_t vm_map_mmio(const char *name, uint64_t phys_addr, uint64_t size) {
+    uint64_t offset = phys_addr & (PAGE_SIZE - 1);
+    uint64_t num_pages = NUM_PAGES(offset + size);
+    ADDR_SPACE *as = &kernel_addr_space;
+
+    LOCK_LOCK(&as->lock);
+    uint64_t virt_addr = vma_find_gap(&as->vmas, VM_KERNEL_AREA_START,
+                                      VM_VMALLOC_START,
+                                      num_pages * PAGE_SIZE, PAGE_SIZE);
+    VMA *vma = NULL;
+    if (virt_addr != VMA_NO_GAP) {
+        vma = vm_insert_region(as, name, virt_addr, phys_addr - offset,
+                               num_pages, VM_MMIO);
     }
+    UNLOCK_LOCK(&as->lock);
 
-    for (size_t i = 0; i < num_pages * PAGE_SIZE; i += PAGE_SIZE) {
-        map_page_entry(addr_space, virt_addr + i, phys_addr + i, flags);
+    if (!vma) {
+        kloge("VM: No room to map %s (%d bytes)\n", name, size);
+        return 0;
+    }
+
+    vm_map(NULL, virt_addr, phys_addr - offset, num_pages, VM_MMIO);
+    return virt_addr + offset;
+}
+
+/**
+ * @brief Records an area of the vmalloc window without mapping anything
+ * @verbatim
+ * The area is followed by an unmapped guard page, so running off its end
+ * faults instead of touching the next area. The guard page is part of the
+ * recorded area, so nothing else is ever placed there.
+ *
+ * @param name Name of the area, must have static storage
+ * @param size Number of bytes the area must hold
+ * @param align Alignment of the start of the area
+ * @param type VMA_TYPE_DEMAND or VMA_TYPE_VMALLOC
+ * @param flags Flags the pages are mapped with
+ * @return VMA * New area, NULL if the window is full
+ */
+VMA *vm_alloc_area(const char *name, uint64_t size, uint64_t align,
+                   uint8_t type, uint64_t flags) {
+    uint64_t num_pages = NUM_PAGES(size) + 1;
+    ADDR_SPACE *as = &kernel_addr_space;
+
+    if (!size) {
+        return NULL;
+    }
+
+    LOCK_LOCK(&as->lock);
+    uint64_t virt_addr = vma_find_gap(&as->vmas, VM_VMALLOC_START,
+                                      VM_VMALLOC_END, num_pages * PAGE_SIZE,
+                                      align);
+    VMA *vma = NULL;
+    if (virt_addr != VMA_NO_GAP) {
+        vma = vm_insert_region(as, name, virt_addr, 0, num_pages, flags);
+    }
+    if (vma) {
+        vma->type = type;
+    }
+    UNLOCK_LOCK(&as->lock);
+
+    if (!vma) {
+        kloge("VM: No room to reserve %s (%d bytes)\n", name, size);
+    }
+    return vma;
+}
+
+/**
+ * @brief Reserves part of the kernel area which is only backed once it is
+ *        touched
+ * @verbatim
+ * Nothing is mapped here. The first access to each page faults, and
+ * vm_handle_fault backs it with a zeroed frame, so the untouched part of a
+ * large buffer never takes up physical memory. Release it with
+ * vm_unmap_region.
+ *
+ * @param name Name of the area, must have static storage
+ * @param size Number of bytes to reserve
+ * @param flags Flags the pages are mapped with once touched
+ * @return void * Start of the area, NULL if the kernel area is full
+ */
+void *vm_reserve(const char *name, uint64_t size, uint64_t flags) {
+    VMA *vma = vm_alloc_area(name, size, PAGE_SIZE, VMA_TYPE_DEMAND, flags);
+    return vma ? (void *) vma->start : NULL;
+}
+
+/**
+ * @brief Backs the page of a reserved area which an access faulted on
+ * @verbatim
+ * Addresses in the lower half are looked up in the address space loaded on
+ * this CPU. Only accesses to pages which are not present are resolved here,
+ * protection violations are left to the caller.
+ *
+ * @param virt_addr Address the access faulted on (CR2)
+ * @param error_code Error code pushed by the page fault
+ * @return STATUS SYS_OK if the page is now mapped, SYS_ERR otherwise
+ */
+STATUS vm_handle_fault(uint64_t virt_addr, uint64_t error_code) {
+    ADDR_SPACE *as = VM_IS_KERNEL_HALF(virt_addr) ? NULL :
+                     this_cpu()->addr_space;
+    uint64_t page = virt_addr & ~((uint64_t) PAGE_SIZE - 1);
+    STATUS status = SYS_ERR;
+
+    if (error_code & (PF_PRESENT | PF_RESERVED)) {
+        return SYS_ERR;
+    }
+
+    as = vm_owner(as, virt_addr);
+    LOCK_LOCK(&as->lock);
+    VMA *vma = vma_find(&as->vmas, virt_addr);
+
+    if (vma && vma->type != VMA_TYPE_FIXED && vm_get_phys_addr(as, page)) {
+        /* Another CPU backed the page, or compaction moved it, meanwhile */
+        status = SYS_OK;
+    } else if (vma && vma->type == VMA_TYPE_DEMAND &&
+               page + PAGE_SIZE < vma->end) {
+        /* The last page of a reserved area is its guard page */
+        uint64_t phys = pm_get(1, 0x0, PM_ZERO, __func__, __LINE__);
+        vm_map(as, page, phys, 1, vma->flags);
+        compact_set_movable(phys, page);
+        status = SYS_OK;
+    }
+    UNLOCK_LOCK(&as->lock);
+    return status;
+}
+
+/**
+ * @brief Finds the recorded area which contains an address
+ *
+ * @param addr_space Address space to search, NULL for the kernel
+ * @param virt_addr Virtual address
+ * @return VMA * Area, NULL if the address is not in a recorded area
+ */
+VMA *vm_find_region(ADDR_SPACE *addr_space, uint64_t virt_addr) {
+    ADDR_SPACE *as = vm_owner(addr_space, virt_addr);
+
+    LOCK_LOCK(&as->lock);
+    VMA *vma = vma_find(&as->vmas, virt_addr);
+    UNLOCK_LOCK(&as->lock);
+    return vma;
+}
+
+/**
+ * @brief Unmaps the pages of a DEMAND or VMALLOC area and frees their
+ *        frames
+ * @verbatim
+ * A frame may only go back to the allocator once no TLB can still reach it
+ * through the area, so the pages are unmapped and flushed first. The frames
+ * are collected as physically contiguous runs beforehand, at most
+ * VM_UNMAP_RUNS at a time, so a large area is handled in pieces.
+ *
+ * @param as Owner of the area
+ * @param start First page of the area
+ * @param end Address after the last page of the area
+ */
+static void vm_unmap_free(ADDR_SPACE *as, uint64_t start, uint64_t end) {
+    uint64_t runs[VM_UNMAP_RUNS];
+    uint64_t run_pages[VM_UNMAP_RUNS];
+    uint64_t page = start;
+
+    while (page < end) {
+        uint64_t piece = page;
+        uint64_t count = 0;
+        for (; page < end; page += PAGE_SIZE) {
+            uint64_t phys = vm_get_phys_addr(as, page);
+            if (!phys) {
+                continue;
+            }
+            if (count && phys == runs[count - 1] +
+                                 run_pages[count - 1] * PAGE_SIZE) {
+                run_pages[count - 1]++;
+                continue;
+            }
+            if (count == VM_UNMAP_RUNS) {
+                break;
+            }
+            runs[count] = phys;
+            run_pages[count++] = 1;
+        }
+
+        vm_unmap(as, piece, (page - piece) / PAGE_SIZE);
+        for (uint64_t i = 0; i < count; i++) {
+            for (uint64_t j = 0; j < run_pages[i]; j++) {
+                compact_clear_movable(runs[i] + j * PAGE_SIZE);
+            }
+            pm_free(runs[i], run_pages[i]);
+        }
+    }
+}
+
+/**
+ * @brief Unmaps a whole area mapped with vm_map_region or vm_map_mmio
+ * @verbatim
+ * The frames of areas made with vm_alloc_area (vm_reserve and vmalloc)
+ * belong to the area, so they are freed as well once they are unmapped,
+ * see vm_unmap_free.
+ *
+ * @param addr_space Address space of the area, NULL for the kernel
+ * @param virt_addr Any address inside the area
+ * @return STATUS SYS_OK if unmapped, SYS_ERR if there is no such area
+ */
+STATUS vm_unmap_region(ADDR_SPACE *addr_space, uint64_t virt_addr) {
+    ADDR_SPACE *as = vm_owner(addr_space, virt_addr);
+
+    LOCK_LOCK(&as->lock);
+    VMA *vma = vma_find(&as->vmas, virt_addr);
+    if (vma) {
+        vma_remove(&as->vmas, vma);
+    }
+    UNLOCK_LOCK(&as->lock);
+
+    if (!vma) {
+        return SYS_ERR;
+    }
+    if (vma->type == VMA_TYPE_FIXED) {
+        vm_unmap(addr_space, vma->start, (vma->end - vma->start) / PAGE_SIZE);
+    } else {
+        vm_unmap_free(as, vma->start, vma->end);
+    }
+    kfree(vma);
+    return SYS_OK;
+}
+
+/**
+ * @brief Prints the recorded areas of an address space
+ *
+ * @param addr_space Address space, NULL for the kernel
+ */
+void vm_print_regions(ADDR_SPACE *addr_space) {
+    ADDR_SPACE *as = CONVERT_ADDR_SPACE(addr_space);
+
+    LOCK_LOCK(&as->lock);
+    klogi("VM: %d areas\n", as->vmas.count);
+    for (VMA *vma = vma_first(&as->vmas); vma; vma = vma_next(vma)) {
+        klogi("\t%x - %x -> %x (%d KB) %s%s\n", vma->start, vma->end,
+              vma->phys_addr, (vma->end - vma->start) / 1024, vma->name,
+              vma->type == VMA_TYPE_DEMAND ? " (on demand)" : "");
+    }
+    UNLOCK_LOCK(&as->lock);
+}
+
+/**
+ * @brief Adds the pages of a memory map entry to the direct map
+ * @verbatim
+ * Large pages are only used over whole pages of the entry, so one never
+ * covers memory of another type (the SDM leaves large pages over mixed
+ * memory types undefined). Below VM_DIRECT_SMALL_END, where the fixed
+ * range MTRRs make e.g. the VGA window at 0xA0000 uncached, only 4 KB
+ * pages are used. Nothing past the physical limit is mapped.
+ *
+ * @param tlb Gather for the kernel address space
+ * @param base Physical base of the entry, need not be page aligned
+ * @param length Length of the entry in bytes
+ * @param flags Flags of the pages to map
+ */
+static void vm_map_direct(TLB_GATHER *tlb, uint64_t base, uint64_t length,
+                          uint64_t flags) {
+    uint64_t end = PAGE_ALIGN(base + length);
+    uint64_t whole_start = PAGE_ALIGN(base);
+    uint64_t whole_end = (base + length) & ~((uint64_t) PAGE_SIZE - 1);
+    if (end > PAGE_ALIGN(kmem.physical_limit)) {
+        end = PAGE_ALIGN(kmem.physical_limit);
+        whole_end = whole_end < end ? whole_end : end;
+    }
+
+    uint64_t phys = base & ~((uint64_t) PAGE_SIZE - 1);
+    while (phys < end) {
+        uint8_t level = VM_LEVEL_PT;
+        if (phys >= VM_DIRECT_SMALL_END && phys >= whole_start &&
+            phys < whole_end) {
+            level = vm_pick_level(PHYS_TO_VIRT(phys), phys, whole_end - phys);
+        }
+        map_page_entry(tlb, NULL, PHYS_TO_VIRT(phys), phys, flags, level);
+        phys += VM_LEVEL_SIZE(level);
     }
 }
 
@@ -501,24 +1677,53 @@ void vm_init(LIMINE_MEM_REQ req, LIMINE_K_ADDR_REQ k_req) {
 
     size_t i;
 
-    kernel_addr_space.pml4 = kmalloc(DEFAULT_PAGES * PAGE_SIZE);
-    memset(kernel_addr_space.pml4, 0, PAGE_SIZE * DEFAULT_PAGES);
+    vm_gb_pages = check_cpu_support(cpuid_feature_pdpe1gb) == SYS_OK;
+    /* cpu_init turns on CR4.PGE when this is supported */
+    vm_global_pages = check_cpu_support(cpuid_feature_pge) == SYS_OK;
 
-    uint64_t mem_size = 1024 * 512;
+    pgtable_init();
+    tlb_init();
+    kernel_addr_space.pml4 = vm_alloc_table(&kernel_addr_space);
 
-    uint64_t min = NUM_PAGES(kmem.physical_limit) < mem_size ?
-                   NUM_PAGES(kmem.physical_limit) : mem_size;
-
-    vm_map(NULL, MEM_VIRT_OFFSET, 0, min, VM_USERMODE);
+    /* The kernel half never gets new PML4 entries after this, so copying */
+    /* them is enough for new address spaces to see later kernel mappings */
+    for (i = VM_KERNEL_PML4_FIRST; i < PAGE_TABLE_ENTRIES; i++) {
+        uint64_t *pdpt = vm_alloc_table(&kernel_addr_space);
+        vm_set_entry(&kernel_addr_space.pml4[i],
+                     MAKE_TABLE_ENTRY(VIRT_TO_PHYS(pdpt), VM_USERMODE));
+    }
 
-    /* Map the number of pages up to the physical limit */
+    /*
+      The direct map covers RAM up to the physical limit with write-back
+      pages. Reserved entries (firmware data such as the RSDP, and often
+      device registers) are mapped uncached like vm_map_mmio would, holes
+      and bad memory are not mapped at all.
+    */
     size_t num_pages = NUM_PAGES(kmem.physical_limit);
-    for (i = 0; i < num_pages * PAGE_SIZE; i += PAGE_SIZE) {
-        map_page_entry(NULL, MEM_VIRT_OFFSET + i, i, VM_DEFAULT);
+    LOCK_LOCK(&kernel_addr_space.lock);
+    vm_insert_region(&kernel_addr_space, "direct map", MEM_VIRT_OFFSET, 0,
+                     num_pages, VM_DEFAULT);
+    UNLOCK_LOCK(&kernel_addr_space.lock);
+
+    TLB_GATHER tlb;
+    tlb_gather_init(&tlb, &kernel_addr_space);
+    for (i = 0; i < m->entry_count; i++) {
+        struct limine_memmap_entry *entry = m->entries[i];
+
+        if (ENTRY_TYPE_CHECK(entry) ||
+            entry->type == LIMINE_MEMMAP_ACPI_NVS) {
+            vm_map_direct(&tlb, entry->base, entry->length, VM_DEFAULT);
+        } else if (entry->type == LIMINE_MEMMAP_RESERVED) {
+            vm_map_direct(&tlb, entry->base, entry->length, VM_MMIO);
+        }
     }
+    tlb_gather_finish(&tlb);
 
     klogi("Mapped %d MB of pages to %x\n", kmem.physical_limit / (1024 * 1024),
                                            MEM_VIRT_OFFSET);
+    klogi("Direct map leaves: %d 1 GB (%s), %d 2 MB, %d 4 KB\n",
+          vm_leaves[VM_LEVEL_PDPT], vm_gb_pages ? "enabled" : "disabled",
+          vm_leaves[VM_LEVEL_PD], vm_leaves[VM_LEVEL_PT]);
 
     for (i = 0; i < m->entry_count; i++) {
         struct limine_memmap_entry *entry = m->entries[i];
@@ -527,16 +1732,24 @@ void vm_init(LIMINE_MEM_REQ req, LIMINE_K_ADDR_REQ k_req) {
             uint64_t virt_addr = kernel->virtual_base +
                                  entry->base - kernel->physical_base;
             /* Should share for all processes */
-            vm_map(NULL, virt_addr, entry->base, NUM_PAGES(entry->length),
-                   VM_DEFAULT);
+            if (!vm_map_region(NULL, "kernel", virt_addr, entry->base,
+                               NUM_PAGES(entry->length), VM_DEFAULT)) {
+                vm_map(NULL, virt_addr, entry->base,
+                       NUM_PAGES(entry->length), VM_DEFAULT);
+            }
             klogi("Mapped kernel %x to %x - %x\n"
                   "\t(length: %d (%d KB), #%d)\n\t",
                   entry->base, virt_addr, virt_addr + entry->length,
                   entry->length, entry->length / 1024, i);
             ENTRY_INFO(entry)
         } else if (entry->type == LIMINE_MEMMAP_FRAMEBUFFER) {
-            vm_map(NULL, PHYS_TO_VIRT(entry->base), entry->base,
-                   NUM_PAGES(entry->length), VM_DEFAULT);
+            /* Already part of the direct map if below the physical limit */
+            if (!vm_map_region(NULL, "framebuffer", PHYS_TO_VIRT(entry->base),
+                               entry->base, NUM_PAGES(entry->length),
+                               VM_DEFAULT)) {
+                vm_map(NULL, PHYS_TO_VIRT(entry->base), entry->base,
+                       NUM_PAGES(entry->length), VM_DEFAULT);
+            }
             klogi("Mapped framebuffer %x to %x - %x\n"
                   "\t(length: %d (%d KB), #%d)\n\t",
                   entry->base, PHYS_TO_VIRT(entry->base),
@@ -549,8 +1762,7 @@ void vm_init(LIMINE_MEM_REQ req, LIMINE_K_ADDR_REQ k_req) {
                 VIRT_TO_PHYS(kmem.bitmap) < entry->base + entry->length) {
                 part_bitmap = 1;
             }
-            vm_map(NULL, PHYS_TO_VIRT(entry->base), entry->base,
-                   NUM_PAGES(entry->length), VM_DEFAULT);
+            /* Part of the direct map */
             klogi("Mapped usable %x to %x - %x\n"
                   "\t(length: %d (%d KB), #%d, type: %d, %s)\n\t",
                   entry->base, PHYS_TO_VIRT(entry->base),
@@ -560,8 +1772,7 @@ void vm_init(LIMINE_MEM_REQ req, LIMINE_K_ADDR_REQ k_req) {
                   "all tasks accessable");
             ENTRY_INFO(entry)
         } else if (entry->type == LIMINE_MEMMAP_ACPI_RECLAIMABLE) {
-            vm_map(NULL, PHYS_TO_VIRT(entry->base), entry->base,
-                  NUM_PAGES(entry->length), VM_DEFAULT);
+            /* Part of the direct map */
             klogi("Mapped ACPI %x to %x - %x\n"
                   "\t(length: %d (%d KB), #%d)\n\t",
                   entry->base, PHYS_TO_VIRT(entry->base),
@@ -569,8 +1780,7 @@ void vm_init(LIMINE_MEM_REQ req, LIMINE_K_ADDR_REQ k_req) {
                   entry->length, entry->length / 1024, i);
             ENTRY_INFO(entry)
         } else if (entry->type == LIMINE_MEMMAP_BOOTLOADER_RECLAIMABLE) {
-            vm_map(NULL, PHYS_TO_VIRT(entry->base), entry->base,
-                  NUM_PAGES(entry->length), VM_DEFAULT);
+            /* Part of the direct map */
             klogi("Mapped BL memory %x to %x - %x\n"
                   "\t(length: %d (%d KB), #%d)\n\t",
                   entry->base, PHYS_TO_VIRT(entry->base),
@@ -586,12 +1796,25 @@ void vm_init(LIMINE_MEM_REQ req, LIMINE_K_ADDR_REQ k_req) {
         }
     }
 
-    write_cr(cr3, VIRT_TO_PHYS(kernel_addr_space.pml4));
+    tlb_switch(NULL);
+
+    VM_STATS stats;
+    vm_get_stats(NULL, &stats);
+    klogi("Kernel page tables: %d pages (%d KB)\n", stats.table_pages,
+          stats.table_bytes / 1024);
+    pgtable_print_stats();
+    tlb_print_stats();
+    vm_print_regions(NULL);
     klogi("INIT VM: finished...\n");
 }
 
 /**
  * @brief creates an address space of the default size
+ * @verbatim
+ * The kernel half is shared by copying the PML4 entries which point at the
+ * kernel's pre-allocated PDPTs, so this does not depend on how much memory
+ * the kernel has mapped. Only the lower half areas of the kernel address
+ * space are mapped again.
  */
 ADDR_SPACE *create_address_space() {
     ADDR_SPACE *as = kmalloc(sizeof(ADDR_SPACE));
@@ -603,17 +1826,64 @@ ADDR_SPACE *create_address_space() {
 
     memset(as, 0, sizeof(ADDR_SPACE));
 
-    as->pml4 = kmalloc(PAGE_SIZE * DEFAULT_PAGES);
-    if (!as->pml4) {
-        kloge("VM: Cannot give address space default pages, out of memory!\n");
-        kfree(as);
-        return NULL;
-    }
+    as->pml4 = vm_alloc_table(as);
     as->lock = LOCK_NEW();
 
-    for (size_t i = 0; i < vector_len(&global_mem_map); i++) {
-        MEM_MAP map = vector_at(&global_mem_map, i);
-        vm_map(as, map.virt_addr, map.phys_addr, map.num_pages, map.flags);
+    memcpy(&as->pml4[VM_KERNEL_PML4_FIRST],
+           &kernel_addr_space.pml4[VM_KERNEL_PML4_FIRST],
+           (PAGE_TABLE_ENTRIES - VM_KERNEL_PML4_FIRST) * sizeof(uint64_t));
+    *vm_table_live(as->pml4) = PAGE_TABLE_ENTRIES - VM_KERNEL_PML4_FIRST;
+
+    LOCK_LOCK(&kernel_addr_space.lock);
+    for (VMA *vma = vma_first(&kernel_addr_space.vmas);
+         vma && !VM_IS_KERNEL_HALF(vma->start); vma = vma_next(vma)) {
+        if (vma->type != VMA_TYPE_FIXED) {
+            continue;
+        }
+        vm_map_region(as, vma->name, vma->start, vma->phys_addr,
+                      (vma->end - vma->start) / PAGE_SIZE, vma->flags);
     }
+    UNLOCK_LOCK(&kernel_addr_space.lock);
     return as;
 }
+
+/**
+ * @brief Gets the amount of memory used by the page tables of an address
+ *        space
+ *
+ * @param addr_space Address space, NULL for the kernel
+ * @param stats Filled in with the page table usage
+ */
+void vm_get_stats(ADDR_SPACE *addr_space, VM_STATS *stats) {
+    ADDR_SPACE *as = CONVERT_ADDR_SPACE(addr_space);
+    stats->table_pages = as->tables.count;
+    stats->table_bytes = as->tables.count * PAGE_SIZE;
+}
+
+/**
+ * @brief Frees an address space created with create_address_space
+ * @verbatim
+ * Every paging structure of the lower half, including the PML4, is on the
+ * address space's table list, so this is linear in the number of tables and
+ * does not walk the mappings. The shared kernel half belongs to the kernel
+ * address space and is left alone.
+ *
+ * @param addr_space Address space to free, must not be loaded in CR3
+ */
+void destroy_address_space(ADDR_SPACE *addr_space) {
+    if (!addr_space || addr_space == &kernel_addr_space) {
+        return;
+    }
+
+    uint64_t phys;
+    while ((phys = page_list_pop(&addr_space->tables))) {
+        pgtable_free(phys);
+    }
+
+    VMA *vma;
+    while ((vma = vma_first(&addr_space->vmas))) {
+        vma_remove(&addr_space->vmas, vma);
+        kfree(vma);
+    }
+    kfree(addr_space);
+}
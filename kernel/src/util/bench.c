@@ -0,0 +1,809 @@
+/**
+ * @file bench.c
+ * @author Zack Bostock
+ * @brief Boot-time microbenchmarks
+ * @verbatim
+ * Timing is taken from the HPET main counter, so these must be run after
+ * hpet_init. Results are printed to the debug log.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <util/bench.h>
+#include <sys/mmu.h>
+#include <sys/acpi/hpet.h>
+#include <sys/pci.h>
+#include <common/kmalloc.h>
+#include <common/vector.h>
+#include <sys/mem/slab.h>
+#include <sys/mem/vmalloc.h>
+#include <sys/fpu.h>
+
+/**
+ * @brief Small pseudo random number generator (xorshift64) so that
+ *        benchmarks are repeatable between runs
+ *
+ * @param state Generator state, must not be 0
+ * @return uint64_t Next pseudo random number
+ */
+static uint64_t bench_rand(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+/**
+ * @brief Gets a mixed kmalloc request size, mostly small with a long tail
+ *        up to 2 KB
+ *
+ * @param state Generator state
+ * @return uint64_t Request size in bytes
+ */
+static uint64_t bench_kmalloc_size(uint64_t *state) {
+    uint64_t r = bench_rand(state);
+    return 1 + (r >> 8) % (16ULL << (r & 7));
+}
+
+/**
+ * @brief Gets the amount of physical memory which is not handed out,
+ *        including pages cached in the per-CPU magazines, the zero pool and
+ *        the page color bins
+ *
+ * @return uint64_t Free bytes
+ */
+static uint64_t bench_free_bytes() {
+    return pm_free_size() +
+           (pm_magazine_cached() + zero_pool_cached() +
+            page_color_cached()) * PAGE_SIZE;
+}
+
+/**
+ * @brief Gets a timestamp for benchmarking
+ *
+ * @return uint64_t Nanoseconds since the HPET was enabled
+ */
+uint64_t bench_now_ns() {
+    return hpet_get_nanoseconds();
+}
+
+/**
+ * @brief Prints the result of a benchmark
+ *
+ * @param name Name of the benchmark
+ * @param ops Number of operations performed
+ * @param ns Nanoseconds taken for all of the operations
+ */
+void bench_report(const char *name, uint64_t ops, uint64_t ns) {
+    if (!ns) {
+        klogi("BENCH: %s: %d ops, no timer available\n", name, ops);
+        return;
+    }
+    klogi("BENCH: %s: %d ops in %d us, %d ops/sec, %d ns/op\n", name, ops,
+          ns / 1000, (ops * NS_PER_SEC) / ns, ns / ops);
+}
+
+/**
+ * @brief Measures allocations per second of the physical allocator for
+ *        1, 8 and 512 page requests
+ */
+void bench_pm() {
+    static const uint64_t sizes[] = {1, 8, 512};
+    static const char *names[] = {"pm_get 1 page", "pm_get 8 pages",
+                                  "pm_get 512 pages"};
+    static uint64_t addrs[BENCH_PM_BATCH];
+
+    klogi("BENCH: physical memory backend: %s\n", PM_BACKEND_NAME);
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        /* Leave at least half of free memory untouched */
+        uint64_t batch = pm_free_size() / PAGE_SIZE / (2 * sizes[s]);
+        if (batch > BENCH_PM_BATCH) {
+            batch = BENCH_PM_BATCH;
+        }
+        if (!batch) {
+            klogi("BENCH: %s: not enough free memory\n", names[s]);
+            continue;
+        }
+
+        uint64_t ns = 0;
+        uint64_t ops = 0;
+        for (size_t round = 0; round < BENCH_PM_ROUNDS; round++) {
+            uint64_t start = bench_now_ns();
+            for (size_t i = 0; i < batch; i++) {
+                addrs[i] = pm_get(sizes[s], 0x0, 0, __func__, __LINE__);
+            }
+            ns += bench_now_ns() - start;
+            ops += batch;
+
+            for (size_t i = 0; i < batch; i++) {
+                pm_free(addrs[i], sizes[s]);
+            }
+        }
+        bench_report(names[s], ops, ns);
+    }
+}
+
+/**
+ * @brief Measures kmalloc with mixed size alloc/free pairs and vector growth
+ * @verbatim
+ * Reports the physical memory consumed by BENCH_KMALLOC_LIVE live mixed
+ * size allocations against the bytes requested, then the time per
+ * kfree/kmalloc pair while churning those slots, and the time to grow a
+ * PCI_DEVICE vector one element at a time. Build with KMALLOC_SLAB=0 to
+ * get the numbers of the page-only allocator.
+ */
+void bench_kmalloc() {
+    static void *live[BENCH_KMALLOC_LIVE];
+    uint64_t state = 0x2545F4914F6CDD1D;
+    uint64_t requested = 0;
+
+    klogi("BENCH: kmalloc allocator: %s\n", KMALLOC_NAME);
+
+    uint64_t free_before = bench_free_bytes();
+    uint64_t start = bench_now_ns();
+    for (size_t i = 0; i < BENCH_KMALLOC_LIVE; i++) {
+        uint64_t size = bench_kmalloc_size(&state);
+        live[i] = kmalloc(size);
+        requested += size;
+    }
+    uint64_t ns = bench_now_ns() - start;
+    uint64_t used = free_before - bench_free_bytes();
+    bench_report("kmalloc mixed", BENCH_KMALLOC_LIVE, ns);
+    klogi("BENCH: kmalloc mixed: %d bytes requested, %d bytes used, "
+          "%d percent overhead\n", requested, used,
+          used > requested ? (used - requested) * 100 / requested : 0);
+
+    start = bench_now_ns();
+    for (size_t i = 0; i < BENCH_KMALLOC_OPS; i++) {
+        size_t slot = bench_rand(&state) % BENCH_KMALLOC_LIVE;
+        kfree(live[slot]);
+        live[slot] = kmalloc(bench_kmalloc_size(&state));
+    }
+    bench_report("kfree/kmalloc pair", BENCH_KMALLOC_OPS,
+                 bench_now_ns() - start);
+
+    for (size_t i = 0; i < BENCH_KMALLOC_LIVE; i++) {
+        kfree(live[i]);
+    }
+
+    vector_new(PCI_DEVICE, devices);
+    PCI_DEVICE dev = {0};
+    start = bench_now_ns();
+    for (size_t i = 0; i < BENCH_KMALLOC_VEC; i++) {
+        vector_append(&devices, dev);
+    }
+    bench_report("PCI_DEVICE vector_append", BENCH_KMALLOC_VEC,
+                 bench_now_ns() - start);
+    vector_free(&devices);
+
+#if KMALLOC_SLAB
+    slab_print_stats();
+#endif
+}
+
+/**
+ * @brief Touches every benchmark page of the loaded address space
+ *
+ * @return uint64_t Sum of the bytes read, so the reads are not optimized out
+ */
+static uint64_t bench_pcid_touch() {
+    volatile uint8_t *base = (volatile uint8_t *) BENCH_PCID_BASE;
+    uint64_t sum = 0;
+    for (size_t i = 0; i < BENCH_PCID_PAGES; i++) {
+        sum += base[i * PAGE_SIZE];
+    }
+    return sum;
+}
+
+/**
+ * @brief Ping-pongs between two address spaces which each touch their own
+ *        pages, once flushing the TLB on every switch and once with PCIDs
+ * @verbatim
+ * Without PCIDs every CR3 load empties the TLB, so each switch is followed
+ * by a page walk for every page touched. There are no architectural TLB
+ * miss counters, so the walks avoided are counted from the pages touched
+ * and their cost shows up as the difference in time per switch.
+ */
+void bench_pcid() {
+    if (!tlb_pcid_enabled()) {
+        klogi("BENCH: address space switch: PCIDs not supported\n");
+        return;
+    }
+
+    ADDR_SPACE *spaces[2] = {create_address_space(), create_address_space()};
+    uint64_t frames = pm_get(2 * BENCH_PCID_PAGES, 0x0, 0, __func__,
+                             __LINE__);
+    if (!spaces[0] || !spaces[1] || !frames) {
+        klogi("BENCH: address space switch: out of memory\n");
+        return;
+    }
+    for (size_t i = 0; i < 2; i++) {
+        vm_map(spaces[i], BENCH_PCID_BASE,
+               frames + i * BENCH_PCID_PAGES * PAGE_SIZE, BENCH_PCID_PAGES,
+               VM_DEFAULT);
+    }
+
+    uint64_t sum = 0;
+    uint64_t start = bench_now_ns();
+    for (size_t i = 0; i < BENCH_PCID_ROUNDS; i++) {
+        /* No PCID bits and no no-flush bit, as before PCIDs */
+        write_cr(cr3, VIRT_TO_PHYS(spaces[i & 1]->pml4));
+        sum += bench_pcid_touch();
+    }
+    uint64_t flush_ns = bench_now_ns() - start;
+    /* Drop what the last round left cached under the kernel's PCID 0 */
+    write_cr(cr3, VIRT_TO_PHYS(kernel_addr_space.pml4));
+
+    start = bench_now_ns();
+    for (size_t i = 0; i < BENCH_PCID_ROUNDS; i++) {
+        tlb_switch(spaces[i & 1]);
+        sum += bench_pcid_touch();
+    }
+    uint64_t pcid_ns = bench_now_ns() - start;
+
+    tlb_switch(NULL);
+    bench_report("switch + touch, flushing", BENCH_PCID_ROUNDS, flush_ns);
+    bench_report("switch + touch, PCIDs", BENCH_PCID_ROUNDS, pcid_ns);
+    klogi("BENCH: PCIDs avoid up to %d page walks per switch "
+          "(%d in total), %d ns per switch saved\n", BENCH_PCID_PAGES,
+          BENCH_PCID_PAGES * (BENCH_PCID_ROUNDS - 2),
+          flush_ns > pcid_ns ? (flush_ns - pcid_ns) / BENCH_PCID_ROUNDS : 0);
+
+    destroy_address_space(spaces[0]);
+    destroy_address_space(spaces[1]);
+    pm_free(frames, 2 * BENCH_PCID_PAGES);
+    (void) sum;
+}
+
+/**
+ * @brief Touches half of a reserved area, once to fault every page in and
+ *        once more with every page present
+ * @verbatim
+ * The difference between the two passes is the cost of a fault, and the
+ * drop in free memory shows that only the touched half was committed.
+ */
+void bench_fault() {
+    uint64_t touched = BENCH_FAULT_PAGES / 2;
+    volatile uint8_t *area = vm_reserve("fault benchmark",
+                                        BENCH_FAULT_PAGES * PAGE_SIZE,
+                                        VM_DEFAULT);
+    if (!area) {
+        klogi("BENCH: demand paging: out of memory\n");
+        return;
+    }
+
+    uint64_t free_before = bench_free_bytes();
+    uint64_t start = bench_now_ns();
+    for (size_t i = 0; i < touched; i++) {
+        area[i * PAGE_SIZE] = 1;
+    }
+    uint64_t fault_ns = bench_now_ns() - start;
+    uint64_t committed = free_before - bench_free_bytes();
+
+    start = bench_now_ns();
+    for (size_t i = 0; i < touched; i++) {
+        area[i * PAGE_SIZE] = 2;
+    }
+    uint64_t present_ns = bench_now_ns() - start;
+
+    bench_report("first touch (fault)", touched, fault_ns);
+    bench_report("second touch", touched, present_ns);
+    klogi("BENCH: %d of %d reserved pages touched, %d KB committed\n",
+          touched, BENCH_FAULT_PAGES, committed / 1024);
+    fault_print_stats();
+
+    vm_unmap_region(NULL, (uint64_t) area);
+}
+
+/**
+ * @brief Allocates and frees a back buffer sized buffer with kmalloc, which
+ *        needs one physically contiguous run, and with vmalloc
+ */
+void bench_vmalloc() {
+    uint64_t start = bench_now_ns();
+    for (size_t i = 0; i < BENCH_VMALLOC_ROUNDS; i++) {
+        kfree(kmalloc(BENCH_VMALLOC_SIZE));
+    }
+    bench_report("kmalloc + kfree 8 MB", BENCH_VMALLOC_ROUNDS,
+                 bench_now_ns() - start);
+
+    start = bench_now_ns();
+    for (size_t i = 0; i < BENCH_VMALLOC_ROUNDS; i++) {
+        vfree(vmalloc(BENCH_VMALLOC_SIZE));
+    }
+    bench_report("vmalloc + vfree 8 MB", BENCH_VMALLOC_ROUNDS,
+                 bench_now_ns() - start);
+    vmalloc_print_stats();
+}
+
+/**
+ * @brief Allocates runs from every NUMA node with pm_get_node and writes to
+ *        them, then prints the local and remote allocation counts
+ * @verbatim
+ * Runs which did not come from the requested node (because it ran out of
+ * memory) are counted. Under QEMU's -numa options the write times are about
+ * the same for every node, unless the host binds guest memory to its nodes.
+ */
+void bench_numa() {
+    uint64_t runs[BENCH_NUMA_RUNS];
+    uint64_t local = this_cpu()->node;
+
+    for (uint32_t node = 0; node < numa_num_nodes(); node++) {
+        uint64_t misplaced = 0;
+        uint64_t start = bench_now_ns();
+        for (size_t i = 0; i < BENCH_NUMA_RUNS; i++) {
+            runs[i] = pm_get_node(BENCH_NUMA_RUN_PAGES, node, 0, __func__,
+                                  __LINE__);
+            if (pm_page_node(runs[i]) != node) {
+                misplaced++;
+            }
+        }
+        uint64_t alloc_ns = bench_now_ns() - start;
+
+        start = bench_now_ns();
+        for (size_t i = 0; i < BENCH_NUMA_RUNS; i++) {
+            memset((void *) PHYS_TO_VIRT(runs[i]), 0xA5,
+                   BENCH_NUMA_RUN_PAGES * PAGE_SIZE);
+        }
+        uint64_t write_ns = bench_now_ns() - start;
+
+        for (size_t i = 0; i < BENCH_NUMA_RUNS; i++) {
+            pm_free(runs[i], BENCH_NUMA_RUN_PAGES);
+        }
+
+        klogi("BENCH: node %d (distance %d from node %d), %d of %d runs "
+              "from other nodes\n", node, numa_distance(local, node), local,
+              misplaced, BENCH_NUMA_RUNS);
+        bench_report("pm_get_node", BENCH_NUMA_RUNS, alloc_ns);
+        bench_report("write run", BENCH_NUMA_RUNS, write_ns);
+    }
+    pm_numa_print_stats();
+}
+
+/**
+ * @brief Allocates runs with and without PM_DMA32 and checks that the
+ *        DMA32 ones are all below 4 GB
+ * @verbatim
+ * Ordinary runs only land below 4 GB if there is no normal memory, or once
+ * it has run out.
+ */
+void bench_zones() {
+    uint64_t runs[BENCH_ZONE_RUNS];
+    uint64_t flags[2] = {0, PM_DMA32};
+    const char *names[2] = {"pm_get normal", "pm_get DMA32"};
+
+    for (size_t f = 0; f < 2; f++) {
+        uint64_t low = 0;
+        uint64_t start = bench_now_ns();
+        for (size_t i = 0; i < BENCH_ZONE_RUNS; i++) {
+            runs[i] = pm_get(2, 0x0, flags[f], __func__, __LINE__);
+            if (runs[i] + 2 * PAGE_SIZE <= PM_DMA32_LIMIT) {
+                low++;
+            }
+        }
+        uint64_t ns = bench_now_ns() - start;
+
+        for (size_t i = 0; i < BENCH_ZONE_RUNS; i++) {
+            pm_free(runs[i], 2);
+        }
+        bench_report(names[f], BENCH_ZONE_RUNS, ns);
+        klogi("BENCH: %d of %d runs below 4 GB\n", low, BENCH_ZONE_RUNS);
+    }
+}
+
+/**
+ * @brief Maps a buffer of the vmalloc window with colored or ordinary frames
+ *
+ * @param size Bytes, a multiple of the page size
+ * @param colored TRUE to give each page the color of its virtual page
+ * @return volatile uint64_t * Buffer, NULL if out of address space
+ */
+static volatile uint64_t *bench_color_buffer(uint64_t size, uint8_t colored) {
+    VMA *vma = vm_alloc_area("color benchmark", size, PAGE_SIZE,
+                             VMA_TYPE_VMALLOC, VM_DEFAULT);
+    if (!vma) {
+        return NULL;
+    }
+
+    for (uint64_t virt = vma->start; virt < vma->start + size;
+         virt += PAGE_SIZE) {
+        uint64_t phys = colored ? page_color_get(virt / PAGE_SIZE, 0) : 0;
+        if (!phys) {
+            phys = pm_get(1, 0x0, 0, __func__, __LINE__);
+        }
+        vm_map(NULL, virt, phys, 1, VM_DEFAULT);
+    }
+    return (volatile uint64_t *) vma->start;
+}
+
+/**
+ * @brief Walks an LLC sized buffer built from colored frames and one built
+ *        from whatever frames the allocator hands out
+ * @verbatim
+ * Both buffers would fit in the cache if their pages were spread evenly
+ * over the colors. Pages which share a color beyond the cache's ways evict
+ * each other on every pass, which shows up as lower read throughput. The
+ * most pages any one color holds is printed along with the ideal.
+ */
+void bench_color() {
+    CPU_CACHE *llc = cpu_llc();
+    uint64_t colors = page_color_count();
+    if (!llc || colors == 1) {
+        klogi("BENCH: page coloring: cache geometry unknown, skipped\n");
+        return;
+    }
+
+    uint64_t size = llc->size < BENCH_COLOR_MAX_SIZE ? llc->size :
+                                                       BENCH_COLOR_MAX_SIZE;
+    size &= ~((uint64_t) PAGE_SIZE - 1);
+    const char *names[2] = {"walk uncolored buffer", "walk colored buffer"};
+
+    for (uint8_t colored = FALSE; colored <= TRUE; colored++) {
+        volatile uint64_t *buf = bench_color_buffer(size, colored);
+        if (!buf) {
+            klogi("BENCH: page coloring: out of address space\n");
+            return;
+        }
+
+        uint16_t per_color[PAGE_COLOR_MAX] = {0};
+        uint64_t busiest = 0;
+        for (uint64_t off = 0; off < size; off += PAGE_SIZE) {
+            uint64_t phys = vm_get_phys_addr(NULL, (uint64_t) buf + off);
+            uint64_t count = ++per_color[page_color_of(phys)];
+            busiest = count > busiest ? count : busiest;
+        }
+
+        /* One pass to fault the lines in, then the timed passes */
+        uint64_t sum = 0;
+        uint64_t words = size / sizeof(uint64_t);
+        uint64_t stride = llc->line_size / sizeof(uint64_t);
+        for (uint64_t i = 0; i < words; i += stride) {
+            sum += buf[i];
+        }
+        uint64_t start = bench_now_ns();
+        for (uint64_t pass = 0; pass < BENCH_COLOR_PASSES; pass++) {
+            for (uint64_t i = 0; i < words; i += stride) {
+                sum += buf[i];
+            }
+        }
+        uint64_t ns = bench_now_ns() - start;
+        (void) sum;
+
+        bench_report(names[colored], BENCH_COLOR_PASSES, ns);
+        klogi("BENCH: %d KB buffer, %d MB/s, busiest color holds %d pages "
+              "(ideal %d)\n", size / 1024,
+              ns ? BENCH_COLOR_PASSES * size * 1000 / ns : 0,
+              busiest, (size / PAGE_SIZE + colors - 1) / colors);
+        vm_unmap_region(NULL, (uint64_t) buf);
+    }
+    page_color_print_stats();
+}
+
+/**
+ * @brief Prints a throughput in GB/s with two decimals
+ *
+ * @param name Routine which was measured
+ * @param bytes Bytes moved
+ * @param ns Nanoseconds taken
+ */
+static void bench_print_gbps(const char *name, uint64_t bytes, uint64_t ns) {
+    /* Bytes per nanosecond are GB/s, kept in hundredths */
+    uint64_t centi = ns ? bytes * 100 / ns : 0;
+    klogi(" %s %d.%d%d GB/s", name, centi / 100, centi / 10 % 10, centi % 10);
+}
+
+/**
+ * @brief Measures the bandwidth of memcpy, memset and memmove for sizes
+ *        from BENCH_MEM_MIN_SIZE to BENCH_MEM_MAX_SIZE
+ * @verbatim
+ * Each size moves BENCH_MEM_BYTES in total, so small sizes are dominated by
+ * the per call overhead and large ones by memory bandwidth. memmove shifts
+ * the source up by BENCH_MEM_SHIFT bytes, which takes the backward path.
+ * fpu_memcpy (AVX2) is measured too when the CPU has it.
+ */
+void bench_mem() {
+    uint8_t *src = vmalloc(BENCH_MEM_MAX_SIZE + BENCH_MEM_SHIFT);
+    uint8_t *dst = vmalloc(BENCH_MEM_MAX_SIZE);
+    if (!src || !dst) {
+        klogi("BENCH: mem routines: not enough memory\n");
+        vfree(src);
+        vfree(dst);
+        return;
+    }
+
+    for (uint64_t size = BENCH_MEM_MIN_SIZE; size <= BENCH_MEM_MAX_SIZE;
+         size *= 4) {
+        uint64_t rounds = BENCH_MEM_BYTES / size;
+        uint64_t bytes = rounds * size;
+
+        uint64_t start = bench_now_ns();
+        for (uint64_t i = 0; i < rounds; i++) {
+            memcpy(dst, src, size);
+        }
+        uint64_t copy_ns = bench_now_ns() - start;
+
+        start = bench_now_ns();
+        for (uint64_t i = 0; i < rounds; i++) {
+            memset(dst, (int) i, size);
+        }
+        uint64_t set_ns = bench_now_ns() - start;
+
+        start = bench_now_ns();
+        for (uint64_t i = 0; i < rounds; i++) {
+            memmove(src + BENCH_MEM_SHIFT, src, size);
+        }
+        uint64_t move_ns = bench_now_ns() - start;
+
+        /* Sizes below FPU_COPY_THRESHOLD fall back to memcpy */
+        start = bench_now_ns();
+        for (uint64_t i = 0; fpu_has_avx2() && i < rounds; i++) {
+            fpu_memcpy(dst, src, size);
+        }
+        uint64_t avx2_ns = bench_now_ns() - start;
+
+        if (size < 1024) {
+            klogi("BENCH: %d B:", size);
+        } else if (size < 1024 * 1024) {
+            klogi("BENCH: %d KB:", size / 1024);
+        } else {
+            klogi("BENCH: %d MB:", size / (1024 * 1024));
+        }
+        bench_print_gbps("memcpy", bytes, copy_ns);
+        bench_print_gbps("memset", bytes, set_ns);
+        bench_print_gbps("memmove", bytes, move_ns);
+        if (fpu_has_avx2()) {
+            bench_print_gbps("fpu_memcpy", bytes, avx2_ns);
+        }
+        klogi("\n");
+    }
+
+    vfree(src);
+    vfree(dst);
+}
+
+/**
+ * @brief Starts counting last level cache misses in the first
+ *        architectural performance counter
+ *
+ * @return STATUS SYS_ERR if the CPU has no counter for the event
+ */
+static STATUS bench_llc_misses_start() {
+    uint32_t eax, ebx, ecx, edx;
+    if (cpuid(0xA, &eax, &ebx, &ecx, &edx) == SYS_ERR) {
+        return SYS_ERR;
+    }
+
+    /* Version, number of counters, and length of the EBX bit vector */
+    uint32_t version = eax & 0xFF;
+    if (!version || !((eax >> 8) & 0xFF) ||
+        (eax >> 24) <= PERF_EVENT_LLC_MISSES_BIT ||
+        (ebx & (1 << PERF_EVENT_LLC_MISSES_BIT))) {
+        return SYS_ERR;
+    }
+
+    write_msr(MSR_PERFEVTSEL0, 0);
+    write_msr(MSR_PMC0, 0);
+    if (version >= 2) {
+        write_msr(MSR_PERF_GLOBAL_CTRL, read_msr(MSR_PERF_GLOBAL_CTRL) | 1);
+    }
+    write_msr(MSR_PERFEVTSEL0, PERF_EVENT_LLC_MISSES | PERFEVTSEL_USR |
+                               PERFEVTSEL_OS | PERFEVTSEL_ENABLE);
+    return SYS_OK;
+}
+
+/**
+ * @brief Reads one word of every cache line of a buffer
+ *
+ * @param buf Buffer
+ * @param size Bytes
+ * @param line_size Cache line size
+ * @return uint64_t Sum of the words read, so the reads are kept
+ */
+static uint64_t bench_walk(volatile uint64_t *buf, uint64_t size,
+                           uint64_t line_size) {
+    uint64_t sum = 0;
+    uint64_t stride = line_size / sizeof(uint64_t);
+    for (uint64_t i = 0; i < size / sizeof(uint64_t); i += stride) {
+        sum += buf[i];
+    }
+    return sum;
+}
+
+/**
+ * @brief Measures how much clearing and copying pages through the cache
+ *        slows down a workload, against the non-temporal primitives
+ * @verbatim
+ * A workload walks a working set of half the LLC, and between two walks
+ * BENCH_NT_PAGES pages are cleared or copied the way the allocator would.
+ * Stores which go through the cache evict part of the working set, so the
+ * next walk misses. Only one CPU is running at this point, so the workload
+ * is interleaved with the clears rather than run beside them. LLC misses
+ * of the walks are counted with the architectural performance counters
+ * where the CPU has them, the walk time is printed either way.
+ */
+void bench_nt() {
+    CPU_CACHE *llc = cpu_llc();
+    if (!llc) {
+        klogi("BENCH: non-temporal pages: cache geometry unknown, "
+              "skipped\n");
+        return;
+    }
+
+    uint64_t hot_size = llc->size / 2 < BENCH_NT_HOT_MAX ? llc->size / 2 :
+                                                          BENCH_NT_HOT_MAX;
+    hot_size &= ~((uint64_t) PAGE_SIZE - 1);
+    volatile uint64_t *hot = vmalloc(hot_size);
+    uint8_t *src = vmalloc(BENCH_NT_PAGES * PAGE_SIZE);
+    uint8_t *dst = vmalloc(BENCH_NT_PAGES * PAGE_SIZE);
+    if (!hot || !src || !dst) {
+        klogi("BENCH: non-temporal pages: not enough memory\n");
+        vfree((void *) hot);
+        vfree(src);
+        vfree(dst);
+        return;
+    }
+
+    uint8_t counting = bench_llc_misses_start() == SYS_OK;
+    if (!counting) {
+        klogi("BENCH: no architectural LLC miss counter, timing only\n");
+    }
+
+    const char *names[4] = {"memset pages", "page_clear_nt_run",
+                            "memcpy pages", "page_copy_nt_run"};
+    uint64_t sum = 0;
+    for (uint64_t mode = 0; mode < 4; mode++) {
+        uint64_t op_ns = 0;
+        uint64_t walk_ns = 0;
+        uint64_t misses = 0;
+
+        sum += bench_walk(hot, hot_size, llc->line_size);
+        for (uint64_t round = 0; round < BENCH_NT_ROUNDS; round++) {
+            uint64_t start = bench_now_ns();
+            switch (mode) {
+                case 0:
+                    memset(dst, 0, BENCH_NT_PAGES * PAGE_SIZE);
+                    break;
+                case 1:
+                    page_clear_nt_run(dst, BENCH_NT_PAGES);
+                    break;
+                case 2:
+                    memcpy(dst, src, BENCH_NT_PAGES * PAGE_SIZE);
+                    break;
+                default:
+                    page_copy_nt_run(dst, src, BENCH_NT_PAGES);
+                    break;
+            }
+            op_ns += bench_now_ns() - start;
+
+            uint64_t before = counting ? read_msr(MSR_PMC0) : 0;
+            start = bench_now_ns();
+            sum += bench_walk(hot, hot_size, llc->line_size);
+            walk_ns += bench_now_ns() - start;
+            misses += counting ? read_msr(MSR_PMC0) - before : 0;
+        }
+
+        bench_report(names[mode], BENCH_NT_ROUNDS, op_ns);
+        klogi("BENCH: %d KB workload walk after each: %d ns", hot_size / 1024,
+              walk_ns / BENCH_NT_ROUNDS);
+        if (counting) {
+            klogi(", %d LLC misses", misses / BENCH_NT_ROUNDS);
+        }
+        klogi("\n");
+    }
+    (void) sum;
+
+    if (counting) {
+        write_msr(MSR_PERFEVTSEL0, 0);
+    }
+    vfree((void *) hot);
+    vfree(src);
+    vfree(dst);
+}
+
+/* Acquisitions made by each CPU in the current lock benchmark */
+static volatile uint64_t bench_lock_counts[MAX_CPUS];
+/* Written inside the critical section, so the lock line has company */
+static volatile uint64_t bench_lock_shared = 0;
+
+/**
+ * @brief Takes and releases a lock until end_ns, counting acquisitions for
+ *        the calling CPU
+ * @verbatim
+ * Every online CPU is meant to run this at the same time for the same lock.
+ *
+ * @param lock LOCK or QLOCK to contend on
+ * @param queued TRUE if lock is a QLOCK
+ * @param end_ns bench_now_ns value to stop at
+ */
+void bench_lock_worker(void *lock, uint8_t queued, uint64_t end_ns) {
+    uint64_t count = 0;
+
+    while (bench_now_ns() < end_ns) {
+        for (uint64_t i = 0; i < BENCH_LOCK_BATCH; i++) {
+            if (queued) {
+                LOCK_LOCK((QLOCK *) lock);
+                bench_lock_shared++;
+                UNLOCK_LOCK((QLOCK *) lock);
+            } else {
+                LOCK_LOCK((LOCK *) lock);
+                bench_lock_shared++;
+                UNLOCK_LOCK((LOCK *) lock);
+            }
+        }
+        count += BENCH_LOCK_BATCH;
+    }
+    bench_lock_counts[this_cpu()->cpu_number] = count;
+}
+
+/**
+ * @brief Measures acquisitions per second of the ticket and queue locks,
+ *        and how evenly they were spread over the CPUs
+ * @verbatim
+ * The spread is the gap between the CPUs with the most and the fewest
+ * acquisitions, as a percentage of the most. Only the boot CPU is started
+ * so far, so the other CPUs never join in and the numbers are those of an
+ * uncontended lock with a spread of 0.
+ */
+void bench_lock() {
+    static LOCK ticket_lock = {0};
+    static QLOCK queue_lock = {0};
+    const char *names[2] = {"ticket lock", "queue lock"};
+    void *locks[2] = {&ticket_lock, &queue_lock};
+    if (!bench_now_ns()) {
+        klogi("BENCH: locks: no timer available, skipped\n");
+        return;
+    }
+
+    for (uint8_t queued = FALSE; queued <= TRUE; queued++) {
+        for (uint64_t i = 0; i < MAX_CPUS; i++) {
+            bench_lock_counts[i] = 0;
+        }
+
+        uint64_t start = bench_now_ns();
+        bench_lock_worker(locks[queued], queued, start + BENCH_LOCK_NS);
+        uint64_t ns = bench_now_ns() - start;
+
+        uint64_t total = 0;
+        uint64_t most = 0;
+        uint64_t fewest = UINT64_MAX;
+        uint64_t cpus = 0;
+        for (uint64_t i = 0; i < MAX_CPUS; i++) {
+            if (!cpu_locals[i].online) {
+                continue;
+            }
+            uint64_t count = bench_lock_counts[i];
+            total += count;
+            most = count > most ? count : most;
+            fewest = count < fewest ? count : fewest;
+            cpus++;
+        }
+
+        bench_report(names[queued], total, ns);
+        klogi("BENCH: %d CPUs, %d acquisitions/s, spread %d percent\n", cpus,
+              ns ? total * NS_PER_SEC / ns : 0,
+              most ? (most - fewest) * 100 / most : 0);
+    }
+}
+
+/**
+ * @brief Runs all of the boot-time benchmarks
+ */
+void bench_run() {
+    klogi("BENCH: starting...\n");
+    bench_pm();
+    bench_kmalloc();
+    bench_pcid();
+    bench_fault();
+    bench_vmalloc();
+    bench_numa();
+    bench_zones();
+    bench_color();
+    bench_mem();
+    bench_nt();
+    bench_lock();
+    klogi("BENCH: finished...\n");
+}